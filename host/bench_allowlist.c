@@ -0,0 +1,135 @@
+/*
+    Allowlist lookup benchmark: images built by tools/allowlist_build.py, memory-mapped from a
+    file the way the firmware maps its flash partition, looked up with allowlist_lookup().
+
+    For each list size it checks every listed EPC is found and none of as many unlisted ones
+    are, then times both kinds of lookup (random order, so the cache sees what a door sees
+    over a day rather than a hot loop on one badge).
+
+        bench_allowlist [work dir]
+*/
+
+#include "host.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "vm-5f_allowlist.c"
+
+#define BENCH_EPC_LEN   12
+#define BENCH_LOOKUPS   2000000
+#define BENCH_BUILDER   "../tools/allowlist_build.py"
+
+static const uint32_t bench_sizes[] = { 100, 1000, 10000, 45000 };     //45000: about full for the 768 KB partition.
+
+//EPC number i of the list (odd) or not on it (even).
+static void bench_epc(uint32_t i, uint8_t *epc)
+{
+    static const uint8_t prefix[4] = { 0xE2, 0x80, 0x68, 0x94 };
+    uint32_t h = i * 2654435761u;
+
+    memcpy(epc, prefix, 4);
+    for(int b=0; b<4; b++)
+    {
+        epc[4 + b] = (uint8_t)(i >> (24 - 8 * b));
+        epc[8 + b] = (uint8_t)(h >> (24 - 8 * b));
+    }
+}
+
+static int bench_size(const char *dir, uint32_t entries)
+{
+    char txt[256];
+    char img[256];
+    char cmd[768];
+    uint8_t epc[BENCH_EPC_LEN];
+    allowlist_t al;
+    struct stat st;
+    uint32_t rng = 0x9E3779B9;
+    int wrong = 0;
+
+    snprintf(txt, sizeof(txt), "%s/allow_%u.txt", dir, entries);
+    snprintf(img, sizeof(img), "%s/allow_%u.bin", dir, entries);
+    FILE *f = fopen(txt, "w");
+    if(f == NULL)
+    {
+        perror(txt);
+        return -1;
+    }
+    for(uint32_t i=0; i<entries; i++)
+    {
+        bench_epc(2 * i + 1, epc);
+        for(int b=0; b<BENCH_EPC_LEN; b++)
+        {
+            fprintf(f, "%02x", epc[b]);
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    snprintf(cmd, sizeof(cmd), "python3 %s %s %s > /dev/null", BENCH_BUILDER, txt, img);
+    if(system(cmd) != 0)
+    {
+        fprintf(stderr, "%s failed\n", cmd);
+        return -1;
+    }
+
+    const int fd = open(img, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(img);
+        return -1;
+    }
+    const void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED || allowlist_open(&al, base, st.st_size) != 0)
+    {
+        fprintf(stderr, "%s: not a valid image\n", img);
+        return -1;
+    }
+
+    for(uint32_t i=0; i<entries; i++)
+    {
+        bench_epc(2 * i + 1, epc);
+        wrong += (allowlist_lookup(&al, epc, BENCH_EPC_LEN) != 1);
+        bench_epc(2 * i, epc);
+        wrong += (allowlist_lookup(&al, epc, BENCH_EPC_LEN) != 0);
+    }
+
+    //Lookups in random order, hits (odd numbers) and misses (even numbers) timed apart.
+    static uint8_t epcs[BENCH_LOOKUPS / 16][BENCH_EPC_LEN];
+    const int n = sizeof(epcs) / sizeof(epcs[0]);
+    uint64_t ns[2];
+    int found = 0;
+    for(int hit=0; hit<2; hit++)
+    {
+        for(int i=0; i<n; i++)
+        {
+            bench_epc(2 * (host_rand(&rng) % entries) + hit, epcs[i]);
+        }
+        const uint64_t start = host_ns();
+        for(int pass=0; pass<16; pass++)
+        {
+            for(int i=0; i<n; i++)
+            {
+                found += allowlist_lookup(&al, epcs[i], BENCH_EPC_LEN);
+            }
+        }
+        ns[hit] = host_ns() - start;
+    }
+    printf("allowlist %5u EPCs, %6u slots, %7ld bytes: hit %.1f ns, miss %.1f ns per lookup, %d wrong answers \n",
+           entries, al.slot_count, (long) st.st_size, (double) ns[1] / (16.0 * n), (double) ns[0] / (16.0 * n),
+           wrong + (found != 16 * n));
+    munmap((void *) base, st.st_size);
+    return wrong ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "build";
+    int ret = 0;
+
+    for(int i=0; i<sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+    {
+        ret |= bench_size(dir, bench_sizes[i]);
+    }
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+/*
+    Frame parser benchmark: replays captures of the Reader's UART output through the streaming
+    parser (ring_write, frame_parser_next, frame_parser_idle at the end like a line gone idle)
+    and reports frames/s and how often the parser had to resync.
+
+    A capture is the raw byte stream from the Reader's TX line, e.g. a USB serial adapter
+    listening on it:   stty -F /dev/ttyUSB1 115200 raw && cat /dev/ttyUSB1 > reader.cap
+    Without a capture, --synth writes a synthetic one: inventory, buffer and command frames with
+    0xA0 bytes in their data, and line faults (noise, flipped bytes, cut frames) mixed in.
+
+        bench_parser [-n passes] [-c chunk] capture...
+        bench_parser --synth out.cap [frames]
+*/
+
+#include "host.h"
+#include "vm-5f_parser.c"
+
+#define BENCH_CHUNK     120                                             //Bytes per ring_write, the UART FIFO threshold.
+#define BENCH_PASSES    20
+#define SYNTH_FRAMES    100000
+
+//Frame counts by kind, from one pass.
+typedef struct bench_counts
+{
+    uint32_t frames;
+    uint32_t tag_frames;                                                //0x89/0x8A/0x8B with a tag, 0x91.
+    uint32_t bytes_in_frames;
+
+}bench_counts_t;
+
+static void synth_frame(FILE *f, uint8_t cmd, const uint8_t *data, int n)
+{
+    uint8_t frame[300];
+    uint8_t sum = 0;
+
+    frame[0] = FRAME_HEAD;
+    frame[1] = n + 3;
+    frame[2] = 0x01;
+    frame[3] = cmd;
+    memcpy(&frame[4], data, n);
+    for(int i=0; i<n + 4; i++)
+    {
+        sum += frame[i];
+    }
+    frame[n + 4] = (uint8_t)(~sum + 1);
+    fwrite(frame, 1, n + 5, f);
+}
+
+//Write a synthetic capture. Returns 0 on success.
+static int synth_capture(const char *path, int frames)
+{
+    FILE *f = fopen(path, "wb");
+    uint32_t rng = 0x2545F491;
+    uint8_t d[128];
+
+    if(f == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    for(int i=0; i<frames; i++)
+    {
+        const uint32_t r = host_rand(&rng) % 100;
+        //EPC of 2 to 62 bytes, mostly 12, random bytes so 0xA0 shows up inside frames.
+        const int epc_len = (r % 10 == 0) ? 2 * (1 + host_rand(&rng) % 31) : 12;
+        for(int b=0; b<sizeof(d); b++)
+        {
+            d[b] = host_rand(&rng);
+        }
+        if(r < 75)
+        {
+            //Inventory tag frame: Freq/Ant, PC(2), EPC, RSSI.
+            d[1] = (epc_len / 2) << 3;
+            d[2] = 0x00;
+            synth_frame(f, 0x89, d, 4 + epc_len);
+        }
+        else if(r < 85)
+        {
+            //Buffer tag frame: TagCount(2), DataLen, PC(2)+EPC+CRC(2), RSSI, Freq/Ant, InvCount.
+            d[2] = 4 + epc_len;
+            d[3] = (epc_len / 2) << 3;
+            d[4] = 0x00;
+            synth_frame(f, 0x91, d, 10 + epc_len);
+        }
+        else if(r < 92)
+        {
+            synth_frame(f, 0x89, d, 7);                                 //End of round.
+        }
+        else
+        {
+            synth_frame(f, 0x10 + host_rand(&rng) % 0x70, d, 1 + host_rand(&rng) % 3);
+        }
+
+        //Line faults.
+        const uint32_t fault = host_rand(&rng) % 1000;
+        if(fault < 5)
+        {
+            const int n = 1 + host_rand(&rng) % 8;                      //Noise between frames.
+            for(int b=0; b<n; b++)
+            {
+                fputc(host_rand(&rng) & 0xFF, f);
+            }
+        }
+        else if(fault < 7)
+        {
+            fseek(f, -(long)(1 + host_rand(&rng) % 4), SEEK_CUR);       //Frame cut short, the next one overwrites its tail.
+        }
+        else if(fault < 9)
+        {
+            fseek(f, -1, SEEK_CUR);                                     //Flipped checksum byte.
+            fputc(host_rand(&rng) & 0xFF, f);
+        }
+    }
+    fclose(f);
+    printf("%s: %d frames written \n", path, frames);
+    return 0;
+}
+
+static uint8_t* load(const char *path, long *size)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf;
+
+    if(f == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(*size ? *size : 1);
+    if(buf == NULL || fread(buf, 1, *size, f) != (size_t) *size)
+    {
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+static void count_frame(const frame_view_t *frame, bench_counts_t *c)
+{
+    c->frames++;
+    c->bytes_in_frames += frame_size(frame);
+    if((frame->cmd == 0x89 || frame->cmd == 0x8A || frame->cmd == 0x8B) && inventory_frame_kind(frame) == INV_FRAME_TAG)
+    {
+        c->tag_frames++;
+    }
+    else if(frame->cmd == 0x91 && frame_data_len(frame) > 1)
+    {
+        c->tag_frames++;
+    }
+}
+
+//One pass over a capture, chunk bytes at a time.
+static void replay(const uint8_t *buf, long size, int chunk, rx_ring_t *ring, frame_parser_t *parser, bench_counts_t *c)
+{
+    frame_view_t frame;
+
+    ring_init(ring);
+    frame_parser_init(parser, ring);
+    memset(c, 0, sizeof(*c));
+    for(long pos=0; pos<size; pos+=chunk)
+    {
+        ring_write(ring, &buf[pos], (size - pos) < chunk ? (int)(size - pos) : chunk);
+        while(frame_parser_next(parser, &frame))
+        {
+            count_frame(&frame, c);
+        }
+    }
+    while(frame_parser_idle(parser))
+    {
+        while(frame_parser_next(parser, &frame))
+        {
+            count_frame(&frame, c);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static rx_ring_t ring;
+    static frame_parser_t parser;
+    int passes = BENCH_PASSES;
+    int chunk = BENCH_CHUNK;
+    int files = 0;
+
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "--synth") == 0 && i + 1 < argc)
+        {
+            return synth_capture(argv[i + 1], i + 2 < argc ? atoi(argv[i + 2]) : SYNTH_FRAMES) ? 1 : 0;
+        }
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            passes = atoi(argv[++i]);
+            continue;
+        }
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            chunk = atoi(argv[++i]);
+            continue;
+        }
+
+        long size;
+        uint8_t *buf = load(argv[i], &size);
+        bench_counts_t c;
+        if(buf == NULL || passes < 1 || chunk < 1)
+        {
+            return 1;
+        }
+        const uint64_t start = host_ns();
+        for(int p=0; p<passes; p++)
+        {
+            replay(buf, size, chunk, &ring, &parser, &c);
+        }
+        const uint64_t ns = host_ns() - start;
+        const double s = ns / 1e9;
+        printf("%s: %ld bytes x %d passes, %u frames (%u tag frames) per pass, %.2f M frames/s, %.1f ns/frame, %.1f MB/s \n",
+               argv[i], size, passes, c.frames, c.tag_frames, (double) c.frames * passes / s / 1e6,
+               c.frames ? (double) ns / passes / c.frames : 0.0, (double) size * passes / s / 1e6);
+        printf("%s: resync: skipped %u bytes, bad checksum %u, bad len %u, stalled %u; %ld bytes outside frames \n",
+               argv[i], parser.skipped, parser.bad_checksum, parser.bad_len, parser.stalled, size - (long) c.bytes_in_frames);
+        free(buf);
+        files++;
+    }
+    if(files == 0)
+    {
+        fprintf(stderr, "usage: %s [-n passes] [-c chunk] capture...\n       %s --synth out.cap [frames]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return 0;
+}
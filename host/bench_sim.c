@@ -0,0 +1,192 @@
+/*
+    Reader benchmark against the simulated Reader, off target: init time, arrival latency
+    percentiles and frame rates of the firmware's Reader code (vm-5f.c, the parser, tag views
+    and tag table) driven through the transport interface by host_reader.c.
+
+    Latency runs from a simulated tag entering the field to its arrival in the tag table, the
+    point where the firmware publishes the event to the door (the relay follows a queue hop
+    later). Tags already in the field when inventory starts are not timed. Times are virtual
+    (simulated line and air time), except the host CPU figures. There is no health monitor on
+    the host: with the health config the faulty antenna 1 stays the work antenna, so only the
+    realtime mode (fast switch over both antennas) reads tags.
+
+    The log calls are the firmware's: built with LOG_SYNC=1 they print at the call site, inside
+    the timed frame path, and the Reader loop waits out the console line time of every byte
+    printed (virtual, 115200 baud); otherwise they go to the ring and log_drain() prints them once
+    a round, timed apart, off the Reader loop like log_task. Log output goes to the -l file (a
+    temporary file by default), the report to stdout.
+
+    -f sets an EPC filter prefix (hex, whole bytes) for session rounds, with the firmware's unfiltered
+    probe round every 30 s. A read outside the prefix reaching the tag table fails the run.
+
+    --discovery compares the inventory modes on first reads of a dense field instead, like
+    discovery_bench() of the firmware: every tag in the field from the start, 16 slots per round.
+
+        bench_sim [-c defaults|flood|discovery|health|short|filter] [-m realtime|buffered|session] [-t seconds]
+                  [-f prefix] [-l log]
+        bench_sim --discovery
+*/
+
+#include "host_reader.c"
+#include <unistd.h>
+
+#define BENCH_SECONDS   60
+#define DISCOVERY_TIMEOUT 10000                                         //Longest discovery run (ms).
+
+static const uint16_t discovery_tags[] = { 10, 50, 100, 250, 500 };
+
+static const char * const config_names[] = { "defaults", "flood", "discovery", "health", "short", "filter" };
+static const vm5f_sim_config_t configs[] =
+{
+    VM5F_SIM_DEFAULTS, VM5F_SIM_FLOOD_CONFIG, VM5F_SIM_DISCOVERY_CONFIG, VM5F_SIM_HEALTH_CONFIG, VM5F_SIM_SHORT_CONFIG,
+    VM5F_SIM_FILTER_CONFIG,
+};
+
+static int lookup(const char * const *names, int n, const char *name)
+{
+    for(int i=0; i<n; i++)
+    {
+        if(strcmp(names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+    fprintf(stderr, "unknown: %s\n", name);
+    exit(1);
+}
+
+//One discovery run: rounds in the given mode until every tag was read once or DISCOVERY_TIMEOUT.
+static void discovery_run(int mode, uint16_t tags)
+{
+    vm5f_sim_config_t config = VM5F_SIM_DISCOVERY_CONFIG;
+    uint32_t ms = 0;
+    uint32_t t50 = 0;
+    uint32_t t90 = 0;
+
+    config.tags = tags;
+    host_reader_init(&config);
+    host_reader_start(0);
+    const uint32_t start = host_ms();
+    while(host.found < tags && ms < DISCOVERY_TIMEOUT)
+    {
+        host_round(mode);
+        ms = host_ms() - start;
+        if(t50 == 0 && host.found * 2 >= tags)
+        {
+            t50 = ms;
+        }
+        if(t90 == 0 && host.found * 10 >= tags * 9)
+        {
+            t90 = ms;
+        }
+    }
+    printf("discovery %-8s %3u tags: %3u found in %5u ms, 50%% %5u ms, 90%% %5u ms, %4u rounds, %4u new tags/s, %6u line bytes/tag \n",
+           host_mode_names[mode], tags, host.found, ms, t50, t90, host.rounds, ms ? host.found * 1000 / ms : 0,
+           host.found ? (uint32_t)(host.rx_bytes / host.found) : 0);
+}
+
+int main(int argc, char **argv)
+{
+    int config = 0;
+    int mode = HOST_REALTIME;
+    uint32_t seconds = BENCH_SECONDS;
+    const char *log_path = NULL;
+    uint8_t filter[MASK_BITS_MAX / 8];
+    int filter_bits = 0;
+
+    if(argc == 2 && strcmp(argv[1], "--discovery") == 0)
+    {
+        for(int i=0; i<sizeof(discovery_tags) / sizeof(discovery_tags[0]); i++)
+        {
+            for(int mode=HOST_REALTIME; mode<=HOST_SESSION; mode++)
+            {
+                discovery_run(mode, discovery_tags[i]);
+            }
+        }
+        return 0;
+    }
+    for(int i=1; i+1<argc; i+=2)
+    {
+        if(strcmp(argv[i], "-c") == 0)
+        {
+            config = lookup(config_names, sizeof(configs) / sizeof(configs[0]), argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-m") == 0)
+        {
+            mode = lookup(host_mode_names, 3, argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-t") == 0)
+        {
+            seconds = atoi(argv[i + 1]);
+        }
+        else if(strcmp(argv[i], "-f") == 0)
+        {
+            unsigned int byte;
+            for(const char *p=argv[i + 1]; p[0] && p[1] && filter_bits < MASK_BITS_MAX && sscanf(p, "%2x", &byte) == 1; p+=2)
+            {
+                filter[filter_bits / 8] = (uint8_t) byte;
+                filter_bits += 8;
+            }
+        }
+        else if(strcmp(argv[i], "-l") == 0)
+        {
+            log_path = argv[i + 1];
+        }
+    }
+    //The log prints to stdout like on the ESP-32, the report goes to the original stdout.
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    FILE *log = log_path ? fopen(log_path, "w") : tmpfile();
+    if(report == NULL || log == NULL || dup2(fileno(log), STDOUT_FILENO) < 0)
+    {
+        perror(log_path ? log_path : "log file");
+        return 1;
+    }
+
+    const uint64_t host_start = host_ns();
+    host_reader_init(&configs[config]);
+    const int failed = host_reader_start(0);
+    if(failed != 0)
+    {
+        fprintf(report, "init: %d steps failed \n", failed);
+        return 1;
+    }
+    if(filter_bits && host_filter_set(filter, filter_bits) != 0)
+    {
+        fprintf(report, "filter: not set \n");
+        return 1;
+    }
+    const uint32_t start = host_ms();
+    while(host_ms() - start < seconds * 1000)
+    {
+        host_round(mode);
+    }
+    const uint64_t host_total = host_ns() - host_start;
+    const uint32_t ms = host_ms() - start;
+
+    fprintf(report, "bench_sim %s, %s: %u s simulated in %.1f ms host time \n", config_names[config], host_mode_names[mode],
+            ms / 1000, host_total / 1e6);
+    fprintf(report, "init: %u ms \n", host.init_ms);
+    fprintf(report, "arrival latency: p50 %u ms, p99 %u ms, p99.9 %u ms (%u samples) \n", host_latency(500), host_latency(990),
+            host_latency(999), host.latency_count);
+    fprintf(report, "frames: %u (%u tag frames), %u frames/s on the line, reads %u, arrivals %u, departures %u \n",
+            host.frames, host.tag_frames, (uint32_t)((uint64_t) host.frames * 1000 / (ms ? ms : 1)), host.reads,
+            host.arrivals, host.departures);
+    fprintf(report, "rounds: %u, timeouts %u, antenna errors %u, inventory errors %u, bad tag frames %u \n", host.rounds,
+            host.round_timeouts, host.ant_errors, host.inv_errors, host.bad_frames);
+    fprintf(report, "host cpu: %.1f ns/frame (parse, decode, tag table), %.2f M frames/s \n",
+            host.frames ? (double) host.cpu_ns / host.frames : 0.0, host.cpu_ns ? host.frames * 1e3 / host.cpu_ns : 0.0);
+    fprintf(report, "parser: bad checksum %u, bad len %u, skipped %u; sim: commands %u, frames %u, corrupted %u, dropped %u \n",
+            host.parser.bad_checksum, host.parser.bad_len, host.parser.skipped, host.sim.commands, host.sim.frames,
+            host.sim.corrupted, host.sim.dropped);
+    if(filter_bits)
+    {
+        fprintf(report, "filter: %d bits, probes %u, probe tag frames %u, foreign reads %u \n", filter_bits, host.probes,
+                host.probe_frames, host.foreign_reads);
+    }
+    fflush(stdout);
+    fprintf(report, "log: %s, %ld bytes printed, %u ring records, drain %.1f ns/frame, Reader loop held %.1f us/frame printing \n",
+            LOG_SYNC ? "printf at the call (LOG_SYNC)" : "ring", ftell(stdout), log_ring.written,
+            host.frames ? (double) host.log_ns / host.frames : 0.0,
+            host.frames ? (double) host.console_us / host.frames : 0.0);
+    return host.foreign_reads ? 1 : 0;
+}
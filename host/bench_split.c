@@ -0,0 +1,214 @@
+/*
+    Core split benchmark: the firmware's hot path timing histograms (vm-5f_timing.c) with tag
+    aggregation inline in the receive loop, as before the split, and handed to a second thread
+    through the SPSC read ring, as uart_rx_task hands reads to tag_task across the cores.
+
+    The receive thread is host_reader.c against the simulated Reader, paced to real time so the
+    line rate is the Reader's (the flood config by default: tag frames back to back). The tag
+    thread is woken once per batch of frames, like tag_task, and owns the tag table and its
+    sweep. Both modes do the same table work. Stamps are real time on the PC (esp_timer.h here
+    is a clock_gettime() stand-in), so the figures show the shape of the handoff, not ESP-32
+    microseconds:
+        rx->frame       bytes read -> frame parsed; inline it includes the table work of the
+                        frames before it in the same read
+        frame->queue    frame parsed -> read in the tag table (every read, not only arrivals)
+        read handoff    frame parsed -> read taken off the ring by the tag thread (split only)
+
+        bench_split [-c defaults|flood] [-t seconds]
+*/
+
+#define LOG_LEVEL LOG_LEVEL_NONE                                        //Only the histograms on stdout, bench_sim covers the log.
+#include "host_reader.c"
+#include "vm-5f_timing.c"
+#include "vm-5f_spsc.c"
+#include <pthread.h>
+#include <semaphore.h>
+
+#define SPLIT_SECONDS   5
+#define SPLIT_RING_LEN  64                                              //READ_RING_LEN.
+
+//Tag Read: what the receive thread hands over, like read_t of the firmware.
+typedef struct split_read
+{
+    uint8_t epc[TAG_EPC_MAX];
+    uint8_t epc_len;
+    uint8_t ant;
+    uint8_t freq;
+    uint8_t rssi;
+    uint16_t pc;
+    uint16_t count;
+    uint32_t now_ms;                                                    //Virtual time of the read.
+    uint32_t t_frame_us;                                                //Frame parsed, real time.
+
+}split_read_t;
+
+static const char * const config_names[] = { "defaults", "flood" };
+static const vm5f_sim_config_t configs[] = { VM5F_SIM_DEFAULTS, VM5F_SIM_FLOOD_CONFIG };
+
+static int split;                                                       //0: inline, 1: tag thread.
+static spsc_ring_t split_ring;
+static uint8_t split_ring_storage[SPLIT_RING_LEN * sizeof(split_read_t)];
+static sem_t split_wake;
+static volatile int split_stop;
+static int split_pending;                                               //Reads pushed since the last wakeup.
+static uint32_t split_rx_us;                                            //Last read of the transport, real time.
+static uint64_t split_wall_start;
+static uint64_t split_virt_start;
+static uint32_t split_reads;
+static uint32_t split_arrivals;
+static uint32_t split_last_sweep_ms;
+
+static void split_sweep_cb(const tag_entry_t *e, int event, void *ctx)
+{
+    split_arrivals += (event == TAG_ARRIVED);
+}
+
+//Tag aggregation: the table update, and the sweep when due. Runs in whichever thread owns the table.
+static void split_tag(const split_read_t *r)
+{
+    const tag_entry_t *e;
+
+    split_reads++;
+    split_arrivals += (tag_table_update(&host.table, r->epc, r->epc_len, r->pc, r->ant, r->freq, r->rssi, r->count,
+                                        r->now_ms, &e) == TAG_ARRIVED);
+    TIMING_RECORD(TIMING_FRAME_TO_QUEUE, r->t_frame_us, TIMING_NOW());
+    if(r->now_ms - split_last_sweep_ms >= HOST_SWEEP_PERIOD)
+    {
+        tag_table_sweep(&host.table, r->now_ms, split_sweep_cb, NULL);
+        split_last_sweep_ms = r->now_ms;
+    }
+}
+
+//host_reader read hook, in the receive thread: aggregate inline, or push for the tag thread.
+static void split_hook(const tag_view_t *view)
+{
+    split_read_t r;
+
+    memset(&r, 0, sizeof(r));
+    TIMING_STAMP(r.t_frame_us);
+    TIMING_RECORD(TIMING_RX_TO_FRAME, split_rx_us, r.t_frame_us);
+    r.epc_len = tag_view_copy_epc(view, r.epc, sizeof(r.epc));
+    r.ant = tag_view_ant(view);
+    r.freq = tag_view_freq(view);
+    r.rssi = view->rssi;
+    r.pc = view->pc;
+    r.count = view->count;
+    r.now_ms = host_ms();
+    if(!split)
+    {
+        split_tag(&r);
+    }
+    else if(spsc_push(&split_ring, &r))
+    {
+        split_pending = 1;
+    }
+}
+
+//Transport read in real time: wake the tag thread for the batch just dispatched, then hold the
+//bytes back until the wall clock has caught up with the simulated line.
+static int split_io_read(const vm5f_transport_t *io, uint8_t *buf, int max, uint32_t timeout_ms)
+{
+    if(split_pending)
+    {
+        split_pending = 0;
+        sem_post(&split_wake);
+    }
+    const int n = host_io.read(&host_io, buf, max, timeout_ms);
+    const uint64_t due_ns = split_wall_start + (host.now_us - split_virt_start) * 1000;
+    uint64_t now_ns;
+    while((now_ns = host_ns()) < due_ns)
+    {
+        const struct timespec ts = { 0, (long)(due_ns - now_ns) };
+        nanosleep(&ts, NULL);
+    }
+    TIMING_STAMP(split_rx_us);
+    return n;
+}
+
+static const vm5f_transport_t split_io =
+{
+    .name = "host simulator, real time",
+    .write = host_io_write,
+    .read = split_io_read,
+};
+
+static void *split_tag_thread(void *arg)
+{
+    split_read_t r;
+
+    while(1)
+    {
+        sem_wait(&split_wake);
+        while(spsc_pop(&split_ring, &r))
+        {
+            TIMING_RECORD(TIMING_READ_HANDOFF, r.t_frame_us, TIMING_NOW());
+            split_tag(&r);
+        }
+        if(split_stop)
+        {
+            return NULL;
+        }
+    }
+}
+
+static void split_run(int config, uint32_t seconds)
+{
+    pthread_t tag_thread;
+
+    host_reader_init(&configs[config]);
+    host.read_hook = split_hook;
+    vm5f_set_transport(&split_io);
+    spsc_init(&split_ring, split_ring_storage, sizeof(split_read_t), SPLIT_RING_LEN);
+    sem_init(&split_wake, 0, 0);
+    split_stop = 0;
+    split_pending = 0;
+    split_reads = 0;
+    split_arrivals = 0;
+    split_last_sweep_ms = 0;
+    memset(timing_hist, 0, sizeof(timing_hist));
+    if(split)
+    {
+        pthread_create(&tag_thread, NULL, split_tag_thread, NULL);
+    }
+    split_wall_start = host_ns();
+    split_virt_start = host.now_us;
+    host_reader_start(0);
+    const uint32_t start = host_ms();
+    while(host_ms() - start < seconds * 1000)
+    {
+        host_round(HOST_REALTIME);
+    }
+    if(split)
+    {
+        split_stop = 1;
+        sem_post(&split_wake);
+        pthread_join(tag_thread, NULL);
+    }
+    printf("bench_split %s, %s: %u s, %u frames, %u reads aggregated, %u arrivals, ring high water %u of %u, dropped %u \n",
+           config_names[config], split ? "tag thread (split)" : "inline", seconds, host.frames, split_reads, split_arrivals,
+           split_ring.high_water, SPLIT_RING_LEN, split_ring.dropped);
+    timing_report();
+}
+
+int main(int argc, char **argv)
+{
+    int config = 1;
+    uint32_t seconds = SPLIT_SECONDS;
+
+    for(int i=1; i+1<argc; i+=2)
+    {
+        if(strcmp(argv[i], "-c") == 0)
+        {
+            config = strcmp(argv[i + 1], "defaults") == 0 ? 0 : 1;
+        }
+        else if(strcmp(argv[i], "-t") == 0)
+        {
+            seconds = atoi(argv[i + 1]);
+        }
+    }
+    for(split=0; split<2; split++)
+    {
+        split_run(config, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+/*
+    Host stand-in for the ESP-IDF esp_timer.h: esp_timer_get_time() on the monotonic clock, so
+    vm-5f_timing.c stamps real time on the host benchmarks.
+*/
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,56 @@
+/*
+    Shared helpers of the host programs: a clock for the benchmarks and a check macro for the tests.
+
+    The host programs include the firmware modules they need straight from main/ (the portable
+    ones only use standard C), so they test and measure the code that runs on the ESP-32.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//Monotonic time in nanoseconds.
+static inline uint64_t host_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int host_checks = 0;
+static int host_failures = 0;
+
+//Count a check, print it when it fails. The test's exit status is host_failures != 0.
+#define CHECK(cond, ...) \
+    do \
+    { \
+        host_checks++; \
+        if(!(cond)) \
+        { \
+            host_failures++; \
+            printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } \
+    while(0)
+
+//Print the summary line of a test, returns its exit status.
+static inline int host_report(const char *name)
+{
+    printf("%s: %d checks, %d failed\n", name, host_checks, host_failures);
+    return host_failures != 0;
+}
+
+//xorshift32, for repeatable test data.
+static inline uint32_t host_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
@@ -0,0 +1,528 @@
+/*
+    Host reader: the firmware's side of the Reader link, run on a PC against the simulated Reader.
+
+    Commands go out through vm-5f.c, the answers through the frame parser and the tag views into
+    a tag table, as on the ESP-32. The simulator (vm-5f_sim.c) sits behind a vm5f_transport_t
+    with a virtual clock: a read that would wait moves the clock to the next byte due, or to the
+    end of its timeout, instead of sleeping. Minutes of Reader traffic run in well under a second
+    of host time and every run gives the same result. Writing a command takes its line time.
+
+    The FreeRTOS tasks are one loop here: send a command, then read and dispatch frames until its
+    answer or the end of the round. Timeouts and the inventory round sequence are the firmware's.
+    Included by the benchmarks, like vm-5f_main.c includes the modules.
+*/
+
+#include "host.h"
+#include "vm-5f_log.c"
+#include "vm-5f.c"
+#include "vm-5f_parser.c"
+#include "vm-5f_tags.c"
+#include "vm-5f_sim.c"
+
+#define HOST_BYTE_US            87                                      //One byte at 115200 baud, 8N1.
+#define HOST_RX_BUF             512
+#define HOST_RX_IDLE_MS         20                                      //RX_IDLE_TIME of the firmware.
+#define HOST_INIT_TIMEOUT       200                                     //INIT_TIMEOUT, INIT_RETRIES, READER_BOOT_TIMEOUT.
+#define HOST_INIT_RETRIES       3
+#define HOST_BOOT_TIMEOUT       1000
+#define HOST_INVENTORY_TIMEOUT  2000                                    //INVENTORY_TIMEOUT.
+#define HOST_SWEEP_PERIOD       100                                     //TAG_SWEEP_PERIOD.
+#define HOST_ROUND_SEEN_MAX     128                                     //ROUND_SEEN_MAX.
+#define HOST_SAMPLES            65536                                   //Arrival latencies kept.
+#define HOST_REPEAT             3                                       //ANT_SWITCH_REPEAT.
+#define HOST_BUFFER_ROUNDS      5                                       //BUFFER_ROUNDS.
+#define HOST_FILTER_CHECK       30000                                   //EPC_FILTER_CHECK_PERIOD.
+
+#define HOST_REALTIME           0                                       //INVENTORY_REALTIME, INVENTORY_BUFFERED, INVENTORY_SESSION.
+#define HOST_BUFFERED           1
+#define HOST_SESSION            2
+
+static const char * const host_mode_names[] = { "realtime", "buffered", "session" };
+
+//Host Reader state, one Reader.
+typedef struct host_reader
+{
+    vm5f_sim_t sim;
+    uint64_t now_us;                                                    //Virtual clock, the simulator's time.
+    rx_ring_t ring;
+    frame_parser_t parser;
+    tag_table_t table;
+    uint32_t last_sweep_ms;
+    uint32_t start_ms;                                                  //Inventory start, earlier visits are not timed.
+
+    uint8_t resp_cmd;                                                   //Command waiting for its answer, 0: none.
+    uint8_t resp[32];
+    int resp_len;
+    int resp_ready;
+    int round_over;
+    int buffer_expected;
+    int buffer_received;
+    uint8_t session_target;
+    uint32_t round_seen[HOST_ROUND_SEEN_MAX];
+    int round_seen_count;
+    int round_new;
+
+    uint32_t init_ms;
+    uint32_t rx_bytes;
+    uint32_t frames;
+    uint32_t tag_frames;
+    uint32_t reads;
+    uint32_t arrivals;
+    uint32_t departures;
+    uint32_t rounds;
+    uint32_t round_timeouts;
+    uint32_t ant_errors;
+    uint32_t inv_errors;
+    uint32_t bad_frames;                                                //Buffered tag frames skipped, DataLen does not fit.
+    uint8_t filter[MASK_BITS_MAX / 8];                                  //EPC filter prefix, session rounds only.
+    uint8_t filter_bits;                                                //0: no filter.
+    uint32_t filter_check_ms;
+    int probe;                                                          //Unfiltered probe round running.
+    uint32_t probes;
+    uint32_t probe_frames;                                              //Tag frames of probe rounds, counted only.
+    uint32_t foreign_reads;                                             //Reads outside the filter that reached the tag table.
+    uint64_t cpu_ns;                                                    //Host time in parse, decode and tag table.
+    uint64_t log_ns;                                                    //Host time in log_drain() (log_task on the ESP-32).
+    void (*read_hook)(const tag_view_t *view);                          //Set: takes the reads and the sweep instead of host_tag().
+    long console_pos;                                                   //stdout bytes charged to the virtual clock so far.
+    uint64_t console_us;                                                //Virtual time the Reader loop spent printing.
+    uint8_t seen[SIM_TAGS_MAX / 8];                                     //Simulated tags read so far, one bit each.
+    uint32_t found;
+    uint32_t latency[HOST_SAMPLES];                                     //Field entry to arrival (ms).
+    uint32_t latency_count;
+
+}host_reader_t;
+
+static host_reader_t host;
+
+static inline uint32_t host_ms()
+{
+    return (uint32_t)(host.now_us / 1000);
+}
+
+static int host_io_write(const vm5f_transport_t *io, const uint8_t *data, int len)
+{
+    const int n = vm5f_sim_write(&host.sim, data, len, host.now_us);
+
+    host.now_us += len * HOST_BYTE_US;
+    return n;
+}
+
+//Same contract as the UART: bytes due by now, or move the clock until some are due or the timeout ends.
+static int host_io_read(const vm5f_transport_t *io, uint8_t *buf, int max, uint32_t timeout_ms)
+{
+    const uint64_t deadline = host.now_us + timeout_ms * 1000ull;
+
+    while(1)
+    {
+        const int n = vm5f_sim_read(&host.sim, buf, max, host.now_us);
+        if(n > 0)
+        {
+            return n;
+        }
+        const uint64_t due = vm5f_sim_next_due(&host.sim);
+        if(host.now_us >= deadline)
+        {
+            return 0;
+        }
+        if(due > host.now_us)
+        {
+            host.now_us = (due < deadline) ? due : deadline;
+        }
+    }
+}
+
+static const vm5f_transport_t host_io =
+{
+    .name = "host simulator",
+    .write = host_io_write,
+    .read = host_io_read,
+};
+
+void host_reader_init(const vm5f_sim_config_t *config)
+{
+    memset(&host, 0, sizeof(host));
+    vm5f_sim_init(&host.sim, config);
+    ring_init(&host.ring);
+    frame_parser_init(&host.parser, &host.ring);
+    tag_table_init(&host.table, TAG_EXPIRY_MS, TAG_HOLDOFF_MS);
+    log_init();
+    vm5f_set_transport(&host_io);
+}
+
+//Count an EPC once per round, like round_note_epc() of the firmware.
+static int host_round_note(const uint8_t *epc, int len)
+{
+    const uint32_t h = tag_hash(epc, len);
+
+    for(int i=0; i<host.round_seen_count; i++)
+    {
+        if(host.round_seen[i] == h)
+        {
+            return 0;
+        }
+    }
+    if(host.round_seen_count < HOST_ROUND_SEEN_MAX)
+    {
+        host.round_seen[host.round_seen_count++] = h;
+    }
+    return 1;
+}
+
+//Sweep: departures, and arrivals of tags back after their hold-off.
+//Arrival and departure log lines, as tag_task writes them.
+static void host_log_tag(const tag_entry_t *e, int event)
+{
+    LOGI(event == TAG_ARRIVED ? LOG_TAG_ARRIVED : LOG_TAG_DEPARTED, LOG_EPC(e->epc, e->epc_len), e->ant, e->count);
+    LOGD(LOG_TAG_RSSI, e->rssi_min, tag_entry_rssi_mean(e), e->rssi_max);
+}
+
+static void host_sweep_cb(const tag_entry_t *e, int event, void *ctx)
+{
+    host.arrivals += (event == TAG_ARRIVED);
+    host.departures += (event == TAG_DEPARTED);
+    host_log_tag(e, event);
+}
+
+//One decoded read: into the tag table, time the arrival against the simulated field.
+static void host_tag(const tag_view_t *view)
+{
+    uint8_t epc[TAG_EPC_MAX];
+    const tag_entry_t *e;
+    const int len = tag_view_copy_epc(view, epc, sizeof(epc));
+    const uint32_t now = host_ms();
+    const int i = vm5f_sim_tag_index(&host.sim, epc, len);
+    uint32_t since;
+
+    host.reads++;
+    host.round_new += host_round_note(epc, len);
+    for(int b=0; b<host.filter_bits; b++)
+    {
+        if(b >= len * 8 || ((epc[b / 8] ^ host.filter[b / 8]) & (0x80 >> (b % 8))))
+        {
+            host.foreign_reads++;
+            break;
+        }
+    }
+    if(i >= 0 && !(host.seen[i / 8] & (1 << (i % 8))))
+    {
+        host.seen[i / 8] |= 1 << (i % 8);
+        host.found++;
+    }
+    if(tag_table_update(&host.table, epc, len, view->pc, tag_view_ant(view), tag_view_freq(view), view->rssi,
+                        view->count, now, &e) == TAG_ARRIVED)
+    {
+        host.arrivals++;
+        host_log_tag(e, TAG_ARRIVED);
+        if(i >= 0 && vm5f_sim_tag_present(&host.sim, i, now, &since) && (int32_t)(since - host.start_ms) >= 0 &&
+           host.latency_count < HOST_SAMPLES)
+        {
+            host.latency[host.latency_count++] = now - since;
+        }
+    }
+}
+
+static void host_read(const tag_view_t *view)
+{
+    if(host.read_hook != NULL)
+    {
+        host.read_hook(view);
+    }
+    else
+    {
+        host_tag(view);
+    }
+}
+
+//Route one frame, as dispatch_frame() of the firmware does.
+static void host_dispatch(const frame_view_t *frame)
+{
+    tag_view_t view;
+
+    host.frames++;
+    if(frame->cmd == CMD_REAL_TIME_INVENTORY || frame->cmd == CMD_FAST_SWITCH_INVENTORY || frame->cmd == CMD_SESSION_INVENTORY)
+    {
+        const int kind = inventory_frame_kind(frame);
+        if(kind == INV_FRAME_TAG && host.probe)
+        {
+            host.probe_frames++;
+        }
+        else if(kind == INV_FRAME_TAG)
+        {
+            host.tag_frames++;
+            tag_view_inventory(frame, &view);
+            host_read(&view);
+        }
+        else if(kind == INV_FRAME_ANT_ERROR)
+        {
+            host.ant_errors++;
+            LOGW(LOG_ANT_ERROR, frame_data(frame, 0), frame_data(frame, 1));
+        }
+        else
+        {
+            if(kind == INV_FRAME_ERROR)
+            {
+                host.inv_errors++;
+                LOGW(LOG_INVENTORY_ERROR, frame_data(frame, 0));
+            }
+            host.round_over = 1;
+        }
+        return;
+    }
+    if(frame->cmd == CMD_GET_RESET_INV_BUFFER)
+    {
+        if(frame_data_len(frame) == 1)
+        {
+            host.round_over = 1;
+        }
+        else
+        {
+            const int count = tag_view_buffered(frame, &view);
+            if(count < 0)
+            {
+                host.bad_frames++;
+                return;
+            }
+            host.tag_frames++;
+            host.buffer_expected = count;
+            host_read(&view);
+            host.round_over = (++host.buffer_received >= host.buffer_expected);
+        }
+        return;
+    }
+    if(frame->cmd == host.resp_cmd)
+    {
+        host.resp_len = frame_data_len(frame) < sizeof(host.resp) ? frame_data_len(frame) : sizeof(host.resp);
+        for(int i=0; i<host.resp_len; i++)
+        {
+            host.resp[i] = frame_data(frame, i);
+        }
+        host.resp_ready = 1;
+    }
+}
+
+//LOG_SYNC: a print holds its caller for the line time of what it printed, as printf on the console
+//UART does, while the Reader keeps sending. stdout has to be a file for this (see bench_sim).
+static void host_console()
+{
+#if LOG_SYNC
+    const long pos = ftell(stdout);
+    if(pos > host.console_pos)
+    {
+        host.now_us += (uint64_t)(pos - host.console_pos) * HOST_BYTE_US;
+        host.console_us += (uint64_t)(pos - host.console_pos) * HOST_BYTE_US;
+        host.console_pos = pos;
+    }
+#endif
+}
+
+//Read and dispatch frames until *flag is set or timeout_ms of virtual time. Returns 0 when flag got set.
+static int host_wait(volatile int *flag, uint32_t timeout_ms)
+{
+    static uint8_t buf[HOST_RX_BUF];
+    const uint64_t deadline = host.now_us + timeout_ms * 1000ull;
+    frame_view_t frame;
+
+    while(!*flag && host.now_us < deadline)
+    {
+        const uint64_t left_ms = (deadline - host.now_us + 999) / 1000;
+        const int n = vm5f_io->read(vm5f_io, buf, sizeof(buf), left_ms < HOST_RX_IDLE_MS ? left_ms : HOST_RX_IDLE_MS);
+        const uint64_t start = host_ns();
+        if(n == 0)
+        {
+            while(frame_parser_idle(&host.parser))
+            {
+                while(frame_parser_next(&host.parser, &frame))
+                {
+                    host_dispatch(&frame);
+                }
+            }
+        }
+        else
+        {
+            host.rx_bytes += n;
+            ring_write(&host.ring, buf, n);
+            while(frame_parser_next(&host.parser, &frame))
+            {
+                host_dispatch(&frame);
+            }
+        }
+        host.cpu_ns += host_ns() - start;
+        host_console();
+    }
+    return *flag ? 0 : -1;
+}
+
+//Send a command and wait for its answer, like vm5f_command(). Returns 0 with host.resp filled, -1 on timeout.
+int host_command(uint8_t cmd, const uint8_t *params, int nparams, uint32_t timeout_ms)
+{
+    host.resp_cmd = cmd;
+    host.resp_ready = 0;
+    if(vm5f_send(cmd, params, nparams) < 0)
+    {
+        return -1;
+    }
+    const int ret = host_wait(&host.resp_ready, timeout_ms);
+    host.resp_cmd = 0;
+    if(ret != 0)
+    {
+        LOGW(LOG_RX_TIMEOUT);
+    }
+    else
+    {
+        LOGI(LOG_RX_RESPONSE, cmd, host.resp_len);
+    }
+    host_console();
+    return ret;
+}
+
+//Wait for the Reader, then run every init step (reader_init() of the firmware). Returns the failed steps, -1 if
+//the Reader does not answer. host.init_ms is the virtual time it took.
+int host_reader_start(int warm)
+{
+    const uint64_t start = host.now_us;
+    int failed = 0;
+    int up = 0;
+
+    while(!up && host.now_us - start < HOST_BOOT_TIMEOUT * 1000ull)
+    {
+        up = (host_command(CMD_GET_FIRMWARE, NULL, 0, HOST_INIT_TIMEOUT / 2) == 0 && host.resp_len >= 2);
+    }
+    if(!up)
+    {
+        return -1;
+    }
+    for(int i=0; i<INIT_STEP_COUNT; i++)
+    {
+        const init_step_t *step = &init_steps[i];
+        int ok = (warm && step->get_cmd != 0 && host_command(step->get_cmd, NULL, 0, HOST_INIT_TIMEOUT) == 0 &&
+                  host.resp_len >= step->nparams && memcmp(host.resp, step->params, step->nparams) == 0);
+        for(int r=0; r<HOST_INIT_RETRIES && !ok; r++)
+        {
+            ok = (host_command(step->set_cmd, step->params, step->nparams, HOST_INIT_TIMEOUT) == 0 &&
+                  host.resp_len >= 1 && host.resp[0] == RESP_SUCCESS);
+        }
+        failed += !ok;
+    }
+    host.init_ms = (uint32_t)((host.now_us - start) / 1000);
+    host.start_ms = host_ms();
+    host.last_sweep_ms = host_ms();
+    return failed;
+}
+
+//One inventory round in the given mode, as inventory_round() of the firmware runs it with the default
+//config: fast switch over the simulated antennas, session S2 with auto flip, or HOST_BUFFER_ROUNDS
+//buffered rounds. Returns 0 when the round ended, -1 on timeout.
+int host_round(int mode)
+{
+    int ret = 0;
+
+    if(mode != HOST_SESSION)
+    {
+        host.round_seen_count = 0;
+    }
+    host.round_new = 0;
+    host.round_over = 0;
+    //Every HOST_FILTER_CHECK a session round without the SL filter, its tags only counted (epc_filter_round()).
+    host.probe = (mode == HOST_SESSION && host.filter_bits && host_ms() - host.filter_check_ms >= HOST_FILTER_CHECK);
+    if(host.probe)
+    {
+        host.filter_check_ms = host_ms();
+        host.probes++;
+    }
+    if(mode == HOST_BUFFERED)
+    {
+        const uint8_t rounds = HOST_BUFFER_ROUNDS;
+        if(host_command(CMD_INVENTORY, &rounds, 1, HOST_INVENTORY_TIMEOUT) != 0)
+        {
+            ret = -1;
+        }
+        else if(host.resp_len >= 9 && ((host.resp[1] << 8) | host.resp[2]) > 0)
+        {
+            host.buffer_expected = (host.resp[1] << 8) | host.resp[2];
+            host.buffer_received = 0;
+            get_reset_inventory_buffer();
+            ret = host_wait(&host.round_over, HOST_INVENTORY_TIMEOUT);
+        }
+    }
+    else
+    {
+        if(mode == HOST_SESSION)
+        {
+            session_inventory(SESSION_S2, host.session_target, host.probe ? SL_ANY : host.filter_bits ? SL_ASSERTED : SL_NONE,
+                              HOST_REPEAT);
+        }
+        else
+        {
+            ant_step_t seq[ANT_SEQ_LEN];
+            for(int i=0; i<ANT_SEQ_LEN; i++)
+            {
+                seq[i].ant = i < host.sim.cfg.antennas ? i : ANTENNA_NONE;
+                seq[i].stay = i < host.sim.cfg.antennas;
+            }
+            fast_switch_inventory(seq, 0, HOST_REPEAT);
+        }
+        ret = host_wait(&host.round_over, HOST_INVENTORY_TIMEOUT);
+    }
+    if(mode == HOST_SESSION && !host.probe && ret == 0 && host.round_new == 0)
+    {
+        host.session_target ^= 1;
+        host.round_seen_count = 0;
+    }
+    host.rounds++;
+    host.round_timeouts += (ret != 0);
+    if(ret != 0)
+    {
+        LOGW(LOG_INVENTORY_TIMEOUT);
+    }
+    if(host.read_hook == NULL && host_ms() - host.last_sweep_ms >= HOST_SWEEP_PERIOD)
+    {
+        const uint64_t start = host_ns();
+        tag_table_sweep(&host.table, host_ms(), host_sweep_cb, NULL);
+        host.cpu_ns += host_ns() - start;
+        host.last_sweep_ms = host_ms();
+    }
+    host_console();
+    const uint64_t start = host_ns();                               //log_task's turn, once per round.
+    log_drain();
+    host.log_ns += host_ns() - start;
+    return ret;
+}
+
+//Set the EPC filter as epc_filter_set() and epc_filter_apply() of the firmware do, one prefix: a tag mask
+//asserting SL on matching tags, session rounds then only ask for those. Returns 0 when the Reader took it.
+int host_filter_set(const uint8_t *prefix, int bits)
+{
+    uint8_t params[7 + MASK_BITS_MAX / 8];
+    const uint8_t clear = MASK_CLEAR_ALL;
+    const int n = vm5f_tag_mask_params(params, sizeof(params), 1, MASK_TARGET_SL, MASK_ACTION_ASSERT, MEMBANK_EPC,
+                                       MASK_EPC_START, prefix, bits);
+
+    if(n < 0 || host_command(CMD_TAG_MASK, &clear, 1, HOST_INIT_TIMEOUT) != 0 ||
+       host_command(CMD_TAG_MASK, params, n, HOST_INIT_TIMEOUT) != 0 || host.resp_len < 1 || host.resp[0] != RESP_SUCCESS)
+    {
+        return -1;
+    }
+    memcpy(host.filter, prefix, (bits + 7) / 8);
+    host.filter_bits = bits;
+    host.filter_check_ms = host_ms();
+    return 0;
+}
+
+static int host_cmp_u32(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+//Arrival latency percentile (per mille), sorts the samples.
+uint32_t host_latency(uint32_t permille)
+{
+    if(host.latency_count == 0)
+    {
+        return 0;
+    }
+    qsort(host.latency, host.latency_count, sizeof(host.latency[0]), host_cmp_u32);
+    return host.latency[(uint64_t) host.latency_count * permille / 1000];
+}
@@ -0,0 +1,197 @@
+/*
+    Command frame tests: every entry of the command table through vm5f_encode() (head, len,
+    address, params, checksum), the parameter count checks, the command wrappers through a
+    transport that captures what they send, and the precomputed frames.
+*/
+
+#include "host.h"
+#include "vm-5f_log.c"
+#include "vm-5f.c"
+
+//Capture Transport: keeps the last frame written.
+typedef struct capture
+{
+    uint8_t buf[VM5F_FRAME_MAX];
+    int len;
+    int writes;
+
+}capture_t;
+
+static int capture_write(const vm5f_transport_t *io, const uint8_t *data, int len)
+{
+    capture_t *c = io->ctx;
+
+    c->len = len < sizeof(c->buf) ? len : sizeof(c->buf);
+    memcpy(c->buf, data, c->len);
+    c->writes++;
+    return len;
+}
+
+static int capture_read(const vm5f_transport_t *io, uint8_t *buf, int max, uint32_t timeout_ms)
+{
+    return 0;
+}
+
+static capture_t cap;
+static const vm5f_transport_t capture_io = { "capture", capture_write, capture_read, &cap };
+
+//Check one frame byte by byte: head, len, add, cmd, params, and the checksum the spec way
+//(all bytes from head to checksum add up to 0 mod 256).
+static void check_frame(const uint8_t *f, int len, uint8_t add, uint8_t cmd, const uint8_t *params, int nparams, const char *what)
+{
+    uint8_t sum = 0;
+
+    CHECK(len == nparams + 5, "%s: length %d, want %d", what, len, nparams + 5);
+    if(len != nparams + 5)
+    {
+        return;
+    }
+    CHECK(f[0] == 0xA0, "%s: head %02x", what, f[0]);
+    CHECK(f[1] == nparams + 3, "%s: len byte %02x", what, f[1]);
+    CHECK(f[2] == add, "%s: address %02x", what, f[2]);
+    CHECK(f[3] == cmd, "%s: cmd %02x", what, f[3]);
+    CHECK(nparams == 0 || memcmp(&f[4], params, nparams) == 0, "%s: params differ", what);
+    for(int i=0; i<len; i++)
+    {
+        sum += f[i];
+    }
+    CHECK(sum == 0, "%s: checksum %02x, frame sum %02x", what, f[len - 1], sum);
+}
+
+//Send through a wrapper and compare with the expected bytes.
+static void check_sent(int ret, const uint8_t *want, int n, const char *what)
+{
+    CHECK(ret == n, "%s: returned %d, want %d", what, ret, n);
+    CHECK(cap.len == n && memcmp(cap.buf, want, n) == 0, "%s: frame differs (%d bytes sent)", what, cap.len);
+    cap.len = 0;
+}
+
+static void test_table()
+{
+    uint8_t params[VM5F_FRAME_MAX];
+    uint8_t frame[VM5F_FRAME_MAX];
+    const uint8_t adds[] = { 0x00, 0x01, 0x7F, VM5F_BROADCAST };
+
+    for(int i=0; i<sizeof(params); i++)
+    {
+        params[i] = 0xA0 + i * 37;                                      //Head bytes and carries in the checksum.
+    }
+    for(int i=0; i<VM5F_CMD_COUNT; i++)
+    {
+        const vm5f_cmd_desc_t *d = &vm5f_cmd_table[i];
+        const int fixed = d->nparams != VM5F_VAR_PARAMS;
+
+        CHECK(vm5f_cmd_lookup(d->cmd) == d, "%s: lookup finds another entry", d->name);
+        CHECK(d->name != NULL && d->name[0] != 0, "entry %d: no name", i);
+        for(int a=0; a<sizeof(adds); a++)
+        {
+            //Fixed commands take exactly nparams, variable ones anything that fits a frame.
+            const int lo = fixed ? d->nparams : 0;
+            const int hi = fixed ? d->nparams : VM5F_FRAME_MAX - 5;
+            for(int n=lo; n<=hi; n++)
+            {
+                const int len = vm5f_encode(frame, sizeof(frame), adds[a], d->cmd, params, n);
+                check_frame(frame, len, adds[a], d->cmd, params, n, d->name);
+            }
+        }
+        if(fixed)
+        {
+            CHECK(vm5f_encode(frame, sizeof(frame), 0xFF, d->cmd, params, d->nparams + 1) == -1, "%s: extra param accepted", d->name);
+            CHECK(d->nparams == 0 || vm5f_encode(frame, sizeof(frame), 0xFF, d->cmd, params, d->nparams - 1) == -1, "%s: missing param accepted", d->name);
+        }
+        else
+        {
+            CHECK(vm5f_encode(frame, sizeof(frame), 0xFF, d->cmd, params, VM5F_FRAME_MAX - 4) == -1, "%s: oversized frame accepted", d->name);
+        }
+        CHECK(vm5f_encode(frame, 4 + (fixed ? d->nparams : 1), 0xFF, d->cmd, params, fixed ? d->nparams : 1) == -1, "%s: buffer overrun", d->name);
+    }
+    for(int i=0; i<VM5F_CMD_COUNT; i++)
+    {
+        for(int j=i+1; j<VM5F_CMD_COUNT; j++)
+        {
+            CHECK(vm5f_cmd_table[i].cmd != vm5f_cmd_table[j].cmd, "cmd %02x listed twice", vm5f_cmd_table[i].cmd);
+        }
+    }
+    CHECK(vm5f_encode(frame, sizeof(frame), 0xFF, 0x00, NULL, 0) == -1, "unknown command accepted");
+}
+
+static void test_spec_frames()
+{
+    uint8_t f[VM5F_FRAME_MAX];
+    const uint8_t reset[] = { 0xA0, 0x03, 0x01, 0x70, 0xEC };
+    const uint8_t inventory[] = { 0xA0, 0x04, 0xFF, 0x89, 0x01, 0xD3 };
+    const uint8_t work_ant[] = { 0xA0, 0x04, 0xFF, 0x74, 0x00, 0xE9 };
+    const uint8_t region[] = { 0xA0, 0x06, 0xFF, 0x78, 0x02, 0x00, 0x06, 0xDB };
+    const uint8_t get_work_ant[] = { 0xA0, 0x03, 0xFF, 0x75, 0xE9 };
+
+    CHECK(vm5f_encode(f, sizeof(f), 0x01, CMD_RESET, NULL, 0) == 5 && memcmp(f, reset, 5) == 0, "spec reset");
+    CHECK(vm5f_encode(f, sizeof(f), 0xFF, CMD_REAL_TIME_INVENTORY, &inventory[4], 1) == 6 && memcmp(f, inventory, 6) == 0, "spec inventory");
+    CHECK(vm5f_encode(f, sizeof(f), 0xFF, CMD_SET_WORK_ANTENNA, &work_ant[4], 1) == 6 && memcmp(f, work_ant, 6) == 0, "spec work antenna");
+    CHECK(vm5f_encode(f, sizeof(f), 0xFF, CMD_SET_FREQ_REGION, &region[4], 3) == 8 && memcmp(f, region, 8) == 0, "spec region");
+
+    //The precomputed frames match the spec and what vm5f_encode() builds.
+    CHECK(sizeof(frame_real_time_inventory) == 6 && memcmp(frame_real_time_inventory, inventory, 6) == 0, "frame_real_time_inventory");
+    CHECK(sizeof(frame_get_work_antenna) == 5 && memcmp(frame_get_work_antenna, get_work_ant, 5) == 0, "frame_get_work_antenna");
+    CHECK(vm5f_encode(f, sizeof(f), VM5F_BROADCAST, CMD_GET_WORK_ANTENNA, NULL, 0) == 5 && memcmp(f, frame_get_work_antenna, 5) == 0,
+          "frame_get_work_antenna vs vm5f_encode");
+    check_frame(frame_real_time_inventory, sizeof(frame_real_time_inventory), VM5F_BROADCAST, CMD_REAL_TIME_INVENTORY, &inventory[4], 1,
+                "frame_real_time_inventory");
+}
+
+static void test_wrappers()
+{
+    uint8_t f[VM5F_FRAME_MAX];
+    int n;
+
+    vm5f_set_transport(&capture_io);
+
+    //Fixed frames go out as they are.
+    check_sent(real_time_inventory(1), frame_real_time_inventory, sizeof(frame_real_time_inventory), "real_time_inventory(1)");
+    check_sent(getWorkAntenna(), frame_get_work_antenna, sizeof(frame_get_work_antenna), "getWorkAntenna");
+
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_REAL_TIME_INVENTORY, (const uint8_t[]){ 5 }, 1);
+    check_sent(real_time_inventory(5), f, n, "real_time_inventory(5)");
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_SET_FREQ_REGION, (const uint8_t[]){ REGION_ETSI, ETSI_865_00MHZ, ETSI_868_00MHZ }, 3);
+    check_sent(setFreqRegion(REGION_ETSI, ETSI_865_00MHZ, ETSI_868_00MHZ), f, n, "setFreqRegion");
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_READ, (const uint8_t[]){ MEMBANK_TID, 0, 6, 0x12, 0x34, 0x56, 0x78 }, 7);
+    check_sent(read_tag_memory(MEMBANK_TID, 0, 6, 0x12345678), f, n, "read_tag_memory");
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_SET_TEMP_OUTPUT_POWER, (const uint8_t[]){ 30 }, 1);
+    check_sent(setTempOutputPower(30), f, n, "setTempOutputPower");
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_SESSION_INVENTORY, (const uint8_t[]){ SESSION_S1, TARGET_B, SL_ASSERTED, 3 }, 4);
+    check_sent(session_inventory(SESSION_S1, TARGET_B, SL_ASSERTED, 3), f, n, "session_inventory");
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_SESSION_INVENTORY, (const uint8_t[]){ SESSION_S1, TARGET_A, 3 }, 3);
+    check_sent(session_inventory(SESSION_S1, TARGET_A, SL_NONE, 3), f, n, "session_inventory short");
+
+    const ant_step_t seq[ANT_SEQ_LEN] = { { ANTENNA_1, 1 }, { ANTENNA_3, 2 }, { 9, 1 }, { ANTENNA_4, 0 } };
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_FAST_SWITCH_INVENTORY, (const uint8_t[]){ 0, 1, 2, 2, 0xFF, 1, 0xFF, 0, 5, 7 }, 10);
+    check_sent(fast_switch_inventory(seq, 5, 7), f, n, "fast_switch_inventory");
+
+    const uint8_t mask[] = { 0xE2, 0x80, 0x11 };
+    n = vm5f_encode(f, sizeof(f), 0xFF, CMD_TAG_MASK, (const uint8_t[]){ 2, MASK_TARGET_SL, MASK_ACTION_ASSERT, MEMBANK_EPC, MASK_EPC_START, 20, 0xE2, 0x80, 0x11, 0 }, 10);
+    check_sent(setTagMask(2, MASK_TARGET_SL, MASK_ACTION_ASSERT, MEMBANK_EPC, MASK_EPC_START, mask, 20), f, n, "setTagMask");
+
+    //Parameter checks in the wrappers: nothing is sent.
+    cap.writes = 0;
+    CHECK(setWorkAntenna(ANTENNA_4 + 1) == -1, "setWorkAntenna range");
+    CHECK(setOutputPower(POWER_MAX_DBM + 1) == -1 && setOutputPower(POWER_MIN_DBM - 1) == -1, "setOutputPower range");
+    CHECK(setTempOutputPower(POWER_MAX_DBM + 1) == -1 && setTempOutputPower(POWER_MIN_DBM - 1) == -1, "setTempOutputPower range");
+    CHECK(setReadAddress(VM5F_BROADCAST) == -1, "setReadAddress broadcast");
+    CHECK(read_tag_memory(MEMBANK_USER + 1, 0, 1, 0) == -1 && read_tag_memory(MEMBANK_TID, 0, READ_WORDS_MAX + 1, 0) == -1, "read_tag_memory range");
+    CHECK(session_inventory(SESSION_S3 + 1, TARGET_A, SL_NONE, 1) == -1, "session_inventory range");
+    CHECK(setTagMask(MASK_MAX + 1, MASK_TARGET_SL, 0, MEMBANK_EPC, 0, mask, 8) == -1, "setTagMask number");
+    CHECK(setTagMask(1, MASK_TARGET_SL, 0, MEMBANK_EPC, 0, mask, MASK_BITS_MAX + 1) == -1, "setTagMask bits");
+    CHECK(cap.writes == 0, "%d frames sent for bad parameters", cap.writes);
+
+    //An addressed Reader.
+    n = vm5f_encode(f, sizeof(f), 0x05, CMD_GET_FIRMWARE, NULL, 0);
+    check_sent(vm5f_send_to(&capture_io, 0x05, CMD_GET_FIRMWARE, NULL, 0), f, n, "vm5f_send_to");
+    CHECK(vm5f_send_to(&capture_io, 0x05, CMD_GET_FIRMWARE, f, 1) == -1 && cap.len == 0, "vm5f_send_to bad params");
+}
+
+int main()
+{
+    test_table();
+    test_spec_frames();
+    test_wrappers();
+    return host_report("test_encode");
+}
@@ -0,0 +1,300 @@
+/*
+    Journal tests on the file backed flash (NOR semantics: writes only clear bits, erase sets 0xFF):
+    fresh log and boot count, remount after a power cut, a torn block, a block with a bad record
+    CRC, running round the partition, and a failed sector header write.
+
+    A power cut is a journal_t thrown away without a flush, then mounted again from the image.
+    The flash goes through a wrapper that can cut a write short or fail it, at a given address.
+*/
+
+#include "host.h"
+#include <stddef.h>
+#include "vm-5f_journal.c"
+
+#define TEST_SECTORS    4
+#define TEST_SIZE       (TEST_SECTORS * JOURNAL_SECTOR_SIZE)
+
+//Test Flash: the file image, and the next fault to inject.
+typedef struct test_flash
+{
+    journal_flash_t file;
+    int64_t fault_addr;                                                 //Write at this address fails or is cut, -1: none.
+    uint32_t torn_len;                                                  //0: the write fails, else only this many bytes are written.
+    uint32_t writes;
+
+}test_flash_t;
+
+static int test_read(void *ctx, uint32_t addr, void *buf, uint32_t len)
+{
+    test_flash_t *t = ctx;
+    return t->file.read(t->file.ctx, addr, buf, len);
+}
+
+static int test_write(void *ctx, uint32_t addr, const void *buf, uint32_t len)
+{
+    test_flash_t *t = ctx;
+
+    t->writes++;
+    if(t->fault_addr == addr)
+    {
+        t->fault_addr = -1;
+        if(t->torn_len == 0)
+        {
+            return -1;
+        }
+        t->file.write(t->file.ctx, addr, buf, t->torn_len);
+        return 0;                                                       //Power went before the rest, nobody saw an error.
+    }
+    return t->file.write(t->file.ctx, addr, buf, len);
+}
+
+static int test_erase(void *ctx, uint32_t addr, uint32_t len)
+{
+    test_flash_t *t = ctx;
+    return t->file.erase(t->file.ctx, addr, len);
+}
+
+static FILE *image;
+static test_flash_t tflash;
+static journal_flash_t flash;
+
+//Fresh image of zeros (not an erased or valid log), wrapped.
+static void image_new()
+{
+    static const uint8_t zero[JOURNAL_SECTOR_SIZE];
+
+    if(image != NULL)
+    {
+        fclose(image);
+    }
+    image = tmpfile();
+    for(int s=0; s<TEST_SECTORS; s++)
+    {
+        fwrite(zero, 1, sizeof(zero), image);
+    }
+    fflush(image);
+    memset(&tflash, 0, sizeof(tflash));
+    journal_flash_file(&tflash.file, image, TEST_SIZE);
+    tflash.fault_addr = -1;
+    flash.read = test_read;
+    flash.write = test_write;
+    flash.erase = test_erase;
+    flash.size = TEST_SIZE;
+    flash.ctx = &tflash;
+}
+
+static void record(journal_record_t *r, uint32_t i)
+{
+    memset(r, 0, sizeof(*r));
+    r->time_ms = i * 10;
+    r->event = JOURNAL_EV_ARRIVED;
+    r->action = JOURNAL_ACT_LOCKED;
+    r->epc_len = JOURNAL_EPC_MAX;
+    memset(r->epc, (uint8_t) i, JOURNAL_EPC_MAX);
+    r->reads = i;
+}
+
+//What an export saw: blocks, records, and whether the seqs ran on without gaps or going back.
+typedef struct export_check
+{
+    int blocks;
+    int records;
+    uint32_t first_seq;
+    uint32_t last_seq;
+    int gaps;
+    int bad;                                                            //Records whose content does not match their seq.
+
+}export_check_t;
+
+static void export_cb(const uint8_t *block, int len, void *ctx)
+{
+    export_check_t *e = ctx;
+    journal_header_t h;
+    journal_record_t r;
+
+    memcpy(&h, block, sizeof(h));
+    for(int i=0; i<h.count; i++)
+    {
+        memcpy(&r, &block[JOURNAL_HEADER_SIZE + i * JOURNAL_RECORD_SIZE], sizeof(r));
+        if(e->records == 0)
+        {
+            e->first_seq = r.seq;
+        }
+        else if(r.seq != e->last_seq + 1)
+        {
+            e->gaps++;
+        }
+        e->bad += (r.reads != r.seq || r.epc[0] != (uint8_t) r.seq || r.boot != h.boot);
+        e->last_seq = r.seq;
+        e->records++;
+    }
+    e->blocks++;
+}
+
+static export_check_t export_all(journal_t *j)
+{
+    export_check_t e;
+
+    memset(&e, 0, sizeof(e));
+    CHECK(journal_export(j, export_cb, &e) == e.blocks, "export block count");
+    return e;
+}
+
+//Append records first..first+n-1 (their seq must match, see export_cb).
+static void append(journal_t *j, uint32_t first, int n)
+{
+    journal_record_t r;
+
+    for(int i=0; i<n; i++)
+    {
+        record(&r, first + i);
+        journal_append(j, &r);
+    }
+}
+
+static void test_fresh_and_remount()
+{
+    journal_t j;
+    export_check_t e;
+
+    image_new();
+    CHECK(journal_mount(&j, &flash) == 0, "mount fresh");
+    CHECK(j.boot == 1, "fresh log boot %u, want 1", j.boot);
+    CHECK(j.head_sector == 0 && j.head_block == 0 && j.next_seq == 0, "fresh head %u/%u seq %u", j.head_sector, j.head_block, j.next_seq);
+
+    append(&j, 0, 10);                                                  //One full block written, 3 records in the batch.
+    CHECK(j.blocks_written == 1 && j.batch_count == 3, "auto flush: %u blocks, batch %d", j.blocks_written, j.batch_count);
+    CHECK(journal_flush(&j) == 0 && j.blocks_written == 2, "flush");
+
+    CHECK(journal_mount(&j, &flash) == 0, "remount");
+    CHECK(j.boot == 2, "boot after remount %u, want 2", j.boot);
+    CHECK(j.head_block == 2 && j.next_seq == 10 && j.torn == 0, "remount head %u seq %u torn %u", j.head_block, j.next_seq, j.torn);
+    e = export_all(&j);
+    CHECK(e.blocks == 2 && e.records == 10 && e.first_seq == 0 && e.last_seq == 9 && e.gaps == 0 && e.bad == 0,
+          "export: %d blocks %d records %u..%u gaps %d bad %d", e.blocks, e.records, e.first_seq, e.last_seq, e.gaps, e.bad);
+
+    //Power cut with records in the RAM batch: they are gone, numbering goes on from the last block.
+    //Boot 2 wrote nothing, so the log has no trace of it and this boot is numbered 2 again.
+    append(&j, 10, 3);
+    CHECK(journal_mount(&j, &flash) == 0, "mount after power cut");
+    CHECK(j.boot == 2 && j.next_seq == 10 && j.head_block == 2, "after power cut boot %u seq %u head %u", j.boot, j.next_seq, j.head_block);
+    append(&j, 10, 2);
+    CHECK(journal_flush(&j) == 0, "flush after power cut");
+    e = export_all(&j);
+    CHECK(e.records == 12 && e.last_seq == 11 && e.gaps == 0 && e.bad == 0, "export after power cut: %d records, last %u", e.records, e.last_seq);
+}
+
+static void test_torn_and_bad_crc()
+{
+    journal_t j;
+    export_check_t e;
+    uint8_t flip = 0x00;
+
+    image_new();
+    journal_mount(&j, &flash);
+    append(&j, 0, 7);                                                   //Block 0.
+
+    //Power goes half way through block 1: the header made it, the records did not.
+    tflash.fault_addr = journal_addr(0, 1);
+    tflash.torn_len = JOURNAL_HEADER_SIZE + 40;
+    append(&j, 7, 7);
+    CHECK(journal_mount(&j, &flash) == 0, "mount after torn write");
+    CHECK(j.torn == 0 && j.head_block == 2, "torn block: torn %u head %u", j.torn, j.head_block);
+    CHECK(j.next_seq == 14, "next seq %u: the torn block's header counts", j.next_seq);
+    e = export_all(&j);
+    CHECK(e.blocks == 1 && e.records == 7 && e.last_seq == 6, "export skips the torn block: %d blocks, %d records", e.blocks, e.records);
+
+    //Power goes inside the header of block 2: mount counts it torn and writes on after it.
+    tflash.fault_addr = journal_addr(0, 2);
+    tflash.torn_len = 10;
+    append(&j, 14, 7);
+    CHECK(journal_mount(&j, &flash) == 0, "mount after torn header");
+    CHECK(j.torn == 1 && j.head_block == 3 && j.next_seq == 14, "torn header: torn %u head %u seq %u", j.torn, j.head_block, j.next_seq);
+    append(&j, 14, 7);                                                  //Block 3.
+    append(&j, 21, 7);                                                  //Block 4.
+
+    //A bit flip in a record of block 3 (flash can only clear bits): its records CRC fails.
+    fseek(image, journal_addr(0, 3) + JOURNAL_HEADER_SIZE + offsetof(journal_record_t, epc), SEEK_SET);
+    fwrite(&flip, 1, 1, image);
+    fflush(image);
+    CHECK(journal_mount(&j, &flash) == 0, "mount with a bad record crc");
+    e = export_all(&j);
+    CHECK(e.blocks == 2 && e.records == 14 && e.first_seq == 0 && e.last_seq == 27 && e.bad == 0,
+          "export skips the bad crc block: %d blocks, %d records, %u..%u", e.blocks, e.records, e.first_seq, e.last_seq);
+    CHECK(j.next_seq == 28 && j.head_block == 5, "next seq %u head %u", j.next_seq, j.head_block);
+}
+
+static void test_wrap()
+{
+    const int blocks = TEST_SECTORS * JOURNAL_SECTOR_BLOCKS * 2 + 5;    //Twice round and a bit.
+    journal_t j;
+    export_check_t e;
+    uint32_t seq = 0;
+
+    image_new();
+    journal_mount(&j, &flash);
+    for(int b=0; b<blocks; b++)
+    {
+        append(&j, seq, 3);
+        seq += 3;
+        CHECK(journal_flush(&j) == 0, "flush %d", b);
+    }
+    const uint32_t head = ((blocks - 1) / JOURNAL_SECTOR_BLOCKS) % TEST_SECTORS;
+    CHECK(j.head_sector == head && j.head_block == 5, "head %u/%u, want %u/5", j.head_sector, j.head_block, head);
+    CHECK(j.errors == 0 && j.lost == 0, "errors %u lost %u", j.errors, j.lost);
+
+    CHECK(journal_mount(&j, &flash) == 0, "mount after wrap");
+    CHECK(j.head_sector == head && j.head_block == 5 && j.next_seq == seq && j.boot == 2,
+          "remount after wrap: head %u/%u seq %u boot %u", j.head_sector, j.head_block, j.next_seq, j.boot);
+
+    //The head sector's successor was erased when the head moved there: 3 full sectors plus 5 blocks are left.
+    e = export_all(&j);
+    const int kept = (TEST_SECTORS - 1) * JOURNAL_SECTOR_BLOCKS + 5;
+    CHECK(e.blocks == kept && e.records == kept * 3 && e.last_seq == seq - 1 && e.gaps == 0 && e.bad == 0,
+          "export after wrap: %d blocks (want %d), %u..%u, gaps %d", e.blocks, kept, e.first_seq, e.last_seq, e.gaps);
+}
+
+static void test_sector_header_fails()
+{
+    journal_t j;
+    export_check_t e;
+    uint32_t seq = 0;
+
+    image_new();
+    journal_mount(&j, &flash);
+    for(int b=0; b<JOURNAL_SECTOR_BLOCKS; b++)                          //Fill sector 0.
+    {
+        append(&j, seq, 7);
+        seq += 7;
+    }
+    //The first block of sector 1 fails to write: the batch goes to sector 2 instead.
+    tflash.fault_addr = journal_addr(1, 0);
+    tflash.torn_len = 0;
+    append(&j, seq, 7);
+    seq += 7;
+    CHECK(j.errors == 1 && j.lost == 0, "header write failure: errors %u lost %u", j.errors, j.lost);
+    CHECK(j.head_sector == 2 && j.head_block == 1, "moved on to %u/%u, want 2/1", j.head_sector, j.head_block);
+    append(&j, seq, 14);
+    seq += 14;
+
+    CHECK(journal_mount(&j, &flash) == 0, "remount");
+    CHECK(j.head_sector == 2 && j.head_block == 3 && j.next_seq == seq, "remount head %u/%u seq %u, want 2/3 %u",
+          j.head_sector, j.head_block, j.next_seq, seq);
+    e = export_all(&j);
+    CHECK(e.records == (int) seq && e.gaps == 0 && e.bad == 0, "export: %d records of %u, gaps %d", e.records, seq, e.gaps);
+
+    //A failure on any other block: that block is lost, the sector goes on.
+    tflash.fault_addr = journal_addr(2, 3);
+    append(&j, seq, 7);
+    CHECK(j.lost == 7 && j.head_sector == 2 && j.head_block == 4, "later block failure: lost %u head %u/%u", j.lost, j.head_sector, j.head_block);
+}
+
+int main()
+{
+    test_fresh_and_remount();
+    test_torn_and_bad_crc();
+    test_wrap();
+    test_sector_header_fails();
+    fclose(image);
+    return host_report("test_journal");
+}
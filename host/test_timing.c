@@ -0,0 +1,76 @@
+/*
+    Timing histogram tests: timing_take() against a writer thread that keeps recording, as
+    stats_task reports while the tasks on both cores record. Every sample has to turn up in
+    exactly one take, and every take has to be whole: its count the sum of its buckets.
+*/
+
+#include "host.h"
+#include <pthread.h>
+#include "vm-5f_timing.c"
+
+#define TEST_SAMPLES    4000000
+#define TEST_HIST       TIMING_READ_HANDOFF
+
+static volatile int writer_done;
+
+//Interval of sample i (us): spread over the buckets.
+static inline uint32_t sample_us(uint32_t i)
+{
+    return (i * 2654435761u) >> (12 + i % 20);
+}
+
+static void *writer(void *arg)
+{
+    for(uint32_t i=0; i<TEST_SAMPLES; i++)
+    {
+        timing_record(TEST_HIST, 0, sample_us(i));
+    }
+    writer_done = 1;
+    return NULL;
+}
+
+//Take the histogram while the writer records, then once more after it is done.
+static void test_take_concurrent()
+{
+    pthread_t thread;
+    timing_hist_t t;
+    uint64_t count = 0;
+    uint64_t sum_us = 0;
+    uint64_t want_us = 0;
+    int takes = 0;
+    int torn = 0;
+
+    memset(timing_hist, 0, sizeof(timing_hist));
+    writer_done = 0;
+    pthread_create(&thread, NULL, writer, NULL);
+    int last = 0;
+    while(!last)
+    {
+        last = writer_done;
+        timing_take(TEST_HIST, &t);
+        uint32_t buckets = 0;
+        for(int k=0; k<TIMING_BUCKETS; k++)
+        {
+            buckets += t.bucket[k];
+        }
+        torn += (buckets != t.count);
+        count += t.count;
+        sum_us += t.sum_us;
+        takes++;
+    }
+    pthread_join(thread, NULL);
+    for(uint32_t i=0; i<TEST_SAMPLES; i++)
+    {
+        want_us += sample_us(i);
+    }
+    CHECK(takes > 2, "only %d takes while the writer ran", takes);
+    CHECK(torn == 0, "%d of %d takes with a count not matching their buckets", torn, takes);
+    CHECK(count == TEST_SAMPLES, "%llu samples taken of %u", (unsigned long long) count, TEST_SAMPLES);
+    CHECK(sum_us == want_us, "sum %llu us, want %llu us", (unsigned long long) sum_us, (unsigned long long) want_us);
+}
+
+int main()
+{
+    test_take_concurrent();
+    return host_report("test_timing");
+}
@@ -1,3 +1,5 @@
 #
 # Main Makefile. This is basically the same as a component makefile.
 #
+# vm-5f_main.c pulls in the other .c files itself, so only it gets compiled.
+COMPONENT_OBJS := vm-5f_main.o
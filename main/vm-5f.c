@@ -1,309 +1,533 @@
 /*
     Includes functions for setting up and getting data from VM-5F RFID Reader.
+
+    Host command frame: head(0xA0), len, add, cmd, params..., check.
+    len counts add, cmd, params and check. check is the two's complement of the sum of all bytes before it.
+    All frames are built by vm5f_encode() from the command table below, into a buffer owned by the caller,
+    so tasks sending at the same time can not corrupt each other's frames.
+    Bytes go through a vm5f_transport_t (the UART, or the simulated Reader in vm-5f_sim.c), so this
+    file does not depend on the ESP-32 drivers. vm5f_send() talks to the one Reader on vm5f_io at the
+    broadcast address, vm5f_send_to() to one addressed Reader of several sharing a bus.
 */
 
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
-#include "driver/gpio.h"
-#include "driver/uart.h"
-#include "soc/uart_struct.h"
-
-//Response Data Packet Definition Structure.
-typedef struct RData_packet                                  
-{
-    unsigned char head;
-    unsigned char len;
-    unsigned char add;
-    unsigned char cmd;
-    unsigned char data[27];
-    unsigned char check;
-        
-}RData_packet;
-
-//Host Command Data Packet Definition Array.
-unsigned char DPacket_send[8];
+#include <stdint.h>
+
+#define VM5F_HEAD           0xA0
+#define VM5F_BROADCAST      0xFF                                        //Public address, every Reader answers.
+#define VM5F_FRAME_MAX      64                                          //Largest host command frame.
+#define VM5F_VAR_PARAMS     0xFF                                        //Descriptor flag: parameter count is not fixed.
+
+/***************************** Command Codes ***************************************/
+#define CMD_SET_ANT_DETECT          0x62
+#define CMD_GET_ANT_DETECT          0x63
+#define CMD_SET_TEMP_OUTPUT_POWER   0x66                                //Not stored: for frequent changes, a reset goes back to 0x76.
+#define CMD_RESET                   0x70
+#define CMD_SET_BAUD_RATE           0x71
+#define CMD_GET_FIRMWARE            0x72
+#define CMD_SET_READER_ADDRESS      0x73
+#define CMD_SET_WORK_ANTENNA        0x74
+#define CMD_GET_WORK_ANTENNA        0x75
+#define CMD_SET_OUTPUT_POWER        0x76                                //Stored in the Reader's flash: once, at init.
+#define CMD_GET_OUTPUT_POWER        0x77
+#define CMD_SET_FREQ_REGION         0x78
+#define CMD_GET_FREQ_REGION         0x79
+#define CMD_GET_READER_TEMP         0x7B
+#define CMD_SET_DRM                 0x7C
+#define CMD_GET_DRM                 0x7D
+#define CMD_GET_RETURN_LOSS         0x7E
+#define CMD_INVENTORY               0x80
+#define CMD_READ                    0x81
+#define CMD_GET_RESET_INV_BUFFER    0x91
+#define CMD_REAL_TIME_INVENTORY     0x89
+#define CMD_FAST_SWITCH_INVENTORY   0x8A
+#define CMD_SESSION_INVENTORY       0x8B
+#define CMD_TAG_MASK                0x98
+
+/***************************** Response Codes ***************************************/
+#define RESP_SUCCESS                0x10                                //Set command accepted.
+#define RESP_FAIL                   0x11
+#define ERR_ANT_MISSING             0x22                                //Antenna detection: nothing connected to the antenna.
+
+/***************************** Parameter Values ***************************************/
+#define REGION_FCC                  0x01
+#define REGION_ETSI                 0x02
+#define REGION_CHN                  0x03
+#define ETSI_865_00MHZ              0x00                                //ETSI channel index, 865.00 MHz.
+#define ETSI_866_50MHZ              0x03                                //ETSI channel index, 866.50 MHz.
+#define ETSI_868_00MHZ              0x06                                //ETSI channel index, 868.00 MHz.
+#define BAUD_38400                  0x03
+#define BAUD_115200                 0x04
+#define ANTENNA_1                   0x00
+#define ANTENNA_2                   0x01
+#define ANTENNA_3                   0x02
+#define ANTENNA_4                   0x03
+#define ANTENNA_NONE                0xFF                                //Fast switch: skip this sequence slot.
+#define ANT_SEQ_LEN                 4                                   //Slots in a fast switch antenna sequence.
+#define POWER_MIN_DBM               20
+#define POWER_MAX_DBM               33
+#define POWER_DEFAULT_DBM           26
+#define DRM_CLOSE                   0x00
+#define DRM_OPEN                    0x01
+#define ANT_DETECT_OFF              0x00
+#define ANT_DETECT_ON               0x01
+#define SESSION_S0                  0x00                                //Inventoried flag kept while the tag is powered.
+#define SESSION_S1                  0x01                                //Flag falls back to A after 0.5 to 5 s, powered or not.
+#define SESSION_S2                  0x02                                //Flag kept while powered, and 2 s+ without power.
+#define SESSION_S3                  0x03
+#define TARGET_A                    0x00
+#define TARGET_B                    0x01
+#define SL_ANY                      0x00                                //Select flag ignored.
+#define SL_DEASSERTED               0x02                                //Only tags with SL deasserted.
+#define SL_ASSERTED                 0x03                                //Only tags with SL asserted.
+#define SL_NONE                     0xFF                                //Leave the SL byte out (Session, Target, Repeat form).
+#define MASK_MAX                    5                                   //Masks the Reader holds, numbered 1 to MASK_MAX.
+#define MASK_CLEAR_ALL              0x00                                //Clear: every mask.
+#define MASK_QUERY                  0x20                                //Answer: one frame per mask, MaskNo, MaskCount, then the mask.
+#define MASK_TARGET_SL              0x04                                //Mask target: S0-S3 are the session values, 4 the SL flag.
+#define MASK_ACTION_ASSERT          0x00                                //Matching tags assert (SL, or flag A), the others deassert.
+#define MASK_ACTION_ASSERT_MATCH    0x01                                //Matching tags assert, the others are left alone.
+#define MEMBANK_RESERVED            0x00
+#define MEMBANK_EPC                 0x01
+#define MEMBANK_TID                 0x02
+#define MEMBANK_USER                0x03
+#define READ_WORDS_MAX              32                                  //Most words one read command returns per tag.
+#define MASK_EPC_START              0x20                                //Bit address of the EPC in the EPC bank (after CRC and PC).
+#define MASK_BITS_MAX               96
+
+//Antenna Sequence Slot for fast switch inventory: antenna and number of inventory rounds spent on it.
+typedef struct ant_step
+{
+    uint8_t ant;
+    uint8_t stay;
+
+}ant_step_t;
 
+//Transport: how frames reach the Reader and responses come back.
+typedef struct vm5f_transport
+{
+    const char *name;
+    int (*write)(const struct vm5f_transport *io, const uint8_t *data, int len);        //Returns bytes written, -1 on error.
+    int (*read)(const struct vm5f_transport *io, uint8_t *buf, int max, uint32_t timeout_ms);   //Returns bytes read, 0 on timeout, -1 after lost input.
+    void *ctx;                                                          //Port state of this instance (several UARTs share the functions).
+
+}vm5f_transport_t;
+
+static const vm5f_transport_t *vm5f_io = NULL;
+
+//Select the transport, before the first command is sent.
+void vm5f_set_transport(const vm5f_transport_t *io)
+{
+    vm5f_io = io;
+}
+
+//Command Descriptor: how many parameter bytes a command takes, and whether sending it is printed.
+typedef struct vm5f_cmd_desc
+{
+    uint8_t cmd;
+    uint8_t nparams;
+    uint8_t verbose;
+    const char *name;
+
+}vm5f_cmd_desc_t;
+
+static const vm5f_cmd_desc_t vm5f_cmd_table[] =
+{
+    { CMD_SET_ANT_DETECT,       1, 1, "set antenna detect" },
+    { CMD_GET_ANT_DETECT,       0, 1, "get antenna detect" },
+    { CMD_SET_TEMP_OUTPUT_POWER, 1, 0, "set temporary output power" },
+    { CMD_RESET,                0, 1, "reset" },
+    { CMD_SET_BAUD_RATE,        1, 1, "set baud rate" },
+    { CMD_GET_FIRMWARE,         0, 1, "get firmware" },
+    { CMD_SET_READER_ADDRESS,   1, 1, "set reader address" },
+    { CMD_SET_WORK_ANTENNA,     1, 0, "set work antenna" },
+    { CMD_GET_WORK_ANTENNA,     0, 1, "get work antenna" },
+    { CMD_SET_OUTPUT_POWER,     1, 1, "set output power" },
+    { CMD_GET_OUTPUT_POWER,     0, 1, "get output power" },
+    { CMD_SET_FREQ_REGION,      3, 1, "set freq region" },
+    { CMD_GET_FREQ_REGION,      0, 1, "get freq region" },
+    { CMD_GET_READER_TEMP,      0, 0, "get reader temperature" },
+    { CMD_SET_DRM,              1, 1, "set drm" },
+    { CMD_GET_DRM,              0, 1, "get drm" },
+    { CMD_GET_RETURN_LOSS,      1, 0, "get rf port return loss" },
+    { CMD_INVENTORY,            1, 0, "inventory" },
+    { CMD_READ,                 7, 0, "read tag memory" },
+    { CMD_GET_RESET_INV_BUFFER, 0, 0, "get and reset inventory buffer" },
+    { CMD_REAL_TIME_INVENTORY,  1, 0, "real time inventory" },
+    { CMD_FAST_SWITCH_INVENTORY, 10, 0, "fast switch antenna inventory" },
+    { CMD_SESSION_INVENTORY,    VM5F_VAR_PARAMS, 0, "customized session target inventory" },
+    { CMD_TAG_MASK,             VM5F_VAR_PARAMS, 1, "tag mask" },
+};
+
+#define VM5F_CMD_COUNT (sizeof(vm5f_cmd_table) / sizeof(vm5f_cmd_table[0]))
+
+/***************************** Precomputed Frames ***************************************/
+//Checksum as a constant expression, so fixed frames are finished at build time.
+#define VM5F_CHECK(sum)                 ((uint8_t)(0x100 - ((sum) & 0xFF)))
+#define VM5F_FRAME0(add, cmd)           { VM5F_HEAD, 0x03, (add), (cmd), \
+                                          VM5F_CHECK(VM5F_HEAD + 0x03 + (add) + (cmd)) }
+#define VM5F_FRAME1(add, cmd, p0)       { VM5F_HEAD, 0x04, (add), (cmd), (p0), \
+                                          VM5F_CHECK(VM5F_HEAD + 0x04 + (add) + (cmd) + (p0)) }
+
+static const uint8_t frame_real_time_inventory[] = VM5F_FRAME1(VM5F_BROADCAST, CMD_REAL_TIME_INVENTORY, 0x01);
+static const uint8_t frame_get_work_antenna[] = VM5F_FRAME0(VM5F_BROADCAST, CMD_GET_WORK_ANTENNA);
+
+//Known-good frames from the VM-5F protocol spec, checked at build time.
+_Static_assert(VM5F_CHECK(VM5F_HEAD + 0x03 + 0x01 + CMD_RESET) == 0xEC, "spec: A0 03 01 70 EC");
+_Static_assert(VM5F_CHECK(VM5F_HEAD + 0x04 + 0xFF + CMD_REAL_TIME_INVENTORY + 0x01) == 0xD3, "spec: A0 04 FF 89 01 D3");
+_Static_assert(VM5F_CHECK(VM5F_HEAD + 0x04 + 0xFF + CMD_SET_WORK_ANTENNA + ANTENNA_1) == 0xE9, "spec: A0 04 FF 74 00 E9");
+_Static_assert(VM5F_CHECK(VM5F_HEAD + 0x06 + 0xFF + CMD_SET_FREQ_REGION + REGION_ETSI + ETSI_865_00MHZ + ETSI_868_00MHZ) == 0xDB, "spec: A0 06 FF 78 02 00 06 DB");
+
+//Checksum of a host command or response frame.
+static inline uint8_t vm5f_checksum(const uint8_t *buf, int len)
+{
+    uint8_t sum = 0;
+    for(int i=0; i<len; i++)
+    {
+        sum += buf[i];
+    }
+    return (uint8_t)(~sum + 1);
+}
+
+//Find a command in the table, NULL if unknown.
+static const vm5f_cmd_desc_t* vm5f_cmd_lookup(uint8_t cmd)
+{
+    for(int i=0; i<VM5F_CMD_COUNT; i++)
+    {
+        if(vm5f_cmd_table[i].cmd == cmd)
+        {
+            return &vm5f_cmd_table[i];
+        }
+    }
+    return NULL;
+}
+
+//Build a command frame into buf. Returns frame length, or -1 if the command or parameter count is wrong
+//or buf is too small.
+int vm5f_encode(uint8_t *buf, int max, uint8_t add, uint8_t cmd, const uint8_t *params, int nparams)
+{
+    const vm5f_cmd_desc_t *desc = vm5f_cmd_lookup(cmd);
+    if(desc == NULL || (desc->nparams != VM5F_VAR_PARAMS && desc->nparams != nparams))
+    {
+        return -1;
+    }
+
+    const int len = nparams + 5;
+    if(len > max || len > VM5F_FRAME_MAX)
+    {
+        return -1;
+    }
+    buf[0] = VM5F_HEAD;
+    buf[1] = nparams + 3;
+    buf[2] = add;
+    buf[3] = cmd;
+    if(nparams > 0)
+    {
+        memcpy(&buf[4], params, nparams);
+    }
+    buf[len - 1] = vm5f_checksum(buf, len - 1);
+    return len;
+}
+
+//Write a ready made frame to the Reader.
+static int vm5f_write(const uint8_t *frame, int len)
+{
+    return vm5f_io->write(vm5f_io, frame, len);
+}
+
+//Encode a command on the caller's stack and send it over io to the Reader at add.
+int vm5f_send_to(const vm5f_transport_t *io, uint8_t add, uint8_t cmd, const uint8_t *params, int nparams)
+{
+    uint8_t frame[VM5F_FRAME_MAX];
+
+    const int len = vm5f_encode(frame, sizeof(frame), add, cmd, params, nparams);
+    if(len < 0)
+    {
+        LOGE(LOG_CMD_BAD_PARAMS, cmd);
+        return -1;
+    }
+    const int txBytes = io->write(io, frame, len);
+    if(vm5f_cmd_lookup(cmd)->verbose)
+    {
+        LOGD(LOG_CMD_SENT, cmd, frame[len - 1]);
+    }
+    return txBytes;
+}
+
+//Encode a command on the caller's stack and send it to the Reader.
+int vm5f_send(uint8_t cmd, const uint8_t *params, int nparams)
+{
+    return vm5f_send_to(vm5f_io, VM5F_BROADCAST, cmd, params, nparams);
+}
+
+/***************************** Reader Init ***************************************/
+//Reader Init Step: a setting to write, and the command that reads it back (0 if it can not be read back).
+//The steps run in this order once the Reader answers.
+typedef struct init_step
+{
+    uint8_t set_cmd;
+    uint8_t params[3];
+    uint8_t nparams;
+    uint8_t get_cmd;
+
+}init_step_t;
+
+static const init_step_t init_steps[] =
+{
+    { CMD_SET_FREQ_REGION,  { REGION_ETSI, ETSI_865_00MHZ, ETSI_868_00MHZ }, 3, CMD_GET_FREQ_REGION },
+    { CMD_SET_BAUD_RATE,    { BAUD_115200 },                                 1, 0 },
+    { CMD_SET_DRM,          { DRM_OPEN },                                    1, CMD_GET_DRM },
+    { CMD_SET_ANT_DETECT,   { ANT_DETECT_ON },                               1, CMD_GET_ANT_DETECT },
+    { CMD_SET_WORK_ANTENNA, { ANTENNA_1 },                                   1, CMD_GET_WORK_ANTENNA },
+    { CMD_SET_OUTPUT_POWER, { POWER_DEFAULT_DBM },                           1, CMD_GET_OUTPUT_POWER },
+};
+
+#define INIT_STEP_COUNT (sizeof(init_steps) / sizeof(init_steps[0]))
+
+/***************************** Reader Commands ***************************************/
 //Reset the RFID Reader.
 int resetVM_5F()
 {
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x70;
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+    return vm5f_send(CMD_RESET, NULL, 0);
 }
 
 //Get VM-5F RFID Reader Firmware Version.
-unsigned char getFirmware()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x72;             //get Firmware version cmd 0x72.
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+int getFirmware()
+{
+    return vm5f_send(CMD_GET_FIRMWARE, NULL, 0);
 }
 
-//Set up RF Frequency Spectrum(we will use ETSI Spectrum Regulation, with Freq Range: (0x00)865.00 MHz to (0x06)868.00 MHz).
-unsigned char setFreqRegion()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x06;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x78;         //set freq region cmd 0x78
-    DPacket_send[4] = 0x02;         //Spectrum Regulation: ETSI
-    DPacket_send[5] = 0x00;         //Start Freq - 865.00 MHz
-    DPacket_send[6] = 0x06;         //Stop Freq - 868.00 MHz
-    DPacket_send[7] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4] + DPacket_send[5] + DPacket_send[6]) * 0xFF) & 0xFF);
-    
-    const int len = 8;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[7]);
-    return txBytes;
+//Set up RF Frequency Spectrum (we use ETSI Spectrum Regulation, REGION_ETSI from ETSI_865_00MHZ to ETSI_868_00MHZ).
+int setFreqRegion(uint8_t region, uint8_t start, uint8_t stop)
+{
+    const uint8_t params[3] = { region, start, stop };
+    return vm5f_send(CMD_SET_FREQ_REGION, params, sizeof(params));
 }
 
-//Get RF Frequency Spectrum
-unsigned char getFreqRegion()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x79;         //get freq region cmd 0x79
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+//Get RF Frequency Spectrum.
+int getFreqRegion()
+{
+    return vm5f_send(CMD_GET_FREQ_REGION, NULL, 0);
 }
 
-//Set up VM-5F RFID Reader UART baud rate to 115200 bps (0x71, 0x04).
-unsigned char setBaudRate()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x71;         //set Baud Rate cmd 0x71
-    DPacket_send[4] = 0x04;         //Baud rate set to 115200 bps.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]/*dpack->cmd*/);
-    printf("Checksum: %02x \n", DPacket_send[5]/*dpack->check*/);
-    return txBytes;
+//Set up VM-5F RFID Reader UART baud rate (BAUD_115200 = 115200 bps).
+int setBaudRate(uint8_t baud)
+{
+    return vm5f_send(CMD_SET_BAUD_RATE, &baud, 1);
 }
 
-//Set up working Antenna.
-unsigned char setWorkAntenna()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x74;         //set working antenna cmd 0x74
-    DPacket_send[4] = 0x00;         //Antenna ID: Antenna 1 - 0x00.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    //printf("Command send: %02x \n", DPacket_send[3]);
-    //printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Get the Reader's temperature. Answer: sign (1: plus, 0: minus), degrees C.
+int getReaderTemperature()
+{
+    return vm5f_send(CMD_GET_READER_TEMP, NULL, 0);
+}
+
+//Get the return loss (dB) of the work antenna, measured at ETSI channel index freq.
+int getReturnLoss(uint8_t freq)
+{
+    return vm5f_send(CMD_GET_RETURN_LOSS, &freq, 1);
+}
+
+//Set up working Antenna (ANTENNA_1 to ANTENNA_4).
+int setWorkAntenna(uint8_t ant)
+{
+    if(ant > ANTENNA_4)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_SET_WORK_ANTENNA, &ant, 1);
 }
 
 //Get query about working Antenna.
-unsigned char getWorkAntenna()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x75;         //get working antenna cmd 0x75
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+int getWorkAntenna()
+{
+    return vm5f_write(frame_get_work_antenna, sizeof(frame_get_work_antenna));
 }
 
-//Set up RF Output Power(from 20 to 33 dBm, 0x14 to 0x21, resp).
-unsigned char setOutputPower()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x76;         //set RF output power cmd 0x76
-    DPacket_send[4] = 0x1A;         //set Power at: 26 dBm.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Set up RF Output Power in dBm (POWER_MIN_DBM to POWER_MAX_DBM).
+int setOutputPower(uint8_t dbm)
+{
+    if(dbm < POWER_MIN_DBM || dbm > POWER_MAX_DBM)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_SET_OUTPUT_POWER, &dbm, 1);
 }
 
-//Get RF Output Power(from 20 to 33 dBm, 0x14 to 0x21, resp).
-unsigned char getOutputPower()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x77;         //set RF output power cmd 0x77
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+//Set up RF Output Power in dBm (POWER_MIN_DBM to POWER_MAX_DBM) without storing it in the Reader's
+//flash, for power that changes often. A Reader reset goes back to the setOutputPower() value.
+int setTempOutputPower(uint8_t dbm)
+{
+    if(dbm < POWER_MIN_DBM || dbm > POWER_MAX_DBM)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_SET_TEMP_OUTPUT_POWER, &dbm, 1);
 }
 
-//Set DRM Mode.
-unsigned char setDRM()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x7C;         //set DRM Mode cmd 0x7C
-    DPacket_send[4] = 0x01;         //set DRM mode to OPEN DRM.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Get RF Output Power in dBm.
+int getOutputPower()
+{
+    return vm5f_send(CMD_GET_OUTPUT_POWER, NULL, 0);
+}
+
+//Set DRM Mode (DRM_OPEN/DRM_CLOSE).
+int setDRM(uint8_t mode)
+{
+    return vm5f_send(CMD_SET_DRM, &mode, 1);
 }
 
 //Get DRM Mode.
-unsigned char getDRM()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x7D;         //get DRM Mode status cmd 0x7D
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+int getDRM()
+{
+    return vm5f_send(CMD_GET_DRM, NULL, 0);
 }
 
-//Set Antenna Detection On/Off.
-unsigned char setAntDetect()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x62;         //set Antenna detection mode cmd 0x62
-    DPacket_send[4] = 0x01;         //Open Antenna detector connection
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Set Antenna Detection On/Off (ANT_DETECT_ON/ANT_DETECT_OFF).
+int setAntDetect(uint8_t mode)
+{
+    return vm5f_send(CMD_SET_ANT_DETECT, &mode, 1);
 }
 
 //Get Antenna Detection Mode status.
-unsigned char getAntDetect()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x03;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x63;         //get Antenna detection mode status cmd 0x63
-    DPacket_send[4] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3]) * 0xFF) & 0xFF);
-    
-    const int len = 5;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[4]);
-    return txBytes;
+int getAntDetect()
+{
+    return vm5f_send(CMD_GET_ANT_DETECT, NULL, 0);
 }
 
-//Set Reader Address.
-unsigned char setReadAddress()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x73;         //set Reader's Address cmd 0x73
-    DPacket_send[4] = 0x00;         //Address can be set from 0 to 254.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Set Reader Address (0 to 254).
+int setReadAddress(uint8_t address)
+{
+    if(address == VM5F_BROADCAST)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_SET_READER_ADDRESS, &address, 1);
 }
 
 /***************************** EPC C1 Gen2 Commands ***************************************/
-//Real Time Inventory detecting/reading tags.
-unsigned char real_time_inventory()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x89;         //Read realtime tags cmd 0x89
-    DPacket_send[4] = 0x01;         //1 RF carrier freq hopping channel used per inventory round.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    //printf("Command send: %02x \n", DPacket_send[3]);
-    //printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
+//Real Time Inventory detecting/reading tags, with the given number of RF carrier freq hopping channels per round.
+int real_time_inventory(uint8_t channels)
+{
+    if(channels == frame_real_time_inventory[4])
+    {
+        return vm5f_write(frame_real_time_inventory, sizeof(frame_real_time_inventory));
+    }
+    return vm5f_send(CMD_REAL_TIME_INVENTORY, &channels, 1);
 }
 
-//Name Inventory detecting/reading tags.
-unsigned char name_inventory()
-{
-    DPacket_send[0] = 0xA0;
-    DPacket_send[1] = 0x04;
-    DPacket_send[2] = 0xFF;
-    DPacket_send[3] = 0x80;         //Read tags cmd 0x80
-    DPacket_send[4] = 0x01;         //1 RF carrier freq hopping channel used per inventory round.
-    DPacket_send[5] = (((DPacket_send[0] + DPacket_send[1] + DPacket_send[2] + DPacket_send[3] + DPacket_send[4]) * 0xFF) & 0xFF);
-    
-    const int len = 6;
-    const int txBytes = uart_write_bytes(UART_NUM_2, (const char*) &DPacket_send[0], len);
-    //printf("len = %d \n", len);
-    printf("Command send: %02x \n", DPacket_send[3]);
-    printf("Checksum: %02x \n", DPacket_send[5]);
-    return txBytes;
-}
\ No newline at end of file
+//Name Inventory detecting/reading tags into the Reader's buffer, the given number of rounds.
+//The Reader answers once at the end with AntID, TagCount(2), ReadRate(2), TotalRead(4).
+int name_inventory(uint8_t rounds)
+{
+    return vm5f_send(CMD_INVENTORY, &rounds, 1);
+}
+
+//Read out and clear the Reader's de-duplicated tag buffer. One frame per tag comes back:
+//TagCount(2), DataLen, PC(2)+EPC+CRC(2), RSSI, Freq/Ant, InvCount.
+int get_reset_inventory_buffer()
+{
+    return vm5f_send(CMD_GET_RESET_INV_BUFFER, NULL, 0);
+}
+
+//Read word_cnt words from word_add of membank (MEMBANK_*) on every tag in reach of the work antenna,
+//password 0 for unlocked memory. One frame per tag comes back:
+//TagCount(2), DataLen, PC(2)+EPC+CRC(2)+Data, ReadLen, Freq/Ant, ReadCount. 1 data byte: error, no tag read.
+int read_tag_memory(uint8_t membank, uint8_t word_add, uint8_t word_cnt, uint32_t password)
+{
+    const uint8_t params[7] = { membank, word_add, word_cnt, password >> 24, password >> 16, password >> 8, password };
+
+    if(membank > MEMBANK_USER || word_cnt == 0 || word_cnt > READ_WORDS_MAX)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_READ, params, sizeof(params));
+}
+
+//Parameters of a set tag mask command: MaskNo, Target, Action, MemBank, StartAdd, MaskBitLen, Mask, Truncate.
+//The Reader runs a Gen2 Select with each mask before every inventory round. Returns the parameter count, -1 if
+//they do not fit in max.
+int vm5f_tag_mask_params(uint8_t *params, int max, uint8_t no, uint8_t target, uint8_t action, uint8_t membank,
+                         uint8_t start, const uint8_t *mask, uint8_t bits)
+{
+    const int nbytes = (bits + 7) / 8;
+
+    if(no < 1 || no > MASK_MAX || target > MASK_TARGET_SL || bits == 0 || bits > MASK_BITS_MAX || 7 + nbytes > max)
+    {
+        return -1;
+    }
+    params[0] = no;
+    params[1] = target;
+    params[2] = action;
+    params[3] = membank;
+    params[4] = start;
+    params[5] = bits;
+    memcpy(&params[6], mask, nbytes);
+    params[6 + nbytes] = 0x00;                                          //No truncate.
+    return 7 + nbytes;
+}
+
+//Set Tag Mask no (1 to MASK_MAX) on bits of the membank from the bit address start.
+int setTagMask(uint8_t no, uint8_t target, uint8_t action, uint8_t membank, uint8_t start, const uint8_t *mask, uint8_t bits)
+{
+    uint8_t params[7 + MASK_BITS_MAX / 8];
+    const int n = vm5f_tag_mask_params(params, sizeof(params), no, target, action, membank, start, mask, bits);
+
+    if(n < 0)
+    {
+        return -1;
+    }
+    return vm5f_send(CMD_TAG_MASK, params, n);
+}
+
+//Clear Tag Mask no, MASK_CLEAR_ALL for every mask.
+int clearTagMask(uint8_t no)
+{
+    return vm5f_send(CMD_TAG_MASK, &no, 1);
+}
+
+//Get the Tag Masks the Reader holds.
+int getTagMask()
+{
+    const uint8_t query = MASK_QUERY;
+    return vm5f_send(CMD_TAG_MASK, &query, 1);
+}
+
+//Customized Session Target Inventory on the work antenna: only tags whose inventoried flag for session
+//equals target (TARGET_A/TARGET_B) answer, and each read flips that flag, so once the strong tags are
+//read they keep quiet and the weak ones get the slots. sl (SL_*) filters on the select flag, SL_NONE
+//sends the short form. Answers like real time inventory, repeat rounds per command.
+int session_inventory(uint8_t session, uint8_t target, uint8_t sl, uint8_t repeat)
+{
+    const uint8_t params[4] = { session, target, sl, repeat };
+    const uint8_t params_short[3] = { session, target, repeat };
+
+    if(session > SESSION_S3 || target > TARGET_B)
+    {
+        return -1;
+    }
+    if(sl == SL_NONE)
+    {
+        return vm5f_send(CMD_SESSION_INVENTORY, params_short, sizeof(params_short));
+    }
+    return vm5f_send(CMD_SESSION_INVENTORY, params, sizeof(params));
+}
+
+//Fast Switch Antenna Inventory: one command walks the Reader through up to 4 antennas, stay rounds each,
+//waiting interval ms between antennas, and repeats the whole sequence repeat times.
+//Tag frames come back in the real time inventory format, with the antenna in the Freq/Ant byte.
+int fast_switch_inventory(const ant_step_t seq[ANT_SEQ_LEN], uint8_t interval, uint8_t repeat)
+{
+    uint8_t params[ANT_SEQ_LEN * 2 + 2];
+
+    for(int i=0; i<ANT_SEQ_LEN; i++)
+    {
+        //Antenna numbers above ANTENNA_4 make the Reader skip the slot.
+        params[i * 2] = (seq[i].ant <= ANTENNA_4 && seq[i].stay > 0) ? seq[i].ant : ANTENNA_NONE;
+        params[i * 2 + 1] = seq[i].stay;
+    }
+    params[ANT_SEQ_LEN * 2] = interval;
+    params[ANT_SEQ_LEN * 2 + 1] = repeat;
+    return vm5f_send(CMD_FAST_SWITCH_INVENTORY, params, sizeof(params));
+}
@@ -0,0 +1,313 @@
+/*
+    EPC allowlist: read-only open addressing hash index, memory-mapped from flash.
+
+    Image layout (little endian), built on the host by tools/allowlist_build.py:
+        header  (32 bytes, allowlist_header_t)
+        slots   (slot_count * epc_len bytes, an all-zero slot is empty)
+    The home slot is FNV-1a over the EPC (seeded), scaled to slot_count by a multiply-shift,
+    then linear probing. The builder keeps the load factor at or below 0.7, so a lookup
+    usually touches one or two slots in the flash cache.
+
+    Two partitions (allow_a, allow_b) hold images. At boot the valid one with the highest generation
+    is mapped. An update writes the other partition, header last, then swaps the active pointer,
+    so a power loss half way leaves the old list in force. Lookups count themselves in on the
+    partition they use; the old mapping goes once its count has drained to zero.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define ALLOWLIST_MAGIC         0x4C414D56                              //"VMAL"
+#define ALLOWLIST_VERSION       1
+#define ALLOWLIST_HEADER_SIZE   32
+#define ALLOWLIST_MAX_PROBES    64                                      //Builder guarantees fewer.
+
+//Allowlist Image Header.
+typedef struct allowlist_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t epc_len;
+    uint8_t reserved;
+    uint32_t generation;                                                //Higher wins when both partitions are valid.
+    uint32_t slot_count;
+    uint32_t entry_count;
+    uint32_t seed;
+    uint32_t body_crc;                                                  //CRC-32 of the slots.
+    uint32_t header_crc;                                                //CRC-32 of the 28 bytes before it.
+
+}allowlist_header_t;
+
+_Static_assert(sizeof(allowlist_header_t) == ALLOWLIST_HEADER_SIZE, "allowlist header must be 32 bytes");
+
+//Opened Allowlist: points into the mapped image.
+typedef struct allowlist
+{
+    const uint8_t *slots;
+    uint32_t slot_count;
+    uint32_t seed;
+    uint32_t entries;
+    uint32_t generation;
+    uint8_t epc_len;
+
+}allowlist_t;
+
+#ifdef ESP_PLATFORM
+#include "rom/crc.h"
+#define allowlist_crc32(buf, len) crc32_le(0, (buf), (len))
+#else
+//Standard CRC-32 (same result as zlib.crc32 and the ESP-32 ROM crc32_le with crc = 0).
+static uint32_t allowlist_crc32(const uint8_t *buf, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for(uint32_t i=0; i<len; i++)
+    {
+        crc ^= buf[i];
+        for(int b=0; b<8; b++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+#endif
+
+static inline uint32_t allowlist_hash(const uint8_t *epc, int len, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    for(int i=0; i<len; i++)
+    {
+        h = (h ^ epc[i]) * 16777619u;
+    }
+    return h;
+}
+
+//Check an image at base (size bytes) and open it. Returns 0 on success, -1 if it is not a valid image.
+int allowlist_open(allowlist_t *al, const void *base, uint32_t size)
+{
+    allowlist_header_t hdr;
+
+    if(size < ALLOWLIST_HEADER_SIZE)
+    {
+        return -1;
+    }
+    memcpy(&hdr, base, sizeof(hdr));
+    if(hdr.magic != ALLOWLIST_MAGIC || hdr.version != ALLOWLIST_VERSION || hdr.epc_len == 0 ||
+       hdr.slot_count == 0 ||
+       hdr.header_crc != allowlist_crc32((const uint8_t*) base, ALLOWLIST_HEADER_SIZE - 4))
+    {
+        return -1;
+    }
+
+    const uint64_t body = (uint64_t) hdr.slot_count * hdr.epc_len;
+    if(body > size - ALLOWLIST_HEADER_SIZE)
+    {
+        return -1;
+    }
+    const uint8_t *slots = (const uint8_t*) base + ALLOWLIST_HEADER_SIZE;
+    if(hdr.body_crc != allowlist_crc32(slots, (uint32_t) body))
+    {
+        return -1;
+    }
+
+    al->slots = slots;
+    al->slot_count = hdr.slot_count;
+    al->seed = hdr.seed;
+    al->entries = hdr.entry_count;
+    al->generation = hdr.generation;
+    al->epc_len = hdr.epc_len;
+    return 0;
+}
+
+//Is this EPC in the list? EPCs of another length than the image's are never in it.
+int allowlist_lookup(const allowlist_t *al, const uint8_t *epc, int len)
+{
+    static const uint8_t empty[64];
+
+    if(len != al->epc_len || len > sizeof(empty))
+    {
+        return 0;
+    }
+    uint32_t idx = (uint32_t)(((uint64_t) allowlist_hash(epc, len, al->seed) * al->slot_count) >> 32);
+    for(int i=0; i<ALLOWLIST_MAX_PROBES; i++)
+    {
+        const uint8_t *slot = al->slots + (size_t) idx * len;
+        if(memcmp(slot, epc, len) == 0)
+        {
+            return 1;
+        }
+        if(memcmp(slot, empty, len) == 0)
+        {
+            return 0;
+        }
+        if(++idx == al->slot_count)
+        {
+            idx = 0;
+        }
+    }
+    return 0;
+}
+
+#ifdef ESP_PLATFORM
+/***************************** Flash Partitions (A/B) ***************************************/
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_partition.h"
+
+#define ALLOWLIST_SUBTYPE       0x40                                    //Custom data subtype of allow_a/allow_b.
+
+//One A/B slot: its partition and, while mapped, the opened image.
+typedef struct allowlist_part
+{
+    const esp_partition_t *part;
+    const void *base;
+    spi_flash_mmap_handle_t handle;
+    int mapped;
+    allowlist_t list;
+    volatile uint32_t readers;                                          //Lookups running on this image.
+
+}allowlist_part_t;
+
+static allowlist_part_t allow_parts[2];
+static allowlist_part_t * volatile allow_active = NULL;                 //Swapped with one store, read by lookups.
+static int allow_updating = -1;                                         //Partition being written by an update.
+
+//Map a partition and open its image, 0 if valid.
+static int allowlist_map(allowlist_part_t *p)
+{
+    if(p->part == NULL)
+    {
+        return -1;
+    }
+    if(!p->mapped)
+    {
+        if(esp_partition_mmap(p->part, 0, p->part->size, SPI_FLASH_MMAP_DATA, &p->base, &p->handle) != ESP_OK)
+        {
+            return -1;
+        }
+        p->mapped = 1;
+    }
+    if(allowlist_open(&p->list, p->base, p->part->size) != 0)
+    {
+        spi_flash_munmap(p->handle);
+        p->mapped = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void allowlist_unmap(allowlist_part_t *p)
+{
+    if(p->mapped)
+    {
+        spi_flash_munmap(p->handle);
+        p->mapped = 0;
+    }
+}
+
+//Find both partitions and map the newest valid image. Returns 0 if a list is active.
+int allowlist_init()
+{
+    allow_parts[0].part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ALLOWLIST_SUBTYPE, "allow_a");
+    allow_parts[1].part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ALLOWLIST_SUBTYPE, "allow_b");
+
+    int ok0 = (allowlist_map(&allow_parts[0]) == 0);
+    int ok1 = (allowlist_map(&allow_parts[1]) == 0);
+    int use = -1;
+    if(ok0 && ok1)
+    {
+        use = (allow_parts[1].list.generation > allow_parts[0].list.generation) ? 1 : 0;
+        allowlist_unmap(&allow_parts[!use]);
+    }
+    else if(ok0 || ok1)
+    {
+        use = ok0 ? 0 : 1;
+    }
+    if(use < 0)
+    {
+        printf("allowlist: none installed, every tag accepted \n");
+        return -1;
+    }
+    allow_active = &allow_parts[use];
+    printf("allowlist: %s, generation %u, %u EPCs \n", allow_parts[use].part->label,
+           allow_active->list.generation, allow_active->list.entries);
+    return 0;
+}
+
+//Check an EPC against the active list. Returns 1 if allowed, 0 if not, -1 when no list is installed.
+int allowlist_check(const uint8_t *epc, int len)
+{
+    while(1)
+    {
+        allowlist_part_t *p = allow_active;
+        if(p == NULL)
+        {
+            return -1;
+        }
+        //Count in, then make sure the image is still the active one: a commit that swapped it
+        //before seeing this count may already have unmapped it.
+        __atomic_add_fetch(&p->readers, 1, __ATOMIC_SEQ_CST);
+        if(p == __atomic_load_n(&allow_active, __ATOMIC_SEQ_CST))
+        {
+            const int ret = allowlist_lookup(&p->list, epc, len);
+            __atomic_sub_fetch(&p->readers, 1, __ATOMIC_SEQ_CST);
+            return ret;
+        }
+        __atomic_sub_fetch(&p->readers, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+//Start an update: erase the partition not in use. Returns 0 on success.
+int allowlist_update_begin()
+{
+    allow_updating = (allow_active == &allow_parts[0]) ? 1 : 0;
+    allowlist_part_t *p = &allow_parts[allow_updating];
+    if(p->part == NULL)
+    {
+        allow_updating = -1;
+        return -1;
+    }
+    allowlist_unmap(p);
+    return (esp_partition_erase_range(p->part, 0, p->part->size) == ESP_OK) ? 0 : -1;
+}
+
+//Write part of the new image. The header (offset 0) must come last, through allowlist_update_commit().
+int allowlist_update_write(uint32_t offset, const void *data, uint32_t len)
+{
+    if(allow_updating < 0 || offset < ALLOWLIST_HEADER_SIZE || offset + len > allow_parts[allow_updating].part->size ||
+       offset + len < offset)
+    {
+        return -1;
+    }
+    return (esp_partition_write(allow_parts[allow_updating].part, offset, data, len) == ESP_OK) ? 0 : -1;
+}
+
+//Write the header, check the new image and make it the active list.
+int allowlist_update_commit(const allowlist_header_t *hdr)
+{
+    if(allow_updating < 0)
+    {
+        return -1;
+    }
+    allowlist_part_t *p = &allow_parts[allow_updating];
+    allow_updating = -1;
+    if(esp_partition_write(p->part, 0, hdr, sizeof(*hdr)) != ESP_OK || allowlist_map(p) != 0)
+    {
+        return -1;
+    }
+    allowlist_part_t *old = allow_active;
+    __atomic_store_n(&allow_active, p, __ATOMIC_SEQ_CST);
+    if(old != NULL)
+    {
+        //Lookups still on the old image finish first, new ones already see the new image.
+        while(__atomic_load_n(&old->readers, __ATOMIC_SEQ_CST) != 0)
+        {
+            vTaskDelay(1);
+        }
+        allowlist_unmap(old);
+    }
+    printf("allowlist: switched to %s, generation %u, %u EPCs \n", p->part->label,
+           p->list.generation, p->list.entries);
+    return 0;
+}
+#endif
@@ -0,0 +1,241 @@
+/*
+    Tag event bus: one publisher, several subscribers, each with its own bounded queue.
+
+    Events live in a fixed pool of records. Publishing fills a free record once and puts its
+    index into the queue of every subscriber; the record carries a reference count, one per
+    queue it is in, and goes back to the pool when the last subscriber releases it. Nothing is
+    copied per subscriber and nothing touches the heap.
+
+    A full queue is handled by the policy of its subscriber:
+        EVENT_DROP_OLDEST   the oldest waiting event is taken out and released, the publisher
+                            never waits. For consumers that may fall behind (flash, console).
+        EVENT_BLOCK         the publisher waits, calling the bus wait hook up to block_max
+                            times, then drops the new event. For consumers that must see
+                            everything and keep up (the door).
+    Subscribers are served in the order they subscribed, so a slow drop-oldest subscriber
+    behind the door never delays the door's copy.
+
+    The pool can not run dry: a subscriber holds at most its queue length plus the record it
+    is working on, event_bus_subscribe() refuses a subscriber the pool has no room for.
+
+    Each queue is a ring of record indexes. The publisher alone moves head; tail is moved with
+    a compare and swap, by the subscriber taking an event and by the publisher dropping the
+    oldest one, so a drop never races a take. Only uses standard C and GCC builtins.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define EVENT_SUBSCRIBERS_MAX 4
+
+#define EVENT_DROP_OLDEST   0
+#define EVENT_BLOCK         1
+
+//Subscriber: a queue of record indexes, the wakeup and the counters.
+typedef struct event_sub
+{
+    const char *name;
+    uint16_t *slot;
+    uint32_t mask;                                                      //Queue length - 1, a power of 2.
+    volatile uint32_t head;                                             //Next slot to fill, publisher only.
+    volatile uint32_t tail;                                             //Oldest event, compare and swap.
+    uint8_t policy;                                                     //EVENT_DROP_OLDEST or EVENT_BLOCK.
+    uint32_t block_max;                                                 //EVENT_BLOCK: wait hook calls before dropping.
+    void (*notify)(void *ctx);                                          //After an event is queued, publisher side.
+    void *ctx;
+    uint32_t delivered;                                                 //Events queued, publisher only.
+    uint32_t dropped;                                                   //Events lost to a full queue, publisher only.
+    uint32_t blocked;                                                   //Publishes that had to wait, publisher only.
+    uint32_t lag_max;                                                   //Most events waiting at once, publisher only.
+    uint32_t taken;                                                     //Events taken, subscriber only.
+
+}event_sub_t;
+
+//Event Bus.
+typedef struct event_bus
+{
+    uint8_t *pool;
+    uint32_t rec_size;
+    uint32_t records;
+    volatile uint8_t *ref;                                              //References per record, 0 = free.
+    uint32_t next;                                                      //Where the next free record search starts.
+    uint32_t reserved;                                                  //Records the subscribers can hold at once.
+    event_sub_t *sub[EVENT_SUBSCRIBERS_MAX];
+    int subs;
+    void (*wait)(void);                                                 //Lets a blocked publisher wait a little.
+    uint32_t exhausted;                                                 //Publishes without a free record.
+    uint32_t published;
+
+}event_bus_t;
+
+//pool holds records * rec_size bytes, ref one byte per record. wait may be NULL if no subscriber blocks.
+void event_bus_init(event_bus_t *bus, void *pool, uint8_t *ref, uint32_t rec_size, uint32_t records, void (*wait)(void))
+{
+    memset(bus, 0, sizeof(*bus));
+    memset(ref, 0, records);
+    bus->pool = pool;
+    bus->ref = ref;
+    bus->rec_size = rec_size;
+    bus->records = records;
+    bus->reserved = 1;                                                  //The record being published.
+    bus->wait = wait;
+}
+
+//Add a subscriber with a queue of len slots (a power of 2). Call before anything is published.
+//Returns -1 when the pool could run dry with it, or there are too many subscribers.
+int event_bus_subscribe(event_bus_t *bus, event_sub_t *sub, const char *name, uint16_t *slot, uint32_t len,
+                        int policy, uint32_t block_max, void (*notify)(void *ctx), void *ctx)
+{
+    if(bus->subs >= EVENT_SUBSCRIBERS_MAX || bus->reserved + len + 1 > bus->records)
+    {
+        return -1;
+    }
+    memset(sub, 0, sizeof(*sub));
+    sub->name = name;
+    sub->slot = slot;
+    sub->mask = len - 1;
+    sub->policy = policy;
+    sub->block_max = block_max;
+    sub->notify = notify;
+    sub->ctx = ctx;
+    bus->reserved += len + 1;
+    bus->sub[bus->subs++] = sub;
+    return 0;
+}
+
+static inline uint32_t event_sub_lag(const event_sub_t *sub)
+{
+    return sub->head - sub->tail;
+}
+
+//Drop one reference, the last one frees the record.
+static inline void event_bus_release(event_bus_t *bus, const void *rec)
+{
+    const uint32_t i = ((const uint8_t *) rec - bus->pool) / bus->rec_size;
+
+    __atomic_sub_fetch(&bus->ref[i], 1, __ATOMIC_ACQ_REL);
+}
+
+//Take the oldest event out of a queue. Returns its record index, -1 when the queue is empty.
+static inline int event_sub_pop(event_sub_t *sub)
+{
+    uint32_t tail = __atomic_load_n(&sub->tail, __ATOMIC_ACQUIRE);
+
+    while(tail != __atomic_load_n(&sub->head, __ATOMIC_ACQUIRE))
+    {
+        const int i = sub->slot[tail & sub->mask];
+        if(__atomic_compare_exchange_n(&sub->tail, &tail, tail + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//Publisher: a free record to fill, NULL if there is none (the pool is smaller than the subscribers need).
+void* event_bus_claim(event_bus_t *bus)
+{
+    for(uint32_t n=0; n<bus->records; n++)
+    {
+        const uint32_t i = bus->next;
+        bus->next = (i + 1 == bus->records) ? 0 : i + 1;
+        if(__atomic_load_n(&bus->ref[i], __ATOMIC_ACQUIRE) == 0)
+        {
+            return &bus->pool[i * bus->rec_size];
+        }
+    }
+    bus->exhausted++;
+    return NULL;
+}
+
+//Put one index into a subscriber's queue, applying its policy when full. Returns 0 if the event was dropped.
+static int event_sub_push(event_bus_t *bus, event_sub_t *sub, uint16_t i)
+{
+    uint32_t waits = 0;
+
+    while(event_sub_lag(sub) > sub->mask)
+    {
+        if(sub->policy == EVENT_BLOCK)
+        {
+            if(waits == 0)
+            {
+                sub->blocked++;
+            }
+            if(waits++ >= sub->block_max || bus->wait == NULL)
+            {
+                sub->dropped++;
+                return 0;
+            }
+            bus->wait();
+        }
+        else
+        {
+            const int old = event_sub_pop(sub);                        //The subscriber may take it first, then there is room.
+            if(old >= 0)
+            {
+                __atomic_sub_fetch(&bus->ref[old], 1, __ATOMIC_ACQ_REL);
+                sub->dropped++;
+            }
+        }
+    }
+    const uint32_t head = sub->head;
+    sub->slot[head & sub->mask] = i;
+    __atomic_store_n(&sub->head, head + 1, __ATOMIC_RELEASE);          //Index written before head moves.
+    sub->delivered++;
+    if(head + 1 - sub->tail > sub->lag_max)
+    {
+        sub->lag_max = head + 1 - sub->tail;
+    }
+    return 1;
+}
+
+//Publisher: hand a record from event_bus_claim() to every subscriber, in subscribe order.
+void event_bus_publish(event_bus_t *bus, void *rec)
+{
+    const uint32_t i = ((uint8_t *) rec - bus->pool) / bus->rec_size;
+
+    //One reference per subscriber and one held here, so no early release frees it mid publish.
+    __atomic_store_n(&bus->ref[i], (uint8_t)(bus->subs + 1), __ATOMIC_RELEASE);
+    bus->published++;
+    for(int s=0; s<bus->subs; s++)
+    {
+        event_sub_t *sub = bus->sub[s];
+        if(event_sub_push(bus, sub, i))
+        {
+            if(sub->notify != NULL)
+            {
+                sub->notify(sub->ctx);
+            }
+        }
+        else
+        {
+            __atomic_sub_fetch(&bus->ref[i], 1, __ATOMIC_ACQ_REL);
+        }
+    }
+    __atomic_sub_fetch(&bus->ref[i], 1, __ATOMIC_ACQ_REL);
+}
+
+//Subscriber: the oldest event waiting, NULL when there is none. Give it back with event_bus_release().
+static inline const void* event_sub_take(event_bus_t *bus, event_sub_t *sub)
+{
+    const int i = event_sub_pop(sub);
+
+    if(i < 0)
+    {
+        return NULL;
+    }
+    sub->taken++;
+    return &bus->pool[i * bus->rec_size];
+}
+
+//Records not held by any queue or subscriber, for the stats.
+uint32_t event_bus_free(const event_bus_t *bus)
+{
+    uint32_t n = 0;
+
+    for(uint32_t i=0; i<bus->records; i++)
+    {
+        n += (bus->ref[i] == 0);
+    }
+    return n;
+}
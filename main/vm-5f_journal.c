@@ -0,0 +1,442 @@
+/*
+    Tag and door event journal: a circular log of fixed size binary records in a flash partition,
+    so door events survive a reset and can be fetched at sites without a network.
+
+    Records (32 bytes: EPC, antenna, RSSI, time, door action) are collected in a RAM batch and
+    written one block at a time, never one record at a time:
+        block   (256 bytes) header (32 bytes, journal_header_t) + up to 7 records
+        sector  (4096 bytes) 16 blocks, erased as a whole before its first block is written
+    Each block header carries a CRC of itself and one of its records, so a block torn by a power
+    loss is recognised and skipped. The log runs round the partition sector by sector, every
+    sector is erased once per lap (wear levelling by construction), the oldest sector goes first.
+
+    Mount reads only the header of the first block of every sector: the valid one with the
+    highest sector sequence is the head sector, then only that sector's blocks are read to find
+    where writing goes on. No full scan of the partition.
+
+    Flash access goes through journal_flash_t: the partition on the ESP-32, a file backed image
+    on the host (journal_flash_file()), so the same code runs on Linux against an image.
+    tools/journal_decode.py reads images and the export stream.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC           0x4A4D5645                              //"EVMJ"
+#define JOURNAL_SECTOR_SIZE     4096
+#define JOURNAL_BLOCK_SIZE      256
+#define JOURNAL_HEADER_SIZE     32
+#define JOURNAL_RECORD_SIZE     32
+#define JOURNAL_SECTOR_BLOCKS   (JOURNAL_SECTOR_SIZE / JOURNAL_BLOCK_SIZE)
+#define JOURNAL_BLOCK_RECORDS   ((JOURNAL_BLOCK_SIZE - JOURNAL_HEADER_SIZE) / JOURNAL_RECORD_SIZE)
+#define JOURNAL_EPC_MAX         12
+
+//Events.
+#define JOURNAL_EV_ARRIVED      1                                       //Badge arrived, action says what the door did.
+#define JOURNAL_EV_DEPARTED     2
+#define JOURNAL_EV_DOOR         3                                       //Door state change, action is the new state.
+
+//Door actions for an arrival.
+#define JOURNAL_ACT_NONE        0
+#define JOURNAL_ACT_LOCKED      1                                       //Door locked for this badge.
+#define JOURNAL_ACT_DENIED      2                                       //Not on the allowlist.
+#define JOURNAL_ACT_BUSY        3                                       //Door was not idle.
+
+//Journal Record, 32 bytes. seq and boot are filled in by journal_append().
+typedef struct journal_record
+{
+    uint32_t seq;                                                       //Record number since the log was created.
+    uint32_t time_ms;                                                   //Since boot.
+    uint16_t boot;                                                      //Boot number, counted by the journal.
+    uint8_t event;
+    uint8_t action;
+    uint8_t reader;
+    uint8_t ant;
+    uint8_t rssi;
+    uint8_t epc_len;                                                    //Of the tag, longer EPCs keep their first JOURNAL_EPC_MAX bytes.
+    uint8_t epc[JOURNAL_EPC_MAX];
+    uint32_t reads;
+
+}journal_record_t;
+
+//Journal Block Header, 32 bytes.
+typedef struct journal_header
+{
+    uint32_t magic;
+    uint32_t sector_seq;                                                //Same in every block of a sector, +1 per sector written.
+    uint32_t first_seq;                                                 //seq of the block's first record.
+    uint16_t count;                                                     //Records in the block.
+    uint16_t boot;
+    uint32_t records_crc;                                               //CRC-32 of the count records.
+    uint32_t reserved[2];
+    uint32_t header_crc;                                                //CRC-32 of the 28 bytes before it.
+
+}journal_header_t;
+
+_Static_assert(sizeof(journal_record_t) == JOURNAL_RECORD_SIZE, "journal record must be 32 bytes");
+_Static_assert(sizeof(journal_header_t) == JOURNAL_HEADER_SIZE, "journal header must be 32 bytes");
+
+//Journal Flash: where the log lives. Addresses are relative to the start of the area, erase is by sector.
+typedef struct journal_flash
+{
+    int (*read)(void *ctx, uint32_t addr, void *buf, uint32_t len);     //Return 0 on success.
+    int (*write)(void *ctx, uint32_t addr, const void *buf, uint32_t len);
+    int (*erase)(void *ctx, uint32_t addr, uint32_t len);
+    uint32_t size;
+    void *ctx;
+
+}journal_flash_t;
+
+//Journal.
+typedef struct journal
+{
+    const journal_flash_t *flash;
+    uint32_t sectors;
+    uint32_t head_sector;                                               //Sector being written.
+    uint32_t head_block;                                                //Next block in it, JOURNAL_SECTOR_BLOCKS: sector full.
+    uint32_t sector_seq;                                                //Of the head sector.
+    uint32_t next_seq;
+    uint16_t boot;
+    journal_record_t batch[JOURNAL_BLOCK_RECORDS];                      //RAM batch, the next block.
+    int batch_count;
+    uint32_t blocks_written;
+    uint32_t torn;                                                      //Bad blocks seen at mount.
+    uint32_t errors;                                                    //Failed erases and writes.
+    uint32_t lost;                                                      //Records in blocks that failed to write.
+
+}journal_t;
+
+typedef void (*journal_export_cb_t)(const uint8_t *block, int len, void *ctx);
+
+#ifdef ESP_PLATFORM
+#include "rom/crc.h"
+#define journal_crc32(buf, len) crc32_le(0, (const uint8_t*)(buf), (len))
+#else
+//Standard CRC-32 (same result as zlib.crc32 and the ESP-32 ROM crc32_le with crc = 0).
+static uint32_t journal_crc32(const void *data, uint32_t len)
+{
+    const uint8_t *buf = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for(uint32_t i=0; i<len; i++)
+    {
+        crc ^= buf[i];
+        for(int b=0; b<8; b++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+#endif
+
+static inline uint32_t journal_addr(uint32_t sector, uint32_t block)
+{
+    return sector * JOURNAL_SECTOR_SIZE + block * JOURNAL_BLOCK_SIZE;
+}
+
+static int journal_header_ok(const journal_header_t *h)
+{
+    return h->magic == JOURNAL_MAGIC && h->count >= 1 && h->count <= JOURNAL_BLOCK_RECORDS &&
+           h->header_crc == journal_crc32(h, JOURNAL_HEADER_SIZE - 4);
+}
+
+static int journal_erased(const uint8_t *buf, int len)
+{
+    for(int i=0; i<len; i++)
+    {
+        if(buf[i] != 0xFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Find the head of the log. Returns 0 when the journal is ready, -1 if the area is too small or unreadable.
+int journal_mount(journal_t *j, const journal_flash_t *flash)
+{
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    journal_header_t h;
+    int found = 0;
+
+    memset(j, 0, sizeof(*j));
+    j->flash = flash;
+    j->sectors = flash->size / JOURNAL_SECTOR_SIZE;
+    if(j->sectors < 2)
+    {
+        return -1;
+    }
+
+    for(uint32_t s=0; s<j->sectors; s++)
+    {
+        if(flash->read(flash->ctx, journal_addr(s, 0), &h, sizeof(h)) != 0)
+        {
+            return -1;
+        }
+        if(journal_header_ok(&h) && (!found || (int32_t)(h.sector_seq - j->sector_seq) > 0))
+        {
+            j->head_sector = s;
+            j->sector_seq = h.sector_seq;
+            found = 1;
+        }
+    }
+    if(!found)
+    {
+        //Empty or foreign: start a new log in sector 0.
+        j->head_sector = 0;
+        j->head_block = 0;
+        j->sector_seq = 1;
+        j->boot = 1;
+        return flash->erase(flash->ctx, 0, JOURNAL_SECTOR_SIZE) == 0 ? 0 : -1;
+    }
+
+    //Walk the head sector up to its first erased block.
+    for(j->head_block=0; j->head_block<JOURNAL_SECTOR_BLOCKS; j->head_block++)
+    {
+        if(flash->read(flash->ctx, journal_addr(j->head_sector, j->head_block), block, sizeof(block)) != 0)
+        {
+            return -1;
+        }
+        if(journal_erased(block, sizeof(block)))
+        {
+            break;
+        }
+        memcpy(&h, block, sizeof(h));
+        if(journal_header_ok(&h) && h.sector_seq == j->sector_seq)
+        {
+            j->next_seq = h.first_seq + h.count;
+            j->boot = h.boot;
+        }
+        else
+        {
+            j->torn++;
+        }
+    }
+    j->boot++;
+    return 0;
+}
+
+//Write the batch as one block, a partial one too (bounds what a power loss can take).
+//Moves to the next sector, erasing it, when the head sector is full. Returns 0, -1 on a flash error.
+int journal_flush(journal_t *j)
+{
+    const journal_flash_t *flash = j->flash;
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    journal_header_t h;
+    int retried = 0;
+    int err;
+
+    if(j->batch_count == 0)
+    {
+        return 0;
+    }
+    while(1)
+    {
+        if(j->head_block >= JOURNAL_SECTOR_BLOCKS)
+        {
+            const uint32_t next = (j->head_sector + 1) % j->sectors;
+            if(flash->erase(flash->ctx, journal_addr(next, 0), JOURNAL_SECTOR_SIZE) != 0)
+            {
+                j->errors++;
+                j->lost += j->batch_count;
+                j->batch_count = 0;
+                return -1;
+            }
+            j->head_sector = next;
+            j->head_block = 0;
+            j->sector_seq++;
+        }
+
+        const int len = JOURNAL_HEADER_SIZE + j->batch_count * JOURNAL_RECORD_SIZE;
+        memset(&h, 0, sizeof(h));
+        h.magic = JOURNAL_MAGIC;
+        h.sector_seq = j->sector_seq;
+        h.first_seq = j->batch[0].seq;
+        h.count = j->batch_count;
+        h.boot = j->boot;
+        h.records_crc = journal_crc32(j->batch, j->batch_count * JOURNAL_RECORD_SIZE);
+        h.header_crc = journal_crc32(&h, JOURNAL_HEADER_SIZE - 4);
+        memcpy(block, &h, sizeof(h));
+        memcpy(&block[JOURNAL_HEADER_SIZE], j->batch, j->batch_count * JOURNAL_RECORD_SIZE);
+
+        err = flash->write(flash->ctx, journal_addr(j->head_sector, j->head_block), block, len);
+        if(err == 0)
+        {
+            j->head_block++;
+            j->blocks_written++;
+            break;
+        }
+        j->errors++;
+        if(j->head_block > 0 || retried)
+        {
+            //A block that failed to write is left behind like a torn one, mount and export skip it.
+            j->head_block++;
+            j->lost += j->batch_count;
+            break;
+        }
+        //Block 0 holds the header mount finds the sector by, without it the blocks written after it
+        //would be lost at the next mount: give the sector up and write the batch to the next one.
+        j->head_block = JOURNAL_SECTOR_BLOCKS;
+        retried = 1;
+    }
+    j->batch_count = 0;
+    return err ? -1 : 0;
+}
+
+//Add a record to the RAM batch, numbering it. A full batch is written right away.
+int journal_append(journal_t *j, const journal_record_t *rec)
+{
+    journal_record_t *r = &j->batch[j->batch_count++];
+
+    *r = *rec;
+    r->seq = j->next_seq++;
+    r->boot = j->boot;
+    if(j->batch_count == JOURNAL_BLOCK_RECORDS)
+    {
+        return journal_flush(j);
+    }
+    return 0;
+}
+
+//Hand every valid block, oldest first, to cb as stored (header and records). Unwritten batch records
+//are not included, flush first. Returns the number of blocks.
+int journal_export(journal_t *j, journal_export_cb_t cb, void *ctx)
+{
+    const journal_flash_t *flash = j->flash;
+    uint8_t block[JOURNAL_BLOCK_SIZE];
+    journal_header_t h;
+    int blocks = 0;
+
+    for(uint32_t i=1; i<=j->sectors; i++)
+    {
+        const uint32_t s = (j->head_sector + i) % j->sectors;          //Oldest sector first, head last.
+        uint32_t seq = 0;
+        for(uint32_t b=0; b<JOURNAL_SECTOR_BLOCKS; b++)
+        {
+            if(s == j->head_sector && b >= j->head_block)
+            {
+                break;
+            }
+            if(flash->read(flash->ctx, journal_addr(s, b), block, sizeof(block)) != 0)
+            {
+                return blocks;
+            }
+            memcpy(&h, block, sizeof(h));
+            if(!journal_header_ok(&h) || (b > 0 && h.sector_seq != seq) ||
+               h.records_crc != journal_crc32(&block[JOURNAL_HEADER_SIZE], h.count * JOURNAL_RECORD_SIZE))
+            {
+                if(b == 0)
+                {
+                    break;                                              //Erased or never completed, nothing in it.
+                }
+                continue;
+            }
+            seq = h.sector_seq;
+            cb(block, JOURNAL_HEADER_SIZE + h.count * JOURNAL_RECORD_SIZE, ctx);
+            blocks++;
+        }
+    }
+    return blocks;
+}
+
+#ifdef ESP_PLATFORM
+/***************************** Flash Partition ***************************************/
+#include "esp_partition.h"
+
+#define JOURNAL_SUBTYPE         0x41                                    //Custom data subtype of the journal partition.
+
+static int journal_part_read(void *ctx, uint32_t addr, void *buf, uint32_t len)
+{
+    return esp_partition_read(ctx, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int journal_part_write(void *ctx, uint32_t addr, const void *buf, uint32_t len)
+{
+    return esp_partition_write(ctx, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int journal_part_erase(void *ctx, uint32_t addr, uint32_t len)
+{
+    return esp_partition_erase_range(ctx, addr, len) == ESP_OK ? 0 : -1;
+}
+
+//Back flash with the partition of this label. Returns 0, -1 if there is none.
+int journal_flash_partition(journal_flash_t *flash, const char *label)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_SUBTYPE, label);
+
+    if(part == NULL)
+    {
+        return -1;
+    }
+    flash->read = journal_part_read;
+    flash->write = journal_part_write;
+    flash->erase = journal_part_erase;
+    flash->size = part->size;
+    flash->ctx = (void*) part;
+    return 0;
+}
+#else
+/***************************** File Backed Image ***************************************/
+//Writes AND the data in like NOR flash does (bits only go from 1 to 0), erase sets 0xFF.
+static int journal_file_read(void *ctx, uint32_t addr, void *buf, uint32_t len)
+{
+    FILE *f = ctx;
+    return (fseek(f, addr, SEEK_SET) == 0 && fread(buf, 1, len, f) == len) ? 0 : -1;
+}
+
+static int journal_file_write(void *ctx, uint32_t addr, const void *buf, uint32_t len)
+{
+    uint8_t old[JOURNAL_BLOCK_SIZE];
+    const uint8_t *src = buf;
+
+    for(uint32_t done=0; done<len; )
+    {
+        const uint32_t n = (len - done) < sizeof(old) ? (len - done) : sizeof(old);
+        if(journal_file_read(ctx, addr + done, old, n) != 0)
+        {
+            return -1;
+        }
+        for(uint32_t i=0; i<n; i++)
+        {
+            old[i] &= src[done + i];
+        }
+        if(fseek(ctx, addr + done, SEEK_SET) != 0 || fwrite(old, 1, n, ctx) != n)
+        {
+            return -1;
+        }
+        done += n;
+    }
+    return fflush(ctx) == 0 ? 0 : -1;
+}
+
+static int journal_file_erase(void *ctx, uint32_t addr, uint32_t len)
+{
+    uint8_t ones[JOURNAL_BLOCK_SIZE];
+
+    memset(ones, 0xFF, sizeof(ones));
+    if(fseek(ctx, addr, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    for(uint32_t done=0; done<len; done+=sizeof(ones))
+    {
+        if(fwrite(ones, 1, sizeof(ones), ctx) != sizeof(ones))
+        {
+            return -1;
+        }
+    }
+    return fflush(ctx) == 0 ? 0 : -1;
+}
+
+//Back flash with an image file of size bytes (opened "r+b", size a multiple of the sector size).
+void journal_flash_file(journal_flash_t *flash, FILE *f, uint32_t size)
+{
+    flash->read = journal_file_read;
+    flash->write = journal_file_write;
+    flash->erase = journal_file_erase;
+    flash->size = size;
+    flash->ctx = f;
+}
+#endif
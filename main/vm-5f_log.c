@@ -0,0 +1,249 @@
+/*
+    Deferred binary log.
+
+    Hot paths do not format text. A log call stores a fixed 32 byte record (message id, level,
+    time and up to 5 integer arguments) in a lock-free ring and returns, the formatting and the
+    slow console write happen later in log_task at low priority. When the ring is full the
+    record is dropped and counted, a log call never blocks.
+
+    Messages are listed once in LOG_MESSAGES below, the record holds the index. The drain prints
+    them as text, or with LOG_OUTPUT_BINARY as "#L <hex>" lines that tools/log_decode.py turns
+    back into text on the host (it reads the same list from this file).
+
+    Levels are compile time: calls below LOG_LEVEL expand to nothing. With LOG_SYNC the calls
+    print on the spot like the old printf code, to compare the cost of both.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_LEVEL_NONE      0
+#define LOG_LEVEL_ERROR     1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_INFO      3
+#define LOG_LEVEL_DEBUG     4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL           LOG_LEVEL_INFO                              //Calls above this level are compiled out.
+#endif
+#ifndef LOG_SYNC
+#define LOG_SYNC            0                                           //1: print at the call, no ring (for comparison).
+#endif
+#ifndef LOG_OUTPUT_BINARY
+#define LOG_OUTPUT_BINARY   0                                           //1: drain writes "#L <hex>" records for log_decode.py.
+#endif
+
+#define LOG_RING_SIZE       128                                         //Records, must be a power of 2.
+#define LOG_RING_MASK       (LOG_RING_SIZE - 1)
+#define LOG_MAX_ARGS        5
+
+//Message catalogue: id, printf format (integer arguments only). Append only, the id is the position.
+#define LOG_MESSAGES \
+    LOG_MSG(LOG_CMD_BAD_PARAMS,     "Command %02x: bad parameters") \
+    LOG_MSG(LOG_CMD_SENT,           "Command send: %02x, checksum: %02x") \
+    LOG_MSG(LOG_RX_TIMEOUT,         "rx timeout") \
+    LOG_MSG(LOG_RX_RESPONSE,        "rx command: %02x, %u data bytes") \
+    LOG_MSG(LOG_RX_OVERFLOW,        "rx overflow (%u)") \
+    LOG_MSG(LOG_TAG_ARRIVED,        "TAG ARRIVED: %08x%08x%08x Ant: %u Reads: %u") \
+    LOG_MSG(LOG_TAG_DEPARTED,       "TAG DEPARTED: %08x%08x%08x Ant: %u Reads: %u") \
+    LOG_MSG(LOG_TAG_RSSI,           "RSSI min/mean/max: %u/%u/%u") \
+    LOG_MSG(LOG_TAG_NOT_ALLOWED,    "not allowed: %08x%08x%08x") \
+    LOG_MSG(LOG_ANT_ERROR,          "antenna %u error: %02x") \
+    LOG_MSG(LOG_INVENTORY_ERROR,    "inventory error: %02x") \
+    LOG_MSG(LOG_INVENTORY_TIMEOUT,  "inventory round timeout") \
+    LOG_MSG(LOG_DOOR_LOCKED,        "DOOR LOCKED!!! Press STOP to Unlock Door.") \
+    LOG_MSG(LOG_DOOR_RELEASED,      "door released") \
+    LOG_MSG(LOG_DOOR_UNLOCKING,     "STOP pressed, door released in %u ms") \
+    LOG_MSG(LOG_DOOR_FORCED,        "door forced open, STOP held") \
+    LOG_MSG(LOG_DOOR_BUSY,          "badge ignored, door state %u") \
+    LOG_MSG(LOG_SCHED_IDLE,         "inventory idle: %u dBm, %u ms between empty rounds") \
+    LOG_MSG(LOG_SCHED_ACTIVE,       "inventory active: %u dBm") \
+    LOG_MSG(LOG_MASK_APPLIED,       "epc filter: %u tag masks set") \
+    LOG_MSG(LOG_MASK_LOST,          "epc filter: tag masks gone from the Reader, setting them again") \
+    LOG_MSG(LOG_MEM_READ,           "tag memory read: %u of %u tags") \
+    LOG_MSG(LOG_MEM_READ_TIMEOUT,   "tag memory read: no end of answer") \
+    LOG_MSG(LOG_HEALTH_HOT,         "Reader at %d C, output power limited to %u dBm") \
+    LOG_MSG(LOG_HEALTH_COOL,        "Reader at %d C, output power limit back to %u dBm") \
+    LOG_MSG(LOG_HEALTH_ANT_SKIP,    "antenna %u skipped: return loss %u dB, %u detect errors") \
+    LOG_MSG(LOG_HEALTH_ANT_BACK,    "antenna %u back: return loss %u dB") \
+    LOG_MSG(LOG_HEALTH_FAILOVER,    "work antenna %u -> %u") \
+    LOG_MSG(LOG_READER_RESET,       "Reader reset (output power %u, set %u), init again") \
+    LOG_MSG(LOG_HEALTH_NO_ANSWER,   "Reader not answering %u health checks, power cycling") \
+    LOG_MSG(LOG_MASK_MODE,          "epc filter: session inventory, mode %u back when the filter is cleared")
+
+#define LOG_MSG(id, fmt) id,
+enum log_id { LOG_MESSAGES LOG_MSG_COUNT };
+#undef LOG_MSG
+
+#define LOG_MSG(id, fmt) fmt,
+static const char * const log_formats[LOG_MSG_COUNT] = { LOG_MESSAGES };
+#undef LOG_MSG
+
+static const char log_level_char[] = { '-', 'E', 'W', 'I', 'D' };
+
+//Log Record, 32 bytes.
+typedef struct log_record
+{
+    volatile uint32_t seq;                                              //Ring position + 1 once written.
+    uint32_t time_us;
+    uint16_t id;
+    uint8_t level;
+    uint8_t reserved;
+    uint32_t arg[LOG_MAX_ARGS];
+
+}log_record_t;
+
+_Static_assert(sizeof(log_record_t) == 32, "log record must be 32 bytes");
+
+//Log Ring: many writers (any task, any core), one reader (log_task).
+typedef struct log_ring
+{
+    log_record_t rec[LOG_RING_SIZE];
+    volatile uint32_t head;                                             //Next position to claim.
+    uint32_t tail;                                                      //Next position to drain.
+    volatile uint32_t dropped;                                          //Records lost to a full ring.
+    volatile uint32_t written;
+
+}log_ring_t;
+
+static log_ring_t log_ring;
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#define log_time_us() ((uint32_t) esp_timer_get_time())
+#else
+#define log_time_us() 0
+#endif
+
+void log_init()
+{
+    memset(&log_ring, 0, sizeof(log_ring));
+    for(uint32_t i=0; i<LOG_RING_SIZE; i++)
+    {
+        log_ring.rec[i].seq = i;                                        //Free for position i.
+    }
+}
+
+static void log_print(const log_record_t *r)
+{
+#if LOG_OUTPUT_BINARY
+    const uint8_t *b = (const uint8_t*) r;
+    printf("#L ");
+    for(int i=0; i<sizeof(*r); i++)
+    {
+        printf("%02x", b[i]);
+    }
+    printf("\n");
+#else
+    const uint32_t *a = r->arg;
+    printf("[%u.%03u] %c ", r->time_us / 1000000, (r->time_us / 1000) % 1000, log_level_char[r->level]);
+    printf(r->id < LOG_MSG_COUNT ? log_formats[r->id] : "bad log id", a[0], a[1], a[2], a[3], a[4]);
+    printf(" \n");
+#endif
+}
+
+//Store one record. Lock-free: claim a position with compare-and-swap, fill the slot, then publish
+//it through seq. Safe from any task on either core; not from an ISR that can preempt a writer on
+//a full ring for long (the record would just be dropped).
+void log_write(uint8_t level, uint16_t id, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4)
+{
+#if LOG_SYNC
+    log_record_t r = { 0, log_time_us(), id, level, 0, { a0, a1, a2, a3, a4 } };
+    log_print(&r);
+#else
+    uint32_t pos;
+    log_record_t *r;
+
+    do
+    {
+        pos = log_ring.head;
+        r = &log_ring.rec[pos & LOG_RING_MASK];
+        if(r->seq != pos)
+        {
+            __sync_fetch_and_add(&log_ring.dropped, 1);                 //Not drained yet: full.
+            return;
+        }
+    }
+    while(!__sync_bool_compare_and_swap(&log_ring.head, pos, pos + 1));
+
+    r->time_us = log_time_us();
+    r->id = id;
+    r->level = level;
+    r->arg[0] = a0;
+    r->arg[1] = a1;
+    r->arg[2] = a2;
+    r->arg[3] = a3;
+    r->arg[4] = a4;
+    __sync_synchronize();                                               //Record visible before seq says so.
+    r->seq = pos + 1;
+    __sync_fetch_and_add(&log_ring.written, 1);
+#endif
+}
+
+//Format and print everything written so far. Returns number of records printed.
+int log_drain()
+{
+    int n = 0;
+    uint32_t dropped;
+
+    while(1)
+    {
+        log_record_t *r = &log_ring.rec[log_ring.tail & LOG_RING_MASK];
+        if(r->seq != log_ring.tail + 1)
+        {
+            break;                                                      //Not written (yet).
+        }
+        __sync_synchronize();
+        log_print(r);
+        __sync_synchronize();
+        r->seq = log_ring.tail + LOG_RING_SIZE;                         //Free for the next lap.
+        log_ring.tail++;
+        n++;
+    }
+    dropped = log_ring.dropped;
+    if(dropped)
+    {
+        __sync_fetch_and_sub(&log_ring.dropped, dropped);
+        printf("log: %u records dropped \n", dropped);
+    }
+    return n;
+}
+
+//EPC bytes 4*i..4*i+3 as one big endian word, so "%08x" prints them in wire order. Short EPCs are zero padded.
+static inline uint32_t log_epc_word(const uint8_t *epc, int len, int i)
+{
+    uint32_t w = 0;
+    for(int j=4*i; j<4*i+4; j++)
+    {
+        w = (w << 8) | (j < len ? epc[j] : 0);
+    }
+    return w;
+}
+
+#define LOG_ARGS(level, id, a0, a1, a2, a3, a4, ...) \
+    log_write(level, id, (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2), (uint32_t)(a3), (uint32_t)(a4))
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(...) LOG_ARGS(LOG_LEVEL_ERROR, __VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#else
+#define LOGE(...) do { } while(0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(...) LOG_ARGS(LOG_LEVEL_WARN, __VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#else
+#define LOGW(...) do { } while(0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(...) LOG_ARGS(LOG_LEVEL_INFO, __VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#else
+#define LOGI(...) do { } while(0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(...) LOG_ARGS(LOG_LEVEL_DEBUG, __VA_ARGS__, 0, 0, 0, 0, 0, 0)
+#else
+#define LOGD(...) do { } while(0)
+#endif
+
+//EPC as the three "%08x" arguments of the tag messages.
+#define LOG_EPC(epc, len) log_epc_word(epc, len, 0), log_epc_word(epc, len, 1), log_epc_word(epc, len, 2)
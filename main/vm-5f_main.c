@@ -6,22 +6,62 @@
 */
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_dev.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "soc/uart_struct.h"
+#include "xtensa/hal.h"
+#include "vm-5f_log.c"
+#include "vm-5f_timing.c"
 #include "vm-5f.c"
+#include "vm-5f_parser.c"
+#include "vm-5f_allowlist.c"
+#include "vm-5f_tags.c"
+#include "vm-5f_spsc.c"
+#include "vm-5f_events.c"
+#include "vm-5f_journal.c"
+#ifndef VM5F_SIM
+#define VM5F_SIM 0                                                                  //1: run against the simulated Reader in vm-5f_sim.c.
+#endif
+#if VM5F_SIM
+#include "vm-5f_sim.c"
+#endif
+#ifndef VM5F_SIM_FLOOD
+#define VM5F_SIM_FLOOD 0                                                            //1: simulated Reader sends tag frames at full line rate.
+#endif
+#ifndef VM5F_SIM_DISCOVERY
+#define VM5F_SIM_DISCOVERY 0                                                        //1: with VM5F_SIM, benchmark tag discovery per inventory mode at start up.
+#endif
+#ifndef VM5F_SIM_HEALTH
+#define VM5F_SIM_HEALTH 0                                                           //1: simulated Reader runs hot, has a bad antenna and reboots.
+#endif
+#ifndef VM5F_SIM_SHORT
+#define VM5F_SIM_SHORT 0                                                            //1: half the simulated tags have 16 to 80 bit EPCs.
+#endif
+#ifndef VM5F_SIM_FILTER
+#define VM5F_SIM_FILTER 0                                                           //1: a third of the simulated tags are foreign, filtered on the own prefix.
+#endif
+#ifndef VM5F_BUS
+#define VM5F_BUS 0                                                                  //1: poll several Readers on RS-485 buses (bus_config below) instead of one on UART2.
+#endif
+#if VM5F_BUS && VM5F_SIM
+#error "the simulated Reader is a single Reader on its own line, build VM5F_BUS without VM5F_SIM"
+#endif
     
 /*
  * - Port: UART2
  * - Receive (Rx) buffer: on
  * - Transmit (Tx) buffer: on
  * - Flow control: off
- * - Event queue: off
+ * - Event queue: on
  * - Pin assignment: see defines below
  */
 #define TXD_PIN          17
@@ -33,26 +73,618 @@
 #define GPIO_INPUT_PIN_SEL  (1ULL<<GPIO_INPUT_IO_0)
 #define ESP_INTR_FLAG_DEFAULT 0
 
-#define TAG_LENGTH 12                                                               //Length of EPC Number of 1 UHF RFID Tag.
 #define RELAY_TRIGGER_TIME 4000                                                     //Delay time before switching OFF the EM Lock/Relay.
+#define STOP_DEBOUNCE_TIME 30                                                       //STOP edges after an accepted one are ignored this long (ms).
+#define DOOR_FORCE_TIME 3000                                                        //STOP held this long: door forced open until released (ms).
 
-static const int RX_BUF_SIZE = 512;
-static xQueueHandle tag_found_queue = NULL;
+#define DOOR_IDLE 0                                                                 //Relay off, waiting for a badge.
+#define DOOR_LOCKED 1                                                               //Relay on, waiting for STOP.
+#define DOOR_UNLOCKING 2                                                            //STOP pressed, relay on until the hold timer ends.
+#define DOOR_FORCED 3                                                               //STOP held down, relay off and badges ignored until released.
+#define DOOR_EV_STOP_PRESSED 1
+#define DOOR_EV_STOP_RELEASED 2
+#define DOOR_EV_HOLD_DONE 3
+#define DOOR_EV_FORCE 4
+#define DOOR_EV_STOP_EDGE 5                                                         //STOP interrupt, gpio_task reads the level.
+#define DOOR_EV_STOP_SETTLED 6                                                      //Debounce time over, gpio_task reads the level again.
 
-//Intializing UART
-void init() 
-{                         
-    /*****UART Config*****/                                  
+#define RESP_TIMEOUT 1000                                                           //Max wait for a command response (ms).
+#define RX_IDLE_TIME 20                                                             //Quiet time after which a partial frame is dropped (ms).
+#define INVENTORY_TIMEOUT 2000                                                      //Max wait for the end of an inventory round (ms).
+#define ANT_SWITCH_INTERVAL 0                                                       //Pause between antennas in a fast switch round (ms).
+#define ANT_SWITCH_REPEAT 3                                                         //Antenna sequence repeats per fast switch round (active rounds).
+#define BUFFER_ROUNDS 5                                                             //Inventory rounds per buffered round.
+#define ROUND_SEEN_MAX 128                                                          //Distinct EPCs counted per round (session mode: per target) for the mode stats.
+#define TAG_SWEEP_PERIOD 100                                                        //How often the tag table is checked for departures (ms).
+
+#define INVENTORY_REALTIME 0                                                        //Every read is reported as it happens.
+#define INVENTORY_BUFFERED 1                                                        //Reader collects N rounds, then the de-duplicated buffer is read out.
+#define INVENTORY_SESSION 2                                                         //Session/target inventory (0x8B) on the work antenna, reported in real time.
+#define INVENTORY_MODES 3
+#define INIT_TIMEOUT 200                                                            //Max wait for one init command response (ms).
+#define INIT_RETRIES 3                                                              //Tries per init command.
+#define INIT_ATTEMPTS 3                                                             //Full init runs (with a Reader power cycle) before giving up.
+#define READER_BOOT_TIMEOUT 1000                                                    //Max time for the Reader to answer after EN goes high (ms).
+#define SCHED_IDLE_AFTER 3000                                                       //Rounds without a tag this long before inventory backs off (ms).
+#define SCHED_IDLE_GAP 250                                                          //Pause after an empty idle round (ms).
+#define SCHED_IDLE_REPEAT 1                                                         //Sequence repeats (buffered: Reader rounds) per idle round.
+#define SCHED_IDLE_DBM POWER_MIN_DBM
+#define SCHED_ACTIVE_DBM POWER_MAX_DBM
+#define EPC_FILTER_CHECK_PERIOD 30000                                               //Check the Reader's masks, and probe unfiltered, this often (ms).
+#define MASK_QUERY_DRAIN 20                                                         //Wait for the other frames of a mask query (ms).
+#define TAG_MEM_MAX (READ_WORDS_MAX * 2)                                            //Memory bytes kept per tag of a batch read.
+#define TAG_MEM_BATCH_MAX 32                                                        //Tags per batch read.
+#define TAG_MEM_ATTEMPTS 3                                                          //Read commands per batch, for the tags still missing.
+#define TAG_MEM_WAIT 2000                                                           //Longest a batch waits for rfid_task to take it (ms).
+#define HEALTH_STEP_PERIOD 2000                                                     //One health check between two rounds this often (ms).
+#define HEALTH_WINDOW 16                                                            //Samples kept per reading for the rolling stats.
+#define HEALTH_ANTENNAS (ANTENNA_4 + 1)
+#define HEALTH_TEMP_HOT 70                                                          //Reader this hot (C): output power down a step.
+#define HEALTH_TEMP_COOL 60                                                         //This cool again (C): power back up a step.
+#define HEALTH_DERATE_DB 3                                                          //Power step.
+#define HEALTH_RL_MIN 10                                                            //Return loss below this: cable or antenna fault, antenna skipped (dB).
+#define HEALTH_RL_HYST 3                                                            //A skipped antenna is back at HEALTH_RL_MIN + this (dB).
+#define HEALTH_RL_FREQ ETSI_866_50MHZ                                               //Return loss measured mid band.
+#define HEALTH_FAILS_MAX 3                                                          //Health checks in a row without answer before the Reader is power cycled.
+
+#define RX_BUF_SIZE 512
+#define DOOR_QUEUE_LEN 8
+#define RESP_QUEUE_LEN 4
+#define LOG_DRAIN_PERIOD 20                                                         //log_task wakes this often to print (ms).
+#define STATS_PERIOD 10000                                                          //Heap/stack report interval (ms).
+#define BENCH_SAMPLES 256                                                           //Tag-to-relay latencies kept for the percentiles.
+#define READ_RING_LEN 64                                                            //Tag reads in flight to tag_task, power of 2.
+#define EVENT_POOL_LEN 40                                                           //Tag event records, covers every subscriber queue + 1 each.
+#define DOOR_SUB_LEN 8                                                              //Tag events waiting for gpio_task, power of 2.
+#define DOOR_SUB_BLOCK 5                                                            //Ticks tag_task waits for room before the door loses an event.
+#define JOURNAL_SUB_LEN 16                                                          //Tag events waiting for journal_task, power of 2.
+#define HOST_SUB_LEN 8                                                              //Tag events waiting for host_task, power of 2.
+#define JOURNAL_RING_LEN 16                                                         //Door events in flight to journal_task, power of 2.
+#define JOURNAL_FLUSH_TIME 2000                                                     //Longest a door event waits in RAM for flash (ms).
+#define JOURNAL_EXPORT_CMD 'J'                                                      //Console byte starting a journal export.
+#define JOURNAL_EXPORT_BAUD 921600                                                  //Console baud rate while the export streams.
+#define JOURNAL_EXPORT_PAUSE 100                                                    //Quiet time around a baud rate switch (ms).
+#define JOURNAL_NOTIFY_EVENTS 0x01                                                  //journal_task notify bits: records to take,
+#define JOURNAL_NOTIFY_EXPORT 0x02                                                  //export requested on the console.
+#define CONSOLE_RX_BUF 1024                                                         //Console UART driver receive buffer, holds an upload chunk.
+#define CONSOLE_QUEUE_LEN 8                                                         //Console UART driver event queue.
+#define ALLOW_UPLOAD_CMD 'A'                                                        //Console byte starting an allowlist upload.
+#define ALLOW_UPLOAD_CHUNK 512                                                      //Image bytes the host sends per acknowledge.
+#define ALLOW_UPLOAD_TIMEOUT 5000                                                   //Longest wait for the host during an upload (ms).
+
+/*
+ * Core split: the UART, the Reader protocol and frame parsing run on the I/O core, where
+ * app_main installs the UART interrupt. Decoded reads cross to the policy core through an
+ * SPSC ring; tag aggregation, allowlist and door run there, next to the console output,
+ * so none of it holds up the receive path.
+ */
+#define CORE_IO 0                                                                   //PRO CPU.
+#if CONFIG_FREERTOS_UNICORE
+#define CORE_POLICY 0
+#else
+#define CORE_POLICY 1                                                               //APP CPU.
+#endif
+
+//Task stacks (bytes), static so starting a task can not fail on a fragmented heap.
+#define GPIO_TASK_STACK 2048
+#define UART_RX_TASK_STACK 3072
+#define RFID_TASK_STACK 2048
+#define TAG_TASK_STACK 3072
+#define STATS_TASK_STACK 2048
+#define LOG_TASK_STACK 2048
+#define JOURNAL_TASK_STACK 3072
+#define HOST_TASK_STACK 2048
+#define CONSOLE_TASK_STACK 2048
+
+//Command Response: copy of a non-inventory frame handed from uart_rx_task to getData().
+typedef struct vm5f_response
+{
+    uint8_t add;
+    uint8_t cmd;
+    uint8_t data_len;
+    uint8_t data[32];
+
+}vm5f_response_t;
+
+//Tag Event: a tag arrived or departed (or, inside the receive path, a single read), published
+//on tag_bus as one pool record shared by all subscribers.
+typedef struct tag_event
+{
+    uint8_t type;                                                                   //TAG_ARRIVED, TAG_DEPARTED, 0 for a read.
+    uint8_t reader;                                                                 //Reader that saw it (position in bus_config, 0 with one Reader).
+    uint8_t epc[TAG_EPC_MAX];
+    uint8_t epc_len;
+    uint16_t pc;
+    uint8_t ant;                                                                    //Antenna of the last read.
+    uint8_t freq;
+    uint8_t rssi;                                                                   //Mean RSSI (RSSI of the read for a read).
+    uint8_t rssi_min;
+    uint8_t rssi_max;
+    uint32_t count;                                                                 //Reads so far.
+    uint32_t first_ms;                                                              //First seen, ms since boot.
+    uint32_t time_ms;                                                               //Last seen, ms since boot.
+#if VM5F_TIMING
+    uint32_t t_cmd_us;                                                              //Inventory command of the round that read it (0: unknown).
+    uint32_t t_queued_us;
+#endif
+
+}tag_event_t;
+
+//Command Target: where a command goes and where its response comes back.
+typedef struct vm5f_target
+{
+    const vm5f_transport_t* io;
+    uint8_t add;
+    xQueueHandle resp;
+
+}vm5f_target_t;
+
+//UART Link: driver state of one UART transport.
+typedef struct uart_link
+{
+    uart_port_t port;
+    QueueHandle_t events;                                                           //Driver event queue.
+    int pending;                                                                    //Bytes announced by events, not read yet.
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+
+}uart_link_t;
+
+//Door Event: from the STOP interrupt and the door timers to gpio_task.
+typedef struct door_event
+{
+    uint8_t type;
+    uint32_t time_us;                                                               //When it happened, esp_timer time.
+
+}door_event_t;
+
+//Inventory Config: real time (fast switch antenna sequence), buffered or session mode.
+typedef struct inventory_config
+{
+    uint8_t mode;
+    ant_step_t seq[ANT_SEQ_LEN];
+    uint8_t interval;
+    uint8_t repeat;                                                                 //Session mode: rounds per command.
+    uint8_t buffer_rounds;
+    uint8_t session;                                                                //SESSION_S0 to SESSION_S3.
+    uint8_t target;                                                                 //TARGET_A/TARGET_B, the first one with auto_flip.
+    uint8_t sl;                                                                     //SL_* select flag filter.
+    uint8_t auto_flip;                                                              //1: swap target after a round with no new EPC.
+
+}inventory_config_t;
+
+//Scheduler Config: how inventory backs off while the field is empty. Active rounds run back to back
+//as configured by inventory_configure(), at active_dbm.
+typedef struct sched_config
+{
+    uint16_t idle_after;                                                            //No tag read this long: idle (ms).
+    uint16_t idle_gap;                                                              //Pause after an empty idle round (ms).
+    uint8_t idle_repeat;                                                            //Sequence repeats (buffered: Reader rounds) per idle round.
+    uint8_t idle_dbm;
+    uint8_t active_dbm;
+
+}sched_config_t;
+
+//EPC Prefix: with an EPC filter set, only tags whose EPC starts with one of these bits are reported.
+//Build with -DEPC_FILTER_PREFIX=0xE2,0x80,0x68,0x94 -DEPC_FILTER_BITS=32 to start with one.
+typedef struct epc_prefix
+{
+    uint8_t epc[TAG_EPC_MAX];
+    uint8_t bits;
+
+}epc_prefix_t;
+
+//Tag Memory: one tag of a batch memory read, the caller fills in the EPC.
+typedef struct tag_mem
+{
+    uint8_t epc[TAG_EPC_MAX];
+    uint8_t epc_len;
+    uint8_t len;                                                                    //Bytes read, 0: the tag did not answer.
+    uint8_t ant;
+    uint8_t data[TAG_MEM_MAX];
+
+}tag_mem_t;
+
+//Memory Read Job: a batch handed to rfid_task, filled in from the 0x81 frames by uart_rx_task.
+typedef struct mem_job
+{
+    tag_mem_t tags[TAG_MEM_BATCH_MAX];
+    int count;
+    int done;                                                                       //Tags read so far.
+    uint8_t membank;
+    uint8_t word_add;
+    uint8_t word_cnt;
+    int expected;                                                                   //TagCount of the running read command.
+    int received;
+
+}mem_job_t;
+
+//Health Series: the last HEALTH_WINDOW samples of a Reader reading.
+typedef struct health_series
+{
+    int16_t v[HEALTH_WINDOW];
+    uint8_t n;
+    uint8_t pos;
+
+}health_series_t;
+
+//Per mode counters, to compare unique tags/s and UART bytes per unique tag.
+typedef struct mode_stats
+{
+    uint32_t rounds;
+    uint32_t time_ms;
+    uint32_t rx_bytes;
+    uint32_t records;                                                               //Tag frames received.
+    uint32_t unique;                                                                //Distinct EPCs, counted per round.
+
+}mode_stats_t;
+
+static inventory_config_t inv_config =
+{
+    .mode = INVENTORY_REALTIME,
+    .seq = { { ANTENNA_1, 1 }, { ANTENNA_NONE, 0 }, { ANTENNA_NONE, 0 }, { ANTENNA_NONE, 0 } },
+    .interval = ANT_SWITCH_INTERVAL,
+    .repeat = ANT_SWITCH_REPEAT,
+    .buffer_rounds = BUFFER_ROUNDS,
+    .session = SESSION_S2,
+    .target = TARGET_A,
+    .sl = SL_NONE,
+    .auto_flip = 1,
+};
+static sched_config_t sched_config =
+{
+    .idle_after = SCHED_IDLE_AFTER,
+    .idle_gap = SCHED_IDLE_GAP,
+    .idle_repeat = SCHED_IDLE_REPEAT,
+    .idle_dbm = SCHED_IDLE_DBM,
+    .active_dbm = SCHED_ACTIVE_DBM,
+};
+static portMUX_TYPE inv_config_lock = portMUX_INITIALIZER_UNLOCKED;                 //inv_config and sched_config.
+
+static xQueueHandle resp_queue = NULL;
+static vm5f_target_t reader_target;                                                 //The single Reader: vm5f_io, broadcast, resp_queue.
+static uart_link_t uart2_link = { UART_NUM_2 };
+static TaskHandle_t rfid_task_handle = NULL;
+static TaskHandle_t gpio_task_handle = NULL;
+static TaskHandle_t uart_rx_task_handle = NULL;
+static TaskHandle_t tag_task_handle = NULL;
+static StackType_t gpio_task_stack[GPIO_TASK_STACK];
+static StackType_t uart_rx_task_stack[UART_RX_TASK_STACK];
+static StackType_t rfid_task_stack[RFID_TASK_STACK];
+static StackType_t tag_task_stack[TAG_TASK_STACK];
+static StackType_t stats_task_stack[STATS_TASK_STACK];
+static StackType_t log_task_stack[LOG_TASK_STACK];
+static StackType_t journal_task_stack[JOURNAL_TASK_STACK];
+static StaticTask_t gpio_task_tcb;
+static StaticTask_t uart_rx_task_tcb;
+static StaticTask_t rfid_task_tcb;
+static StaticTask_t tag_task_tcb;
+static StaticTask_t stats_task_tcb;
+static StaticTask_t log_task_tcb;
+static StaticTask_t journal_task_tcb;
+static StackType_t host_task_stack[HOST_TASK_STACK];
+static StaticTask_t host_task_tcb;
+static TaskHandle_t host_task_handle = NULL;
+static TaskHandle_t journal_task_handle = NULL;                                     //NULL: no journal partition.
+static journal_flash_t journal_flash;
+static journal_t journal;                                                           //Only touched by journal_task once it runs.
+static spsc_ring_t journal_ring;                                                    //Door events, gpio_task -> journal_task.
+static uint8_t journal_ring_storage[JOURNAL_RING_LEN * sizeof(journal_record_t)];
+static volatile int journal_exporting = 0;                                          //Console carries the binary export, no text.
+static StackType_t console_task_stack[CONSOLE_TASK_STACK];
+static StaticTask_t console_task_tcb;
+static QueueHandle_t console_events = NULL;                                         //Console UART driver events.
+static uint8_t allow_upload_buf[ALLOW_UPLOAD_CHUNK];
+
+//Tag event bus: tag_task publishes arrivals and departures, the door, the journal and the host
+//forwarder each take them from their own queue. Static so nothing on the tag path touches the heap.
+static event_bus_t tag_bus;
+static uint8_t tag_bus_pool[EVENT_POOL_LEN * sizeof(tag_event_t)];
+static uint8_t tag_bus_ref[EVENT_POOL_LEN];
+static event_sub_t door_sub;                                                        //gpio_task, EVENT_BLOCK.
+static event_sub_t journal_sub;                                                     //journal_task, EVENT_DROP_OLDEST.
+static event_sub_t host_sub;                                                        //host_task, EVENT_DROP_OLDEST.
+static uint16_t door_sub_slot[DOOR_SUB_LEN];
+static uint16_t journal_sub_slot[JOURNAL_SUB_LEN];
+static uint16_t host_sub_slot[HOST_SUB_LEN];
+static SemaphoreHandle_t door_tag_sem = NULL;                                       //Given per event queued for gpio_task.
+static StaticSemaphore_t door_tag_sem_buf;
+//Queue storage is static so nothing on the tag path touches the heap.
+static uint8_t door_queue_storage[DOOR_QUEUE_LEN * sizeof(door_event_t)];
+static StaticQueue_t door_queue_buf;
+static xQueueHandle door_queue = NULL;
+static QueueSetHandle_t door_queue_set = NULL;                                      //door_tag_sem + door_queue, gpio_task waits on both.
+static TimerHandle_t door_hold_timer = NULL;                                        //Relay hold after STOP.
+static TimerHandle_t door_force_timer = NULL;                                       //STOP held long.
+static TimerHandle_t stop_debounce_timer = NULL;                                    //Re-checks STOP once it has settled.
+static StaticTimer_t door_hold_timer_buf;
+static StaticTimer_t door_force_timer_buf;
+static StaticTimer_t stop_debounce_timer_buf;
+static int stop_level = 1;                                                          //Debounced STOP level, 0 = pressed. gpio_task's.
+static uint32_t stop_edge_us = 0;                                                   //Last STOP edge posted, stop_isr's.
+static int door_state = DOOR_IDLE;
+static uint32_t door_busy_tags = 0;                                                 //Badges read while the door was not idle.
+static uint8_t resp_queue_storage[RESP_QUEUE_LEN * sizeof(vm5f_response_t)];
+static StaticQueue_t resp_queue_buf;
+static rx_ring_t rx_ring;                                                           //Receive ring for UART2.
+static frame_parser_t rx_parser;
+static uint32_t rx_resp_dropped = 0;
+static uint32_t tag_queue_dropped = 0;
+static uint32_t allow_denied = 0;                                                   //Tags ignored, not on the allowlist.
+static mode_stats_t mode_stats[INVENTORY_MODES];
+static const char * const mode_names[INVENTORY_MODES] = { "real time", "buffered", "session" };
+static uint32_t round_seen[ROUND_SEEN_MAX];                                          //EPC hashes seen this round (session mode: this target).
+static int round_seen_count = 0;
+static int round_reads = 0;                                                         //Tag reads this round.
+static int round_new = 0;                                                           //EPCs not in round_seen before, this round.
+static int round_bytes = 0;                                                         //Inventory frame bytes this round.
+static volatile int round_probe = 0;                                                //Unfiltered probe round: tag frames counted, never reported.
+static uint8_t session_target = TARGET_A;                                           //Target of the next session round with auto_flip.
+static uint32_t session_flips = 0;
+static tag_table_t tag_table;                                                       //Only touched by tag_task.
+static spsc_ring_t read_ring;                                                       //Tag reads, uart_rx_task -> tag_task.
+static uint8_t read_ring_storage[READ_RING_LEN * sizeof(tag_event_t)];
+static uint32_t tag_reads = 0;
+static uint32_t tag_pc_mismatch = 0;                                                //Tag frames whose PC word claimed a longer EPC.
+static uint32_t tag_bad_frames = 0;                                                 //Buffered tag frames whose DataLen does not fit, skipped.
+static mem_job_t mem_job;                                                           //Batch memory read, owned by rfid_task while mem_job_busy.
+static volatile int mem_job_busy = 0;                                               //1: handed over, 2: being read.
+static volatile int mem_job_active = 0;                                             //uart_rx_task may fill it in.
+static SemaphoreHandle_t mem_job_lock = NULL;                                       //One batch at a time.
+static SemaphoreHandle_t mem_job_done = NULL;
+static StaticSemaphore_t mem_job_lock_buf;
+static StaticSemaphore_t mem_job_done_buf;
+static uint32_t mem_commands = 0;
+static uint32_t mem_frames = 0;
+static uint32_t mem_tags_read = 0;
+static uint32_t mem_unmatched = 0;                                                  //Frames of tags not in the batch.
+static uint32_t frame_cycles = 0;                                                   //CPU cycles spent handling frames, per stats period.
+static uint32_t frame_count = 0;
+static uint32_t tag_arrivals = 0;
+#if VM5F_TIMING
+static volatile uint32_t timing_cmd_us = 0;                                         //Last inventory command sent.
+static volatile int timing_cmd_pending = 0;                                         //Its answer has not started yet.
+static uint32_t timing_rx_us = 0;                                                   //Last bytes read.
+static uint32_t timing_frame_us = 0;                                                //Last frame checksum OK.
+#endif
+static uint32_t reader_init_ms = 0;                                                 //Duration of the last Reader init.
+static int sched_idle = 0;                                                          //Backed off, field empty.
+static uint8_t sched_dbm = 0;                                                       //Output power last set by the scheduler, 0: unknown.
+static uint32_t sched_seen_ms = 0;                                                  //End of the last round that read a tag.
+static uint32_t sched_switches = 0;
+static uint32_t sched_rounds[2];                                                    //Per state, active/idle.
+static uint32_t sched_rf_ms[2];                                                     //Time spent in rounds, per state.
+static uint32_t sched_time_ms[2];                                                   //Time spent in the state.
+static health_series_t health_temp;                                                 //Reader temperature (C).
+static health_series_t health_rl[HEALTH_ANTENNAS];                                  //Return loss per antenna (dB).
+static uint32_t health_ant_errors[HEALTH_ANTENNAS];                                 //Antenna detection errors in inventory rounds.
+static uint32_t health_ant_errors_seen[HEALTH_ANTENNAS];                            //health_ant_errors at the antenna's last check.
+static uint8_t health_ant_skip = 0;                                                 //Bit per antenna left out of inventory.
+static uint8_t health_dbm_cap = POWER_MAX_DBM;                                      //Output power limit while hot.
+static uint8_t health_work_ant = ANTENNA_1;                                         //Work antenna set on the Reader.
+static int health_step = 0;                                                         //Next check: temperature, reset, then each antenna.
+static uint32_t health_next_ms = 0;
+static int health_fails = 0;
+static uint32_t health_derates = 0;
+static uint32_t health_skips = 0;
+static uint32_t health_failovers = 0;
+static uint32_t health_resets = 0;                                                  //Reader resets detected, init run again.
+static uint32_t health_power_cycles = 0;
+static uint32_t health_timeouts = 0;
+static int health_ant_restore = 0;                                                  //Work antenna not set back after a return loss check.
+static epc_prefix_t epc_filter[MASK_MAX];
+static int epc_filter_count = 0;                                                    //0: every tag reported.
+static uint8_t epc_filter_mode = INVENTORY_REALTIME;                                //Inventory mode held back while a filter is set.
+static volatile int epc_filter_dirty = 0;                                           //Reader needs the filter (again) before the next round.
+static int epc_filter_applied = 0;                                                  //Masks the Reader holds, as far as known.
+static uint32_t epc_filter_check_ms = 0;
+static uint32_t epc_filter_applies = 0;
+static uint32_t epc_filter_lost = 0;                                                //Masks found gone (Reader reset).
+static uint32_t epc_filter_probes = 0;
+static uint32_t epc_probe_frames = 0;                                               //Tag frames and bytes of the last unfiltered probe round.
+static uint32_t epc_probe_bytes = 0;
+static uint32_t epc_saved_frames = 0;                                               //Estimate: probe round minus filtered round, summed.
+static uint32_t epc_saved_bytes = 0;
+#ifdef EPC_FILTER_PREFIX
+static const epc_prefix_t epc_filter_build = { { EPC_FILTER_PREFIX }, EPC_FILTER_BITS };
+#elif VM5F_SIM && VM5F_SIM_FILTER
+static const epc_prefix_t epc_filter_build = { { 0xE2, 0x80, 0x68, 0x94 }, 32 };  //The simulator's own tags.
+#endif
+#if VM5F_SIM
+static uint32_t sim_foreign_posted = 0;                                             //Reads outside the EPC filter handed to tag_task, must stay 0.
+#endif
+#if VM5F_SIM
+static uint16_t bench_latency[BENCH_SAMPLES];                                       //Tag-to-relay latencies (ms), newest last.
+static uint32_t bench_latency_count = 0;
+#endif
+static int buffer_expected = 0;                                                     //Tags in the Reader's buffer being read out.
+static int buffer_received = 0;
+
+//Set up a UART and install its driver. With a DE pin the port runs RS-485 half duplex: the driver
+//raises RTS (wired to the transceiver's DE and /RE) while it sends, so it does not hear its own frames.
+static void uart_link_open(uart_link_t* link, int txd, int rxd, int de, int baud)
+{
     const uart_config_t uart_config = {
-        .baud_rate = 115200,
+        .baud_rate = baud,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
     };
-    uart_param_config(UART_NUM_2, &uart_config);
-    uart_set_pin(UART_NUM_2, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
-    uart_driver_install(UART_NUM_2, RX_BUF_SIZE * 2 ,0 , 0, NULL, 0);
+    uart_param_config(link->port, &uart_config);
+    uart_set_pin(link->port, txd, rxd, de, UART_PIN_NO_CHANGE);
+    uart_driver_install(link->port, RX_BUF_SIZE * 2 ,0 , 20, &link->events, 0);
+    if(de != UART_PIN_NO_CHANGE)
+    {
+        uart_set_mode(link->port, UART_MODE_RS485_HALF_DUPLEX);
+    }
+}
+
+//UART transport: frames go out through the driver's TX path, input comes through its event queue.
+static int uart_transport_write(const vm5f_transport_t* io, const uint8_t* data, int len)
+{
+    uart_link_t* link = io->ctx;
+
+    link->tx_bytes += len;
+    return uart_write_bytes(link->port, (const char*) data, len);
+}
+
+//Read what the driver holds (up to max), waiting up to timeout_ms for it. Returns 0 when nothing
+//arrived, -1 after a FIFO or buffer overflow (bytes were lost, input is flushed).
+static int uart_transport_read(const vm5f_transport_t* io, uint8_t* buf, int max, uint32_t timeout_ms)
+{
+    uart_link_t* link = io->ctx;
+    uart_event_t event;
+
+    while(1)
+    {
+        if(link->pending > 0)
+        {
+            const int n = uart_read_bytes(link->port, buf, link->pending < max ? link->pending : max, 0);
+            if(n > 0)
+            {
+                link->pending -= n;
+                link->rx_bytes += n;
+                return n;
+            }
+            link->pending = 0;
+        }
+        if(xQueueReceive(link->events, &event, timeout_ms / portTICK_RATE_MS) != pdTRUE)
+        {
+            return 0;
+        }
+        switch(event.type)
+        {
+            case UART_DATA:
+                link->pending += event.size;
+                break;
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                //Bytes are already lost, start over clean.
+                LOGE(LOG_RX_OVERFLOW, event.type);
+                uart_flush_input(link->port);
+                xQueueReset(link->events);
+                link->pending = 0;
+                return -1;
+
+            default:
+                break;
+        }
+    }
+}
+
+static const vm5f_transport_t uart_transport =
+{
+    .name = "uart2",
+    .write = uart_transport_write,
+    .read = uart_transport_read,
+    .ctx = &uart2_link,
+};
+
+#if VM5F_SIM
+/***************************** Simulated Reader ***************************************/
+static vm5f_sim_t sim;
+static SemaphoreHandle_t sim_lock = NULL;                                           //uart_rx_task reads, rfid_task writes.
+static SemaphoreHandle_t sim_wake = NULL;                                           //Given on every write, ends a read wait.
+static StaticSemaphore_t sim_lock_buf;
+static StaticSemaphore_t sim_wake_buf;
+
+static int sim_transport_write(const vm5f_transport_t* io, const uint8_t* data, int len)
+{
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    const int n = vm5f_sim_write(&sim, data, len, esp_timer_get_time());
+    xSemaphoreGive(sim_lock);
+    xSemaphoreGive(sim_wake);
+    return n;
+}
+
+//Same contract as the UART: bytes due by now, or wait until some are due or the timeout ends.
+static int sim_transport_read(const vm5f_transport_t* io, uint8_t* buf, int max, uint32_t timeout_ms)
+{
+    const int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+
+    while(1)
+    {
+        const int64_t now = esp_timer_get_time();
+        xSemaphoreTake(sim_lock, portMAX_DELAY);
+        const int n = vm5f_sim_read(&sim, buf, max, now);
+        const uint64_t due = vm5f_sim_next_due(&sim);
+        xSemaphoreGive(sim_lock);
+        if(n > 0)
+        {
+            return n;
+        }
+        if(now >= deadline)
+        {
+            return 0;
+        }
+        const int64_t wake = (due < (uint64_t) deadline) ? (int64_t) due : deadline;
+        const TickType_t ticks = (wake - now) / 1000 / portTICK_RATE_MS;
+        xSemaphoreTake(sim_wake, ticks ? ticks : 1);
+    }
+}
+
+static const vm5f_transport_t sim_transport =
+{
+    .name = "simulator",
+    .write = sim_transport_write,
+    .read = sim_transport_read,
+};
+
+#if VM5F_SIM_DISCOVERY
+#define DISCOVERY_TIMEOUT 10000                                                     //Longest discovery run (ms).
+static const uint16_t discovery_tags[] = { 10, 50, 100, 250, 500 };                 //Populations benchmarked.
+static uint8_t discovery_seen[SIM_TAGS_MAX / 8];                                    //Simulated tags read so far, one bit each.
+static volatile uint32_t discovery_found = 0;
+
+//Count a simulated tag the first time it is read.
+static void discovery_note(const tag_event_t* tag)
+{
+    const int i = vm5f_sim_tag_index(&sim, tag->epc, tag->epc_len);
+
+    if(i >= 0 && !(discovery_seen[i / 8] & (1 << (i % 8))))
+    {
+        discovery_seen[i / 8] |= 1 << (i % 8);
+        discovery_found++;
+    }
+}
+#endif
+#endif
+
+//Intializing UART
+void init() 
+{                         
+    /*****UART Config*****/                                  
+#if VM5F_BUS
+    //The buses open their own UARTs in bus_start().
+#elif VM5F_SIM
+#if VM5F_SIM_FLOOD
+    const vm5f_sim_config_t sim_config = VM5F_SIM_FLOOD_CONFIG;
+#elif VM5F_SIM_HEALTH
+    const vm5f_sim_config_t sim_config = VM5F_SIM_HEALTH_CONFIG;
+#elif VM5F_SIM_SHORT
+    const vm5f_sim_config_t sim_config = VM5F_SIM_SHORT_CONFIG;
+#elif VM5F_SIM_FILTER
+    const vm5f_sim_config_t sim_config = VM5F_SIM_FILTER_CONFIG;
+#else
+    const vm5f_sim_config_t sim_config = VM5F_SIM_DEFAULTS;
+#endif
+    vm5f_sim_init(&sim, &sim_config);
+    sim_lock = xSemaphoreCreateMutexStatic(&sim_lock_buf);
+    sim_wake = xSemaphoreCreateBinaryStatic(&sim_wake_buf);
+    vm5f_set_transport(&sim_transport);
+    printf("VM-5F simulator: %u tags \n", sim.cfg.tags);
+#else
+    uart_link_open(&uart2_link, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, 115200);
+    vm5f_set_transport(&uart_transport);
+#endif
+
+    log_init();
+    ring_init(&rx_ring);
+    frame_parser_init(&rx_parser, &rx_ring);
+    tag_table_init(&tag_table, TAG_EXPIRY_MS, TAG_HOLDOFF_MS);
+    spsc_init(&read_ring, read_ring_storage, sizeof(tag_event_t), READ_RING_LEN);
 }
 
 //Setting up GPIOs
@@ -74,8 +706,8 @@ void gpio_setup()
     //configure GPIO with the given settings
     gpio_config(&io_conf);
 
-    //Disable interrupt
-    io_conf.intr_type = GPIO_PIN_INTR_DISABLE;
+    //interrupt on both edges, STOP press and release
+    io_conf.intr_type = GPIO_PIN_INTR_ANYEDGE;
     //bit mask of the pins, use GPIO19 here
     io_conf.pin_bit_mask = GPIO_INPUT_PIN_SEL;
     //set as input mode    
@@ -87,181 +719,2639 @@ void gpio_setup()
     gpio_config(&io_conf);
 }
 
-//Function to get Data from RFID Reader in RData_packet structure.
+//Function to get Data from RFID Reader, waits for the next command response and logs it.
 unsigned char getData()
 {
-    uint8_t* data = (uint8_t*) malloc(RX_BUF_SIZE+1);
-    int j = 0;
-    struct RData_packet * dpack2;
-    dpack2 = (struct RData_packet*)data;
-
-     const int rxBytes = uart_read_bytes(UART_NUM_2, data, RX_BUF_SIZE, 1000 / portTICK_RATE_MS);
-        if(rxBytes > 0) 
-        {
-            data[rxBytes] = 0;
-            j = (rxBytes - 5);          //here, j = length of Data[] received(head, len, add, cmd, checksum excluded).
-            //printf("rx bytes:   %d\n", rxBytes);
-            //printf("rx head:    %02x \n", dpack2->head);
-            //printf("rx length:  %02x \n", dpack2->len);
-            //printf("rx address: %02x \n", dpack2->add);
-            printf("rx command: %02x \n", dpack2->cmd);
-            printf("rx data:    ");
-            for(int i=0; i<j; i++)              
-            {
-                printf("%02x ", dpack2->data[i]);
-            }
-            printf("\n");
-            printf("rx checksum: %02x \n", dpack2->check);  
+    vm5f_response_t resp;
+
+    if(xQueueReceive(resp_queue, &resp, RESP_TIMEOUT / portTICK_RATE_MS) != pdTRUE)
+    {
+        LOGW(LOG_RX_TIMEOUT);
+        return 0;
+    }
+    LOGI(LOG_RX_RESPONSE, resp.cmd, resp.data_len);
+    return resp.data_len;
+}
+
+//Wait for a Reader's response to cmd, sent just before. Responses to other commands (late replies from
+//earlier timeouts) are skipped. Returns 0 with resp filled, -1 on timeout.
+static int vm5f_response_wait(const vm5f_target_t* target, uint8_t cmd, vm5f_response_t* resp, int timeout_ms)
+{
+    const TickType_t start = xTaskGetTickCount();
+    const TickType_t timeout = timeout_ms / portTICK_RATE_MS;
+
+    while(1)
+    {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if(waited >= timeout || xQueueReceive(target->resp, resp, timeout - waited) != pdTRUE)
+        {
+            return -1;
+        }
+        if(resp->cmd == cmd)
+        {
+            return 0;
+        }
+    }
+}
+
+//Send a command to a Reader and wait for its response. Returns 0 with resp filled, -1 on timeout.
+static int vm5f_command(const vm5f_target_t* target, uint8_t cmd, const uint8_t* params, int nparams,
+                        vm5f_response_t* resp, int timeout_ms)
+{
+    if(vm5f_send_to(target->io, target->add, cmd, params, nparams) < 0)
+    {
+        return -1;
+    }
+    return vm5f_response_wait(target, cmd, resp, timeout_ms);
+}
+
+//Count an EPC once per round (FNV-1a hash, linear search: rounds hold few distinct tags).
+static int round_note_epc(const tag_event_t* tag)
+{
+    uint32_t h = 2166136261u;
+    for(int i=0; i<tag->epc_len; i++)
+    {
+        h = (h ^ tag->epc[i]) * 16777619u;
+    }
+    for(int i=0; i<round_seen_count; i++)
+    {
+        if(round_seen[i] == h)
+        {
+            return 0;
+        }
+    }
+    if(round_seen_count < ROUND_SEEN_MAX)
+    {
+        round_seen[round_seen_count++] = h;
+    }
+    return 1;
+}
+
+//Publish an arrival or departure on tag_bus.
+//read is the read that caused it, NULL from the sweep.
+static void tag_emit(const tag_entry_t* e, int type, uint8_t reader, const tag_event_t* read)
+{
+    tag_event_t* tag = event_bus_claim(&tag_bus);
+
+    if(tag == NULL)
+    {
+        tag_queue_dropped++;
+        return;
+    }
+    tag->type = type;
+    tag->reader = reader;
+    memcpy(tag->epc, e->epc, e->epc_len);
+    tag->epc_len = e->epc_len;
+    tag->pc = e->pc;
+    tag->ant = e->ant;
+    tag->freq = e->freq;
+    tag->rssi = tag_entry_rssi_mean(e);
+    tag->rssi_min = e->rssi_min;
+    tag->rssi_max = e->rssi_max;
+    tag->count = e->count;
+    tag->first_ms = e->first_ms;
+    tag->time_ms = e->last_ms;
+    if(type == TAG_ARRIVED)
+    {
+        tag_arrivals++;
+    }
+
+    LOGI(type == TAG_ARRIVED ? LOG_TAG_ARRIVED : LOG_TAG_DEPARTED, LOG_EPC(tag->epc, tag->epc_len), tag->ant, tag->count);
+    LOGD(LOG_TAG_RSSI, tag->rssi_min, tag->rssi, tag->rssi_max);
+
+#if VM5F_TIMING
+    tag->t_cmd_us = (read != NULL) ? read->t_cmd_us : 0;
+    TIMING_STAMP(tag->t_queued_us);
+    if(read != NULL)
+    {
+        TIMING_RECORD(TIMING_FRAME_TO_QUEUE, read->t_queued_us, tag->t_queued_us);
+    }
+#endif
+    event_bus_publish(&tag_bus, tag);                           //Waits only on gpio_task, never on the journal or host.
+}
+
+//Table sweep callback, ctx is the Reader number.
+static void tag_sweep_emit(const tag_entry_t* e, int type, void* ctx)
+{
+    tag_emit(e, type, (uint8_t)(uintptr_t) ctx, NULL);
+}
+
+//Pass a decoded read to tag_task on the policy core. The read carries the stamps of the
+//command and frame that produced it, t_queued_us is the frame time until tag_task takes it.
+static void tag_post(spsc_ring_t* ring, tag_event_t* tag, uint8_t reader)
+{
+    tag->type = 0;
+    tag->reader = reader;
+    tag->time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+#if VM5F_TIMING
+    tag->t_cmd_us = timing_cmd_us;
+    tag->t_queued_us = timing_frame_us;
+#endif
+    spsc_push(ring, tag);                                   //Full: dropped and counted, never stall the receive path.
+}
+
+#if VM5F_SIM
+//Does the EPC start with one of the filter prefixes? The Reader's masks decide, this only checks them.
+static int epc_filter_match(const uint8_t* epc, int len)
+{
+    for(int i=0; i<epc_filter_count; i++)
+    {
+        const epc_prefix_t* f = &epc_filter[i];
+        int b = 0;
+        while(b < f->bits && b < len * 8 && ((epc[b / 8] ^ f->epc[b / 8]) & (0x80 >> (b % 8))) == 0)
+        {
+            b++;
+        }
+        if(b == f->bits)
+        {
+            return 1;
         }
-        free(data);
-        uart_flush(UART_NUM_2);
-        return rxBytes;       
+    }
+    return epc_filter_count == 0;
+}
+#endif
+
+//Hand a decoded tag read on, tag_task folds it into the tag table.
+static void tag_publish(tag_event_t* tag, int mode)
+{
+    const int fresh = round_note_epc(tag);
+
+    tag_reads++;
+    round_reads++;
+    round_new += fresh;
+    mode_stats[mode].records++;
+    mode_stats[mode].unique += fresh;
+#if VM5F_SIM && VM5F_SIM_DISCOVERY
+    discovery_note(tag);
+#endif
+#if VM5F_SIM
+    sim_foreign_posted += !epc_filter_match(tag->epc, tag->epc_len);
+#endif
+    tag_post(&read_ring, tag, 0);
+}
+
+//Fill a tag read in from a tag view. The EPC is the one copy out of the receive ring, into the
+//read that crosses to tag_task.
+static void tag_from_view(const tag_view_t* view, tag_event_t* tag)
+{
+    tag->pc = view->pc;
+    tag->epc_len = tag_view_copy_epc(view, tag->epc, TAG_EPC_MAX);
+    tag->rssi = view->rssi;
+    tag->freq = tag_view_freq(view);
+    tag->ant = tag_view_ant(view);
+    tag->count = view->count;
+    tag_pc_mismatch += view->pc_mismatch;
+}
+
+//Function for Tag Detection, handles one tag frame of a real time or session inventory round.
+//Frame data: Freq/Ant, PC(2), EPC, RSSI.
+unsigned char TagDetect(const frame_view_t* frame)
+{
+    tag_view_t view;
+    tag_event_t tag;
+
+    tag_view_inventory(frame, &view);
+    tag_from_view(&view, &tag);
+    tag_publish(&tag, frame->cmd == CMD_SESSION_INVENTORY ? INVENTORY_SESSION : INVENTORY_REALTIME);
+    return frame_data_len(frame);
+}
+
+//Decode one tag frame of a Reader's inventory buffer, returns the frame's TagCount, -1 when its
+//DataLen does not match the frame (counted, the frame is skipped).
+//Frame data: TagCount(2), DataLen, PC(2)+EPC+CRC(2), RSSI, Freq/Ant, InvCount.
+static int tag_decode_buffered(const frame_view_t* frame, tag_event_t* tag)
+{
+    tag_view_t view;
+    const int count = tag_view_buffered(frame, &view);
+
+    if(count < 0)
+    {
+        tag_bad_frames++;
+        return -1;
+    }
+    tag_from_view(&view, tag);
+    return count;
+}
+
+//Tag Detection for one tag frame of the Reader's inventory buffer. Returns its TagCount, -1 if skipped.
+static int TagDetectBuffered(const frame_view_t* frame)
+{
+    tag_event_t tag;
+    const int count = tag_decode_buffered(frame, &tag);
+
+    if(count >= 0)
+    {
+        tag_publish(&tag, INVENTORY_BUFFERED);
+    }
+    return count;
+}
+
+//One tag frame of a read tag memory command: fill in the batch entry with that EPC.
+//Returns 1 when it was the command's last frame.
+static int mem_read_frame(const frame_view_t* frame)
+{
+    tag_view_t view;
+    const int count = tag_view_read(frame, &view);
+
+    mem_frames++;
+    if(count < 0)
+    {
+        return 0;
+    }
+    int i = 0;
+    while(i < mem_job.count && !tag_view_epc_equal(&view, mem_job.tags[i].epc, mem_job.tags[i].epc_len))
+    {
+        i++;
+    }
+    if(i == mem_job.count)
+    {
+        mem_unmatched++;
+    }
+    else if(mem_job.tags[i].len == 0)
+    {
+        tag_mem_t* t = &mem_job.tags[i];
+        t->len = tag_view_copy_mem(&view, t->data, TAG_MEM_MAX);
+        t->ant = tag_view_ant(&view);
+        mem_job.done += (t->len > 0);
+    }
+    tag_pc_mismatch += view.pc_mismatch;
+    mem_job.expected = count;
+    return ++mem_job.received >= count;
+}
+
+//Copy a command response frame to the queue of whoever waits for it.
+static void frame_respond(const frame_view_t* frame, xQueueHandle queue)
+{
+    vm5f_response_t resp;
+    resp.add = frame->add;
+    resp.cmd = frame->cmd;
+    resp.data_len = frame_data_len(frame);
+    if(resp.data_len > sizeof(resp.data))
+    {
+        resp.data_len = sizeof(resp.data);
+    }
+    for(int i=0; i<resp.data_len; i++)
+    {
+        resp.data[i] = frame_data(frame, i);
+    }
+    if(xQueueSend(queue, &resp, 0) != pdTRUE)
+    {
+        rx_resp_dropped++;
+    }
 }
 
-//Function for Tag Detection.
-unsigned char TagDetect()
+//Wake rfid_task, the current round is over.
+static void round_done()
 {
-    uint8_t* tagdata = (uint8_t*) malloc(RX_BUF_SIZE+1);
-    int j = 0;
-    uint32_t tag_id;
-    struct RData_packet * dpack3;
-    dpack3 = (struct RData_packet*)tagdata;
+    if(rfid_task_handle != NULL)
+    {
+        xTaskNotifyGive(rfid_task_handle);
+    }
+}
 
-    const int rxBytes = uart_read_bytes(UART_NUM_2, tagdata, RX_BUF_SIZE, 1000 / portTICK_RATE_MS);
-        if(rxBytes > 0) 
+//Route one complete frame: tag reads to TagDetect(), end of round to rfid_task, everything else to resp_queue.
+static void dispatch_frame(const frame_view_t* frame)
+{
+    if(frame->cmd == CMD_REAL_TIME_INVENTORY || frame->cmd == CMD_FAST_SWITCH_INVENTORY || frame->cmd == CMD_SESSION_INVENTORY)
+    {
+        const int kind = inventory_frame_kind(frame);
+        if(kind == INV_FRAME_TAG && round_probe)
+        {
+            round_reads++;                                          //Probe: only measured, foreign tags must not reach the door.
+        }
+        else if(kind == INV_FRAME_TAG)
+        {
+            TagDetect(frame);
+        }
+        else if(kind == INV_FRAME_ANT_ERROR)
+        {
+            //Fast switch only: one antenna of the sequence failed (ant, error), the round goes on.
+            LOGW(LOG_ANT_ERROR, frame_data(frame, 0), frame_data(frame, 1));
+            health_ant_errors[frame_data(frame, 0) & 0x03]++;
+        }
+        else
         {
-            tagdata[rxBytes] = 0;
-            j = (rxBytes - 5);          //here, j = length of Data[] received(head, len, add, cmd, checksum excluded).
-            
-            printf("rx command: %02x \n", dpack3->cmd);
-            if(j > 10)
+            //End of round or an error code, either way the round is over.
+            if(kind == INV_FRAME_ERROR)
             {
-                printf("\t\t TAG FOUND!!! \n");
-                printf("Freq Ant: %02x \n", dpack3->data[0]);
-                printf("PC Bytes: %02x  %02x \n", dpack3->data[1], dpack3->data[2]);
-                
-                printf("RFID Tag EPC No: ");
-                for(int i=3; i<(TAG_LENGTH + 3); i++)              
-                {
-                    printf("%02x ", dpack3->data[i]);
-                }
-                printf("\n");
-                printf("\nRFID Tag other data: ");
-                for(int i=(TAG_LENGTH + 4); i<(j - 3); i++)              
+                LOGW(LOG_INVENTORY_ERROR, frame_data(frame, 0));
+                if(frame_data(frame, 0) == ERR_ANT_MISSING)
                 {
-                    printf("%02x", dpack3->data[i]);
+                    health_ant_errors[health_work_ant]++;
                 }
-                printf("\n");
-                tag_id = (uint32_t)&dpack3->data;    
-                xQueueSend(tag_found_queue, &tag_id, portMAX_DELAY);
             }
-            else
+            round_done();
+        }
+        mode_stats[frame->cmd == CMD_SESSION_INVENTORY ? INVENTORY_SESSION : INVENTORY_REALTIME].rx_bytes += frame_size(frame);
+        round_bytes += frame_size(frame);
+        return;
+    }
+    if(frame->cmd == CMD_GET_RESET_INV_BUFFER)
+    {
+        //One frame per buffered tag, done when all TagCount tags are in. 1 data byte: error, buffer empty.
+        if(frame_data_len(frame) == 1)
+        {
+            round_done();
+        }
+        else
+        {
+            const int count = TagDetectBuffered(frame);
+            if(count >= 0)
             {
-                printf("rx data:");
-                for(int i=0; i<j; i++)              
+                buffer_expected = count;
+                if(++buffer_received >= buffer_expected)
                 {
-                    printf(" %02x", dpack3->data[i]);
+                    round_done();
                 }
-                printf("\n");
             }
-            printf("rx checksum: %02x \n", dpack3->check);
         }
-    free(tagdata);
-    uart_flush(UART_NUM_2);
-    return rxBytes;
+        mode_stats[INVENTORY_BUFFERED].rx_bytes += frame_size(frame);
+        round_bytes += frame_size(frame);
+        return;
+    }
+    if(frame->cmd == CMD_READ)
+    {
+        //One frame per tag read, done when all TagCount tags are in. 1 data byte: error, no tag read.
+        //Late frames of a timed out command are dropped, they must not end an inventory round.
+        if(mem_job_active && (frame_data_len(frame) == 1 || mem_read_frame(frame)))
+        {
+            round_done();
+        }
+        return;
+    }
+    if(frame->cmd == CMD_INVENTORY)
+    {
+        mode_stats[INVENTORY_BUFFERED].rx_bytes += frame_size(frame);
+    }
+
+    frame_respond(frame, resp_queue);
 }
 
-//GPIO interrupt handling task function
-static void gpio_task(void* arg)
+//Dispatch every complete frame in the ring, then wake tag_task once for the reads they held.
+static void rx_dispatch_frames()
 {
-    uint32_t tag_id;
-    
-    gpio_set_level(GPIO_OUTPUT_IO_0, 1);                //set EN pin for RFID Reader High/On
-    //gpio_set_level(GPIO_OUTPUT_IO_1, 1);                //keep the Relay OFF, it's Active Low trigger
+    const uint32_t head = read_ring.head;
+    frame_view_t frame;
 
-    while(1) 
+    while(frame_parser_next(&rx_parser, &frame))
+    {
+        TIMING_STAMP(timing_frame_us);
+        TIMING_RECORD(TIMING_RX_TO_FRAME, timing_rx_us, timing_frame_us);
+        const uint32_t start = xthal_get_ccount();
+        dispatch_frame(&frame);
+        frame_cycles += xthal_get_ccount() - start;
+        frame_count++;
+    }
+    if(read_ring.head != head)
+    {
+        xTaskNotifyGive(tag_task_handle);
+    }
+}
+
+//Receive task: woken by the transport as soon as bytes arrive (UART: FIFO threshold or RX timeout),
+//feeds them to the frame parser and dispatches every complete frame right away.
+static void uart_rx_task(void* arg)
+{
+    static uint8_t data[RX_BUF_SIZE];
+
+    while(1)
     {
-        if(xQueueReceive(tag_found_queue, &tag_id, portMAX_DELAY))
+        const int n = vm5f_io->read(vm5f_io, data, RX_BUF_SIZE, RX_IDLE_TIME);
+        if(n < 0)
         {
-            gpio_set_level(GPIO_OUTPUT_IO_1, 0);        //Turn Relay ON, it's an Active Low trigger.
-            printf("\n\t\tDOOR LOCKED!!!\n");
-            //printf("\nRFID Tag: %d", tag_id);
-            while(gpio_get_level(GPIO_INPUT_IO_0) != 0)
+            continue;                                   //Input lost and flushed, the parser resyncs on the next head.
+        }
+        if(n == 0)
+        {
+            //Line idle: drop a partial frame that can not complete and parse what is behind it.
+            while(frame_parser_idle(&rx_parser))
             {
-                printf("\n \tPress STOP to Unlock Door.\n");
-                vTaskDelay(100 / portTICK_RATE_MS);
+                rx_dispatch_frames();
             }
-            vTaskDelay(RELAY_TRIGGER_TIME / portTICK_RATE_MS);
-            gpio_set_level(GPIO_OUTPUT_IO_1, 1);
+            continue;
+        }
+#if VM5F_TIMING
+        TIMING_STAMP(timing_rx_us);
+        if(timing_cmd_pending)
+        {
+            timing_cmd_pending = 0;
+            TIMING_RECORD(TIMING_CMD_TO_RX, timing_cmd_us, timing_rx_us);
+        }
+#endif
+        ring_write(&rx_ring, data, n);
+        rx_dispatch_frames();
+    }
+}
+
+#if VM5F_SIM
+//Tag-to-relay latency: from the tag entering the simulated field to the relay switching.
+static void bench_note_latency(const tag_event_t* tag)
+{
+    const uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+    const int i = vm5f_sim_tag_index(&sim, tag->epc, tag->epc_len);
+    uint32_t since;
+
+    if(i >= 0 && vm5f_sim_tag_present(&sim, i, now, &since))
+    {
+        const uint32_t ms = now - since;
+        bench_latency[bench_latency_count++ % BENCH_SAMPLES] = ms < 0xFFFF ? ms : 0xFFFF;
+    }
+}
+
+//Report init time and the latency percentiles.
+static void bench_report()
+{
+    static uint16_t sorted[BENCH_SAMPLES];
+    const int n = bench_latency_count < BENCH_SAMPLES ? bench_latency_count : BENCH_SAMPLES;
+
+    memcpy(sorted, bench_latency, n * sizeof(sorted[0]));
+    for(int i=1; i<n; i++)
+    {
+        const uint16_t v = sorted[i];
+        int j = i;
+        for(; j>0 && sorted[j - 1] > v; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = v;
+    }
+    printf("bench: init %u ms, tag-to-relay p50 %u ms, p99 %u ms (%d samples) \n",
+           reader_init_ms, n ? sorted[n / 2] : 0, n ? sorted[n * 99 / 100] : 0, n);
+    printf("sim: commands %u, frames %u, corrupted %u, bytes dropped %u, flash writes %u \n",
+           sim.commands, sim.frames, sim.corrupted, sim.dropped, sim.flash_writes);
+}
+#endif
+
+/***************************** Door Controller ***************************************/
+static void door_post(uint8_t type, uint32_t time_us)
+{
+    const door_event_t ev = { type, time_us };
+    xQueueSend(door_queue, &ev, 0);                     //Called from timer callbacks, must not block.
+}
+
+//STOP edge: only its time goes to gpio_task, which reads the level. Edges closer than
+//STOP_DEBOUNCE_TIME to the last one posted (bounce) are not posted, so they can not fill door_queue.
+static void IRAM_ATTR stop_isr(void* arg)
+{
+    const uint32_t now = (uint32_t) esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+
+    if(now - stop_edge_us < STOP_DEBOUNCE_TIME * 1000)
+    {
+        return;
+    }
+    stop_edge_us = now;
+    const door_event_t ev = { DOOR_EV_STOP_EDGE, now };
+    xQueueSendFromISR(door_queue, &ev, &woken);
+    if(woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+//STOP has settled: gpio_task looks again, for a change the unposted edges hid.
+static void stop_debounce_expired(TimerHandle_t timer)
+{
+    door_post(DOOR_EV_STOP_SETTLED, (uint32_t) esp_timer_get_time());
+}
+
+static void door_hold_expired(TimerHandle_t timer)
+{
+    door_post(DOOR_EV_HOLD_DONE, (uint32_t) esp_timer_get_time());
+}
+
+static void door_force_expired(TimerHandle_t timer)
+{
+    door_post(DOOR_EV_FORCE, (uint32_t) esp_timer_get_time());
+}
+
+//Journal record of a door event, tag may be NULL.
+static void journal_fill(journal_record_t* rec, uint8_t event, uint8_t action, const tag_event_t* tag)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->time_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    rec->event = event;
+    rec->action = action;
+    if(tag != NULL)
+    {
+        rec->reader = tag->reader;
+        rec->ant = tag->ant;
+        rec->rssi = tag->rssi;
+        rec->epc_len = tag->epc_len;                                //Full length, the record keeps the first JOURNAL_EPC_MAX bytes.
+        memcpy(rec->epc, tag->epc, tag->epc_len < JOURNAL_EPC_MAX ? tag->epc_len : JOURNAL_EPC_MAX);
+        rec->reads = tag->count;
+    }
+}
+
+//Hand a door event to journal_task. Never waits: a full ring drops it and counts.
+static void journal_note(uint8_t event, uint8_t action, const tag_event_t* tag)
+{
+    journal_record_t rec;
+
+    if(journal_task_handle == NULL)
+    {
+        return;
+    }
+    journal_fill(&rec, event, action, tag);
+    if(spsc_push(&journal_ring, &rec))
+    {
+        xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_EVENTS, eSetBits);
+    }
+}
+
+//Enter a state and drive the relay for it (on while LOCKED or UNLOCKING, active low).
+static void door_set_state(int state)
+{
+    const int relay_on = (state == DOOR_LOCKED || state == DOOR_UNLOCKING);
+
+    gpio_set_level(GPIO_OUTPUT_IO_1, relay_on ? 0 : 1);
+    door_state = state;
+    journal_note(JOURNAL_EV_DOOR, state, NULL);
+}
+
+//A badge arrived: lock when idle, otherwise it is consumed and counted.
+static void door_tag(const tag_event_t* tag)
+{
+#if VM5F_TIMING
+    uint32_t t_recv, t_relay;
+    TIMING_STAMP(t_recv);
+    TIMING_RECORD(TIMING_QUEUE_TO_RECV, tag->t_queued_us, t_recv);
+#endif
+    //Only listed badges work the door. Without an installed list every tag does.
+    if(allowlist_check(tag->epc, tag->epc_len) == 0)
+    {
+        allow_denied++;
+        LOGD(LOG_TAG_NOT_ALLOWED, LOG_EPC(tag->epc, tag->epc_len));
+        journal_note(JOURNAL_EV_ARRIVED, JOURNAL_ACT_DENIED, tag);
+        return;
+    }
+    if(door_state != DOOR_IDLE)
+    {
+        door_busy_tags++;
+        LOGD(LOG_DOOR_BUSY, door_state);
+        journal_note(JOURNAL_EV_ARRIVED, JOURNAL_ACT_BUSY, tag);
+        return;
+    }
+    journal_note(JOURNAL_EV_ARRIVED, JOURNAL_ACT_LOCKED, tag);
+    door_set_state(DOOR_LOCKED);                        //Turn Relay ON.
+#if VM5F_TIMING
+    TIMING_STAMP(t_relay);
+    TIMING_RECORD(TIMING_RECV_TO_RELAY, t_recv, t_relay);
+    if(tag->t_cmd_us != 0)
+    {
+        TIMING_RECORD(TIMING_CMD_TO_RELAY, tag->t_cmd_us, t_relay);
+    }
+#endif
+    LOGI(LOG_DOOR_LOCKED);
+#if VM5F_SIM
+    //Nobody presses STOP on the simulator, every arrival is a latency sample.
+    bench_note_latency(tag);
+    door_set_state(DOOR_IDLE);
+#endif
+}
+
+//STOP edge or settle check: read the level. Returns DOOR_EV_STOP_PRESSED or DOOR_EV_STOP_RELEASED
+//on a change, 0 otherwise. An edge (re)starts the settle check.
+static uint8_t stop_check(uint8_t type)
+{
+    const int level = gpio_get_level(GPIO_INPUT_IO_0);
+
+    if(type == DOOR_EV_STOP_EDGE)
+    {
+        xTimerReset(stop_debounce_timer, 0);
+    }
+    if(level == stop_level)
+    {
+        return 0;
+    }
+    stop_level = level;
+    return level ? DOOR_EV_STOP_RELEASED : DOOR_EV_STOP_PRESSED;
+}
+
+static void door_event(const door_event_t* ev)
+{
+    switch(ev->type)
+    {
+        case DOOR_EV_STOP_PRESSED:
+            TIMING_RECORD(TIMING_STOP_TO_DOOR, ev->time_us, (uint32_t) esp_timer_get_time());
+            xTimerStart(door_force_timer, 0);
+            if(door_state == DOOR_LOCKED)
+            {
+                door_set_state(DOOR_UNLOCKING);
+                xTimerStart(door_hold_timer, 0);
+                LOGI(LOG_DOOR_UNLOCKING, RELAY_TRIGGER_TIME);
+            }
+            break;
+
+        case DOOR_EV_STOP_RELEASED:
+            xTimerStop(door_force_timer, 0);
+            if(door_state == DOOR_FORCED)
+            {
+                door_set_state(DOOR_IDLE);
+                LOGI(LOG_DOOR_RELEASED);
+            }
+            break;
+
+        case DOOR_EV_HOLD_DONE:
+            if(door_state == DOOR_UNLOCKING)
+            {
+                door_set_state(DOOR_IDLE);
+                LOGI(LOG_DOOR_RELEASED);
+            }
+            break;
+
+        case DOOR_EV_FORCE:
+            if(stop_level == 0 && door_state != DOOR_FORCED)
+            {
+                xTimerStop(door_hold_timer, 0);
+                door_set_state(DOOR_FORCED);
+                LOGW(LOG_DOOR_FORCED);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+//Queues, timers and the STOP interrupt of the door controller. Call before gpio_task starts.
+static void door_init()
+{
+    door_queue = xQueueCreateStatic(DOOR_QUEUE_LEN, sizeof(door_event_t), door_queue_storage, &door_queue_buf);
+    door_tag_sem = xSemaphoreCreateBinaryStatic(&door_tag_sem_buf);
+    door_queue_set = xQueueCreateSet(1 + DOOR_QUEUE_LEN);
+    xQueueAddToSet(door_tag_sem, door_queue_set);
+    xQueueAddToSet(door_queue, door_queue_set);
+
+    door_hold_timer = xTimerCreateStatic("door_hold", RELAY_TRIGGER_TIME / portTICK_RATE_MS, pdFALSE, NULL,
+                                         door_hold_expired, &door_hold_timer_buf);
+    door_force_timer = xTimerCreateStatic("door_force", DOOR_FORCE_TIME / portTICK_RATE_MS, pdFALSE, NULL,
+                                          door_force_expired, &door_force_timer_buf);
+    stop_debounce_timer = xTimerCreateStatic("stop_debounce", STOP_DEBOUNCE_TIME / portTICK_RATE_MS, pdFALSE, NULL,
+                                             stop_debounce_expired, &stop_debounce_timer_buf);
+
+    stop_level = gpio_get_level(GPIO_INPUT_IO_0);
+    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+    gpio_isr_handler_add(GPIO_INPUT_IO_0, stop_isr, NULL);
+}
+
+//door_sub wakeup, runs in tag_task.
+static void door_sub_notify(void* ctx)
+{
+    xSemaphoreGive(door_tag_sem);
+}
+
+//Door task: badges and STOP/timer events, never blocks on anything but its queues, so arrivals
+//are taken off door_sub while the relay is active.
+static void gpio_task(void* arg)
+{
+    const tag_event_t* tag;
+    door_event_t ev;
+    
+    gpio_set_level(GPIO_OUTPUT_IO_0, 1);                //set EN pin for RFID Reader High/On
+    door_set_state(DOOR_IDLE);                          //Relay OFF, it's an Active Low trigger.
+
+    while(1) 
+    {
+        QueueSetMemberHandle_t q = xQueueSelectFromSet(door_queue_set, portMAX_DELAY);
+        if(q == door_queue && xQueueReceive(door_queue, &ev, 0) == pdTRUE)
+        {
+            if(ev.type == DOOR_EV_STOP_EDGE || ev.type == DOOR_EV_STOP_SETTLED)
+            {
+                ev.type = stop_check(ev.type);
+            }
+            door_event(&ev);
+        }
+        else if(q == door_tag_sem && xSemaphoreTake(door_tag_sem, 0) == pdTRUE)
+        {
+            //Departures are journal_task's, the door only acts on arrivals.
+            while((tag = event_sub_take(&tag_bus, &door_sub)) != NULL)
+            {
+                if(tag->type == TAG_ARRIVED)
+                {
+                    door_tag(tag);
+                }
+                event_bus_release(&tag_bus, tag);
+            }
+        }
+    }
+}
+
+//Run one init step: skip it when the read back value already matches (warm boot), otherwise
+//set it and check the result code, retrying on error or timeout. Returns 0 on success.
+static int init_run_step(const vm5f_target_t* target, const init_step_t* step, int warm)
+{
+    vm5f_response_t resp;
+
+    if(warm && step->get_cmd != 0 &&
+       vm5f_command(target, step->get_cmd, NULL, 0, &resp, INIT_TIMEOUT) == 0 &&
+       resp.data_len >= step->nparams && memcmp(resp.data, step->params, step->nparams) == 0)
+    {
+        printf("init %02x: already set \n", step->set_cmd);
+        return 0;
+    }
+
+    for(int i=0; i<INIT_RETRIES; i++)
+    {
+        if(vm5f_command(target, step->set_cmd, step->params, step->nparams, &resp, INIT_TIMEOUT) != 0)
+        {
+            printf("init %02x: timeout \n", step->set_cmd);
+        }
+        else if(resp.data_len < 1 || resp.data[0] != RESP_SUCCESS)
+        {
+            printf("init %02x: error %02x \n", step->set_cmd, resp.data_len ? resp.data[0] : 0);
+        }
+        else
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//Wait until the Reader answers (it needs some time to boot after EN goes high), prints its firmware version.
+static int init_wait_reader(const vm5f_target_t* target)
+{
+    vm5f_response_t resp;
+    const int64_t start = esp_timer_get_time();
+
+    while((esp_timer_get_time() - start) < READER_BOOT_TIMEOUT * 1000LL)
+    {
+        if(vm5f_command(target, CMD_GET_FIRMWARE, NULL, 0, &resp, INIT_TIMEOUT / 2) == 0 && resp.data_len >= 2)
+        {
+            printf("Reader firmware: %d.%d \n", resp.data[0], resp.data[1]);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//Bring the Reader up, each command is sent as soon as the previous one is acknowledged.
+//On a warm reboot settings are read back first and only the ones that differ are written.
+//Returns 0 when every step succeeded.
+static int reader_init(const vm5f_target_t* target, int warm)
+{
+    const int64_t start = esp_timer_get_time();
+    int failed = 0;
+
+    if(init_wait_reader(target) != 0)
+    {
+        printf("init: Reader not answering \n");
+        return -1;
+    }
+    for(int i=0; i<INIT_STEP_COUNT; i++)
+    {
+        if(init_run_step(target, &init_steps[i], warm) != 0)
+        {
+            failed++;
+        }
+    }
+    reader_init_ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+    sched_dbm = 0;                                                  //Init set the default power.
+    health_work_ant = ANTENNA_1;                                    //And the work antenna.
+    health_ant_restore = 0;
+    epc_filter_dirty = (epc_filter_count > 0);                      //And the Reader may have lost its masks.
+    printf("init %s: %d failed, %u ms \n", warm ? "warm" : "cold", failed, reader_init_ms);
+    return failed ? -1 : 0;
+}
+
+//Power cycle the Reader through its EN pin.
+static void reader_power_cycle()
+{
+    gpio_set_level(GPIO_OUTPUT_IO_0, 0);
+    vTaskDelay(10 / portTICK_RATE_MS);
+    gpio_set_level(GPIO_OUTPUT_IO_0, 1);
+}
+
+//Change the antenna sequence, takes effect from the next inventory round. With an EPC filter set
+//its mode is held back until the filter is cleared.
+void inventory_configure(const inventory_config_t* config)
+{
+    portENTER_CRITICAL(&inv_config_lock);
+    inv_config = *config;
+    if(epc_filter_count > 0)
+    {
+        epc_filter_mode = config->mode;
+        inv_config.mode = INVENTORY_SESSION;
+        inv_config.sl = SL_ASSERTED;
+    }
+    portEXIT_CRITICAL(&inv_config_lock);
+}
+
+//Buffered round: the Reader runs its rounds without reporting, then the de-duplicated
+//buffer is read out (with read counts) and cleared. Returns 0 when done, -1 on timeout.
+static int inventory_round_buffered(uint8_t rounds)
+{
+    vm5f_response_t resp;
+
+    if(vm5f_command(&reader_target, CMD_INVENTORY, &rounds, 1, &resp, INVENTORY_TIMEOUT) != 0)
+    {
+        return -1;
+    }
+    if(resp.data_len < 9)
+    {
+        return 0;                                                   //Error code, e.g. no tag found.
+    }
+    buffer_expected = (resp.data[1] << 8) | resp.data[2];
+    buffer_received = 0;
+    if(buffer_expected == 0)
+    {
+        return 0;
+    }
+    ulTaskNotifyTake(pdTRUE, 0);
+    get_reset_inventory_buffer();
+    return ulTaskNotifyTake(pdTRUE, INVENTORY_TIMEOUT / portTICK_RATE_MS) ? 0 : -1;
+}
+
+//Run one inventory round in the configured mode, idle: cut down to idle_repeat rounds on each
+//antenna, probe: session round without the SL filter, its tags are counted but not reported. Returns 0 when the Reader reported the end
+//of the round, -1 on timeout.
+static int inventory_round(int idle, int probe)
+{
+    inventory_config_t config;
+    int ret;
+
+    portENTER_CRITICAL(&inv_config_lock);
+    config = inv_config;
+    const uint8_t idle_repeat = sched_config.idle_repeat;
+    portEXIT_CRITICAL(&inv_config_lock);
+    //Leave out the antennas the health monitor found faulty, unless that leaves none.
+    uint8_t skip = 0;
+    for(int i=0; i<ANT_SEQ_LEN; i++)
+    {
+        if(config.seq[i].stay > 0 && config.seq[i].ant <= ANTENNA_4 && !(health_ant_skip & (1 << config.seq[i].ant)))
+        {
+            skip = health_ant_skip;
+        }
+    }
+    for(int i=0; i<ANT_SEQ_LEN; i++)
+    {
+        if(config.seq[i].ant <= ANTENNA_4 && (skip & (1 << config.seq[i].ant)))
+        {
+            config.seq[i].stay = 0;
+        }
+    }
+    if(idle)
+    {
+        for(int i=0; i<ANT_SEQ_LEN; i++)
+        {
+            config.seq[i].stay = config.seq[i].stay ? 1 : 0;
+        }
+        config.repeat = idle_repeat;
+        config.buffer_rounds = idle_repeat;
+    }
+
+    const int64_t start = esp_timer_get_time();
+    if(config.mode != INVENTORY_SESSION)
+    {
+        round_seen_count = 0;
+    }
+    round_reads = 0;
+    round_new = 0;
+    round_bytes = 0;
+    round_probe = probe;                                            //Late frames of a timed out probe stay unreported too.
+#if VM5F_TIMING
+    TIMING_STAMP(timing_cmd_us);
+    timing_cmd_pending = 1;
+#endif
+    if(config.mode == INVENTORY_BUFFERED)
+    {
+        ret = inventory_round_buffered(config.buffer_rounds);
+    }
+    else
+    {
+        ulTaskNotifyTake(pdTRUE, 0);                                //Drop a late end of round from a timed out round.
+        if(config.mode == INVENTORY_SESSION)
+        {
+            session_inventory(config.session, config.auto_flip ? session_target : config.target,
+                              probe ? SL_ANY : config.sl, config.repeat);
+        }
+        else
+        {
+            fast_switch_inventory(config.seq, config.interval, config.repeat);
+        }
+        ret = ulTaskNotifyTake(pdTRUE, INVENTORY_TIMEOUT / portTICK_RATE_MS) ? 0 : -1;
+    }
+    //Nothing new in this target: the tags in reach have all flipped, read them back from the other side.
+    if(config.mode == INVENTORY_SESSION && config.auto_flip && !probe && ret == 0 && round_new == 0)
+    {
+        session_target ^= 1;
+        session_flips++;
+        round_seen_count = 0;
+    }
+    mode_stats[config.mode].rounds++;
+    mode_stats[config.mode].time_ms += (uint32_t)((esp_timer_get_time() - start) / 1000);
+    return ret;
+}
+
+//Switch between real time, buffered and session inventory, takes effect from the next round.
+//An EPC filter needs session inventory: while one is set the mode only takes effect once it is cleared.
+void inventory_set_mode(uint8_t mode, uint8_t buffer_rounds)
+{
+    portENTER_CRITICAL(&inv_config_lock);
+    const int held = (epc_filter_count > 0);
+    if(held)
+    {
+        epc_filter_mode = mode;
+    }
+    else
+    {
+        inv_config.mode = mode;
+    }
+    inv_config.buffer_rounds = buffer_rounds;
+    portEXIT_CRITICAL(&inv_config_lock);
+    if(held)
+    {
+        LOGW(LOG_MASK_MODE, mode);
+    }
+}
+
+//Change when and how far inventory backs off, takes effect from the next round.
+void inventory_schedule(const sched_config_t* config)
+{
+    portENTER_CRITICAL(&inv_config_lock);
+    sched_config = *config;
+    portEXIT_CRITICAL(&inv_config_lock);
+}
+
+//Set the Reader's output power, as temporary power: the scheduler changes it every few seconds of
+//traffic, the stored power (0x76) is written to the Reader's flash and only set once, by init.
+//Returns 0 when it accepted.
+static int sched_set_power(uint8_t dbm)
+{
+    vm5f_response_t resp;
+
+    if(setTempOutputPower(dbm) < 0 ||
+       vm5f_response_wait(&reader_target, CMD_SET_TEMP_OUTPUT_POWER, &resp, INIT_TIMEOUT) != 0 ||
+       resp.data_len < 1 || resp.data[0] != RESP_SUCCESS)
+    {
+        return -1;
+    }
+    sched_dbm = dbm;
+    return 0;
+}
+
+//Report only tags whose EPC starts with one of the prefixes (count 0: every tag again). The Reader
+//selects them with tag masks on the SL flag, which only session inventory filters on, so a filter
+//switches inventory to INVENTORY_SESSION with SL_ASSERTED, overriding inventory_set_mode(); clearing
+//it goes back to the mode set before. Sent to the Reader before the next round.
+int epc_filter_set(const epc_prefix_t* prefixes, int count)
+{
+    if(count < 0 || count > MASK_MAX)
+    {
+        return -1;
+    }
+    for(int i=0; i<count; i++)
+    {
+        if(prefixes[i].bits == 0 || prefixes[i].bits > MASK_BITS_MAX)
+        {
+            return -1;
+        }
+    }
+    portENTER_CRITICAL(&inv_config_lock);
+    if(count > 0 && epc_filter_count == 0)
+    {
+        epc_filter_mode = inv_config.mode;
+    }
+    else if(count == 0 && epc_filter_count > 0)
+    {
+        inv_config.mode = epc_filter_mode;
+    }
+    memcpy(epc_filter, prefixes, count * sizeof(epc_prefix_t));
+    epc_filter_count = count;
+    inv_config.sl = count > 0 ? SL_ASSERTED : SL_NONE;
+    if(count > 0)
+    {
+        inv_config.mode = INVENTORY_SESSION;
+    }
+    const uint8_t mode = epc_filter_mode;
+    portEXIT_CRITICAL(&inv_config_lock);
+    if(count > 0)
+    {
+        LOGI(LOG_MASK_MODE, mode);
+    }
+    epc_filter_dirty = 1;
+    return 0;
+}
+
+//Send the filter: clear every mask, then one per prefix. The first mask asserts SL on matching tags
+//and deasserts it on the rest, the others only assert, so SL ends up set on tags matching any prefix.
+static int epc_filter_apply()
+{
+    epc_prefix_t prefixes[MASK_MAX];
+    uint8_t params[7 + MASK_BITS_MAX / 8];
+    const uint8_t clear = MASK_CLEAR_ALL;
+    vm5f_response_t resp;
+
+    portENTER_CRITICAL(&inv_config_lock);
+    const int count = epc_filter_count;
+    memcpy(prefixes, epc_filter, sizeof(prefixes));
+    epc_filter_dirty = 0;
+    portEXIT_CRITICAL(&inv_config_lock);
+
+    epc_filter_applied = 0;
+    if(vm5f_command(&reader_target, CMD_TAG_MASK, &clear, 1, &resp, INIT_TIMEOUT) != 0 ||
+       resp.data_len < 1 || resp.data[0] != RESP_SUCCESS)
+    {
+        return -1;
+    }
+    for(int i=0; i<count; i++)
+    {
+        const int n = vm5f_tag_mask_params(params, sizeof(params), i + 1, MASK_TARGET_SL,
+                                           i == 0 ? MASK_ACTION_ASSERT : MASK_ACTION_ASSERT_MATCH,
+                                           MEMBANK_EPC, MASK_EPC_START, prefixes[i].epc, prefixes[i].bits);
+        if(n < 0 || vm5f_command(&reader_target, CMD_TAG_MASK, params, n, &resp, INIT_TIMEOUT) != 0 ||
+           resp.data_len < 1 || resp.data[0] != RESP_SUCCESS)
+        {
+            return -1;
+        }
+    }
+    epc_filter_applied = count;
+    epc_filter_applies++;
+    LOGI(LOG_MASK_APPLIED, count);
+    return 0;
+}
+
+//Does the Reader still hold the filter? A Reader reset drops its masks.
+static int epc_filter_present()
+{
+    const uint8_t query = MASK_QUERY;
+    vm5f_response_t resp;
+
+    const int present = vm5f_command(&reader_target, CMD_TAG_MASK, &query, 1, &resp, INIT_TIMEOUT) == 0 &&
+                        resp.data_len >= 2 && resp.data[1] == epc_filter_applied;
+    while(xQueueReceive(reader_target.resp, &resp, MASK_QUERY_DRAIN / portTICK_RATE_MS) == pdTRUE)
+    {
+        //One frame per mask, only the first one counts.
+    }
+    return present;
+}
+
+//Before a round: send a new or lost filter. Every EPC_FILTER_CHECK_PERIOD check that the Reader still
+//has it and make the round an unfiltered probe, to measure what the filter keeps off the UART.
+//Returns 1 for a probe round.
+static int epc_filter_round()
+{
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    if(epc_filter_dirty)
+    {
+        if(epc_filter_apply() != 0)
+        {
+            epc_filter_dirty = 1;                                   //Try again before the next round.
+        }
+        return 0;
+    }
+    if(epc_filter_count == 0 || now_ms - epc_filter_check_ms < EPC_FILTER_CHECK_PERIOD)
+    {
+        return 0;
+    }
+    epc_filter_check_ms = now_ms;
+    if(!epc_filter_present())
+    {
+        epc_filter_lost++;
+        LOGW(LOG_MASK_LOST);
+        epc_filter_dirty = 1;
+        return 0;
+    }
+    epc_filter_probes++;
+    return 1;
+}
+
+//After a round: a probe sets the unfiltered baseline, a filtered round adds what it kept off the line.
+static void epc_filter_account(int probe)
+{
+    if(probe)
+    {
+        epc_probe_frames = round_reads;
+        epc_probe_bytes = round_bytes;
+    }
+    else if(epc_filter_applied > 0 && epc_probe_frames > round_reads)
+    {
+        epc_saved_frames += epc_probe_frames - round_reads;
+        epc_saved_bytes += epc_probe_bytes > round_bytes ? epc_probe_bytes - round_bytes : 0;
+    }
+}
+
+//Read word_cnt words from word_add of membank (MEMBANK_TID, MEMBANK_USER...) on each of the tags,
+//whose EPCs the caller filled in. rfid_task runs it between two inventory rounds: one read command
+//returns a frame for every tag in reach and they are matched to the batch by EPC, instead of a
+//round trip per tag; tags that did not answer get up to TAG_MEM_ATTEMPTS commands. Blocks until
+//done, returns the number of tags read (len set), -1 if rfid_task did not take it in time.
+int tag_mem_read(tag_mem_t* tags, int count, uint8_t membank, uint8_t word_add, uint8_t word_cnt)
+{
+    if(count <= 0 || count > TAG_MEM_BATCH_MAX || word_cnt == 0 || word_cnt > READ_WORDS_MAX ||
+       mem_job_lock == NULL || xSemaphoreTake(mem_job_lock, TAG_MEM_WAIT / portTICK_RATE_MS) != pdTRUE)
+    {
+        return -1;
+    }
+    for(int i=0; i<count; i++)
+    {
+        mem_job.tags[i] = tags[i];
+        mem_job.tags[i].len = 0;
+    }
+    mem_job.count = count;
+    mem_job.done = 0;
+    mem_job.membank = membank;
+    mem_job.word_add = word_add;
+    mem_job.word_cnt = word_cnt;
+    xSemaphoreTake(mem_job_done, 0);
+    mem_job_busy = 1;
+    if(xSemaphoreTake(mem_job_done, TAG_MEM_WAIT / portTICK_RATE_MS) != pdTRUE)
+    {
+        portENTER_CRITICAL(&inv_config_lock);
+        const int taken = (mem_job_busy == 2);
+        mem_job_busy = taken ? 2 : 0;
+        portEXIT_CRITICAL(&inv_config_lock);
+        if(!taken)
+        {
+            xSemaphoreGive(mem_job_lock);
+            return -1;
+        }
+        xSemaphoreTake(mem_job_done, portMAX_DELAY);                //Bounded by the command timeouts.
+    }
+    const int done = mem_job.done;
+    for(int i=0; i<count; i++)
+    {
+        tags[i] = mem_job.tags[i];
+    }
+    xSemaphoreGive(mem_job_lock);
+    return done;
+}
+
+//Run a batch memory read handed over by tag_mem_read(), if there is one.
+static void tag_mem_round()
+{
+    portENTER_CRITICAL(&inv_config_lock);
+    const int take = (mem_job_busy == 1);
+    if(take)
+    {
+        mem_job_busy = 2;
+    }
+    portEXIT_CRITICAL(&inv_config_lock);
+    if(!take)
+    {
+        return;
+    }
+    for(int a=0; a<TAG_MEM_ATTEMPTS && mem_job.done < mem_job.count; a++)
+    {
+        mem_job.expected = 0;
+        mem_job.received = 0;
+        ulTaskNotifyTake(pdTRUE, 0);
+        mem_job_active = 1;
+        read_tag_memory(mem_job.membank, mem_job.word_add, mem_job.word_cnt, 0);
+        mem_commands++;
+        const int answered = ulTaskNotifyTake(pdTRUE, INVENTORY_TIMEOUT / portTICK_RATE_MS);
+        mem_job_active = 0;
+        if(!answered)
+        {
+            LOGW(LOG_MEM_READ_TIMEOUT);
+        }
+    }
+    mem_tags_read += mem_job.done;
+    LOGD(LOG_MEM_READ, mem_job.done, mem_job.count);
+    mem_job_busy = 0;
+    xSemaphoreGive(mem_job_done);
+}
+
+static void health_add(health_series_t* s, int v)
+{
+    s->v[s->pos] = v;
+    s->pos = (s->pos + 1) % HEALTH_WINDOW;
+    if(s->n < HEALTH_WINDOW)
+    {
+        s->n++;
+    }
+}
+
+static int health_last(const health_series_t* s)
+{
+    return s->n ? s->v[(s->pos + HEALTH_WINDOW - 1) % HEALTH_WINDOW] : 0;
+}
+
+static int health_mean(const health_series_t* s)
+{
+    int sum = 0;
+    for(int i=0; i<s->n; i++)
+    {
+        sum += s->v[i];
+    }
+    return s->n ? sum / s->n : 0;
+}
+
+//Lowest (max 0) or highest (max 1) sample of the window.
+static int health_extreme(const health_series_t* s, int max)
+{
+    int e = s->n ? s->v[0] : 0;
+    for(int i=1; i<s->n; i++)
+    {
+        if(max ? s->v[i] > e : s->v[i] < e)
+        {
+            e = s->v[i];
+        }
+    }
+    return e;
+}
+
+//Antennas of the configured sequence, and the work antenna of session and buffered inventory.
+static uint8_t health_ants_used()
+{
+    uint8_t used = 1 << ANTENNA_1;
+
+    portENTER_CRITICAL(&inv_config_lock);
+    for(int i=0; i<ANT_SEQ_LEN; i++)
+    {
+        if(inv_config.seq[i].stay > 0 && inv_config.seq[i].ant <= ANTENNA_4)
+        {
+            used |= 1 << inv_config.seq[i].ant;
+        }
+    }
+    portEXIT_CRITICAL(&inv_config_lock);
+    return used;
+}
+
+//Reader temperature: output power down a step while hot, back up once cool. Returns -1 without answer.
+static int health_check_temp()
+{
+    vm5f_response_t resp;
+
+    if(vm5f_command(&reader_target, CMD_GET_READER_TEMP, NULL, 0, &resp, INIT_TIMEOUT) != 0 || resp.data_len < 2)
+    {
+        return -1;
+    }
+    const int temp = resp.data[0] ? resp.data[1] : -resp.data[1];
+    health_add(&health_temp, temp);
+    if(temp >= HEALTH_TEMP_HOT && health_dbm_cap > POWER_MIN_DBM)
+    {
+        health_dbm_cap = (health_dbm_cap - HEALTH_DERATE_DB > POWER_MIN_DBM) ? health_dbm_cap - HEALTH_DERATE_DB : POWER_MIN_DBM;
+        health_derates++;
+        LOGW(LOG_HEALTH_HOT, temp, health_dbm_cap);
+    }
+    else if(temp <= HEALTH_TEMP_COOL && health_dbm_cap < POWER_MAX_DBM)
+    {
+        health_dbm_cap = (health_dbm_cap + HEALTH_DERATE_DB < POWER_MAX_DBM) ? health_dbm_cap + HEALTH_DERATE_DB : POWER_MAX_DBM;
+        LOGI(LOG_HEALTH_COOL, temp, health_dbm_cap);
+    }
+    return 0;
+}
+
+//A Reader that reset itself is back on its stored settings and has lost its tag masks. The scheduler
+//only sets temporary power (0x66), a reset brings back the power init stored (0x76), so the power read
+//back no longer is the one the scheduler set. If both are the same the tag masks tell, when a filter
+//is set. Runs init again then.
+static int health_check_reset()
+{
+    vm5f_response_t resp;
+
+    if(sched_dbm == 0)
+    {
+        return 0;                                                   //Not known what it should be.
+    }
+    if(vm5f_command(&reader_target, CMD_GET_OUTPUT_POWER, NULL, 0, &resp, INIT_TIMEOUT) != 0 || resp.data_len < 1)
+    {
+        return -1;
+    }
+    int reset = (resp.data[0] != sched_dbm);
+    if(!reset && sched_dbm == POWER_DEFAULT_DBM && epc_filter_applied > 0)
+    {
+        reset = !epc_filter_present();
+    }
+    if(reset)
+    {
+        health_resets++;
+        LOGW(LOG_READER_RESET, resp.data[0], sched_dbm);
+        reader_init(&reader_target, 0);
+    }
+    return 0;
+}
+
+//Set the Reader's work antenna, up to INIT_RETRIES tries. Returns 0 when it accepted.
+static int health_set_work_ant(uint8_t ant)
+{
+    vm5f_response_t resp;
+
+    for(int i=0; i<INIT_RETRIES; i++)
+    {
+        if(vm5f_command(&reader_target, CMD_SET_WORK_ANTENNA, &ant, 1, &resp, INIT_TIMEOUT) == 0 &&
+           resp.data_len >= 1 && resp.data[0] == RESP_SUCCESS)
+        {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+//Return loss of one antenna, measured by the Reader on the work antenna, and the detection errors
+//inventory reported on it since the last check. A faulty antenna is left out of inventory until it
+//measures well again. The work antenna is set back after the measurement; if the Reader does not take
+//it the check fails and health_round() tries again before the next round.
+static int health_check_antenna(uint8_t ant)
+{
+    vm5f_response_t resp;
+    const uint8_t freq = HEALTH_RL_FREQ;
+    const uint8_t bit = 1 << ant;
+
+    if(vm5f_command(&reader_target, CMD_SET_WORK_ANTENNA, &ant, 1, &resp, INIT_TIMEOUT) != 0)
+    {
+        return -1;
+    }
+    const int answered = vm5f_command(&reader_target, CMD_GET_RETURN_LOSS, &freq, 1, &resp, INIT_TIMEOUT) == 0 &&
+                         resp.data_len >= 1;
+    const uint8_t rl = answered ? resp.data[0] : 0;
+    health_ant_restore = (health_set_work_ant(health_work_ant) != 0);
+    if(!answered || health_ant_restore)
+    {
+        return -1;
+    }
+    const uint32_t errors = health_ant_errors[ant] - health_ant_errors_seen[ant];
+    health_ant_errors_seen[ant] = health_ant_errors[ant];
+    health_add(&health_rl[ant], rl);
+    if((rl < HEALTH_RL_MIN || errors > 0) && !(health_ant_skip & bit))
+    {
+        health_ant_skip |= bit;
+        health_skips++;
+        LOGW(LOG_HEALTH_ANT_SKIP, ant + 1, rl, errors);
+    }
+    else if(rl >= HEALTH_RL_MIN + HEALTH_RL_HYST && errors == 0 && (health_ant_skip & bit))
+    {
+        health_ant_skip &= ~bit;
+        LOGI(LOG_HEALTH_ANT_BACK, ant + 1, rl);
+    }
+    return 0;
+}
+
+//Session and buffered inventory run on the work antenna: move it to the first good antenna of the
+//sequence when it is skipped.
+static void health_failover(uint8_t used)
+{
+    uint8_t ant = health_work_ant;
+
+    for(int a=ANTENNA_4; a>=ANTENNA_1; a--)
+    {
+        if((used & (1 << a)) && !(health_ant_skip & (1 << a)))
+        {
+            ant = a;
+        }
+    }
+    if(ant != health_work_ant && health_set_work_ant(ant) == 0)
+    {
+        LOGW(LOG_HEALTH_FAILOVER, health_work_ant + 1, ant + 1);
+        health_work_ant = ant;
+        health_failovers++;
+    }
+}
+
+//Between two rounds, at most once per HEALTH_STEP_PERIOD: one health check, a few ms of commands,
+//so inventory is never held up for long. The checks take turns: temperature, reset, each antenna.
+static void health_round()
+{
+    const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    const uint8_t used = health_ants_used();
+    int ret;
+
+    if(health_ant_restore && health_set_work_ant(health_work_ant) == 0)
+    {
+        health_ant_restore = 0;                                     //Off the antenna the last check measured.
+    }
+    if((int32_t)(now_ms - health_next_ms) < 0)
+    {
+        return;
+    }
+    health_next_ms = now_ms + HEALTH_STEP_PERIOD;
+    while(health_step >= 2 && !(used & (1 << (health_step - 2))))
+    {
+        health_step = (health_step + 1) % (2 + HEALTH_ANTENNAS);
+    }
+    if(health_step == 0)
+    {
+        ret = health_check_temp();
+    }
+    else if(health_step == 1)
+    {
+        ret = health_check_reset();
+    }
+    else
+    {
+        ret = health_check_antenna(health_step - 2);
+    }
+    health_step = (health_step + 1) % (2 + HEALTH_ANTENNAS);
+
+    if(ret != 0)
+    {
+        health_timeouts++;
+        if(++health_fails >= HEALTH_FAILS_MAX)
+        {
+            //Not answering between rounds either: power cycle, a cold init brings it back.
+            LOGW(LOG_HEALTH_NO_ANSWER, health_fails);
+            health_fails = 0;
+            health_power_cycles++;
+            reader_power_cycle();
+            reader_init(&reader_target, 0);
+        }
+        return;
+    }
+    health_fails = 0;
+    health_failover(used);
+}
+
+//One scheduled round: back to back at full power while tags are about; once no round has read a
+//tag for idle_after ms, short rounds at low power with a pause after each empty one. The first
+//idle round that reads a tag makes the next one active, without a pause.
+static void sched_round()
+{
+    sched_config_t config;
+
+    portENTER_CRITICAL(&inv_config_lock);
+    config = sched_config;
+    portEXIT_CRITICAL(&inv_config_lock);
+
+    const uint32_t start_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    const int idle = (start_ms - sched_seen_ms) >= config.idle_after;
+    if(idle != sched_idle)
+    {
+        sched_idle = idle;
+        sched_switches++;
+        if(idle)
+        {
+            LOGI(LOG_SCHED_IDLE, config.idle_dbm, config.idle_gap);
+        }
+        else
+        {
+            LOGI(LOG_SCHED_ACTIVE, config.active_dbm);
+        }
+    }
+    health_round();
+    uint8_t dbm = idle ? config.idle_dbm : config.active_dbm;
+    if(dbm > health_dbm_cap)
+    {
+        dbm = health_dbm_cap;                                       //Reader running hot.
+    }
+    if(dbm != sched_dbm && sched_set_power(dbm) != 0)
+    {
+        sched_dbm = 0;                                              //Try again before the next round.
+    }
+
+    tag_mem_round();
+    const int probe = epc_filter_round();
+    if(inventory_round(idle, probe) != 0)
+    {
+        LOGW(LOG_INVENTORY_TIMEOUT);
+    }
+    epc_filter_account(probe);
+    uint32_t end_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    sched_rounds[idle]++;
+    sched_rf_ms[idle] += end_ms - start_ms;
+    if(round_reads > 0)
+    {
+        sched_seen_ms = end_ms;
+    }
+    else if(idle)
+    {
+        vTaskDelay(config.idle_gap / portTICK_RATE_MS);
+        end_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    }
+    sched_time_ms[idle] += end_ms - start_ms;
+}
+
+#if VM5F_BUS
+/***************************** Reader Bus ***************************************/
+/*
+    Several Readers share an RS-485 line (half duplex, one talker at a time), each at its own
+    address. They run buffered inventory: a Reader is silent while its RF round runs, so the line
+    is free to read out another Reader's buffer meanwhile. The poll task keeps every Reader busy
+    and only puts a command on the line when no Reader is expected to answer in that window,
+    going by each Reader's measured round time. Tags per second then grow with the number of
+    Readers until the line is full (bus utilisation in the stats) instead of one Reader waiting
+    for the other.
+*/
+#define BUS_BAUD 115200
+#define BUS_ROUNDS 5                                                                //Inventory rounds per poll of one Reader.
+#define BUS_ROUND_US_INIT 100000                                                    //Poll to answer time assumed until one is measured (us).
+#define BUS_ANSWER_US 2000                                                          //Kept free around an expected poll answer (us).
+#define BUS_TAG_BYTES 27                                                            //Line bytes per tag of a readout (96 bit EPC).
+#define BUS_RETRY_MS 5                                                              //Poll task recheck while a start or readout is held back.
+#define BUS_EVENT_QUEUE_LEN 8
+#define BUS_RESP_QUEUE_LEN 2
+#define BUS_READERS_MAX 8                                                           //Per bus.
+
+#define BUS_IDLE 0                                                                  //Ready for the next poll.
+#define BUS_RF 1                                                                    //Inventory running, silent until it answers.
+#define BUS_DONE 2                                                                  //Answered, tags wait in its buffer.
+#define BUS_READOUT 3                                                               //Buffer being read out.
+#define BUS_EV_ROUND 1                                                              //Poll answered, count = tags in the buffer.
+#define BUS_EV_READOUT 2                                                            //Last buffered tag (or an error) received.
+
+//Bus Port: a UART and the pin driving the DE of its RS-485 transceiver.
+typedef struct bus_port
+{
+    uart_port_t port;
+    int txd;
+    int rxd;
+    int de;
+
+}bus_port_t;
+
+//Bus Reader Config: the bus a Reader hangs on and its address (set beforehand with setReadAddress()).
+typedef struct bus_reader_config
+{
+    uint8_t bus;
+    uint8_t add;
+
+}bus_reader_config_t;
+
+static const bus_port_t bus_ports[] =
+{
+    { UART_NUM_2, TXD_PIN, RXD_PIN, 22 },
+    { UART_NUM_1, 4, 34, 23 },
+};
+
+static const bus_reader_config_t bus_config[] =
+{
+    { 0, 0x01 },
+    { 0, 0x02 },
+};
+
+#define BUS_PORT_COUNT (sizeof(bus_ports) / sizeof(bus_ports[0]))
+#define BUS_READER_COUNT (sizeof(bus_config) / sizeof(bus_config[0]))
+_Static_assert(BUS_READER_COUNT <= BUS_PORT_COUNT * BUS_READERS_MAX, "bus_config: more Readers than the buses take");
+
+//Bus Reader: poll state and counters of one Reader.
+typedef struct bus_reader
+{
+    uint8_t id;                                                                     //Position in bus_config.
+    uint8_t state;                                                                  //Poll task only.
+    uint16_t pending;                                                               //Tags in its buffer at the last answer.
+    volatile uint16_t received;                                                     //Readout frames so far.
+    vm5f_target_t target;
+    tag_table_t* tags;                                                              //Only touched by tag_task.
+    uint32_t started_us;                                                            //Poll sent.
+    uint32_t round_us;                                                              //Poll to answer, moving average.
+    uint32_t polls;
+    uint32_t reads;
+    uint32_t arrivals;
+    uint32_t lost;                                                                  //Polls or readouts that never finished.
+    uint32_t last_reads;
+    uint32_t last_arrivals;
+    uint8_t resp_storage[BUS_RESP_QUEUE_LEN * sizeof(vm5f_response_t)];
+    StaticQueue_t resp_buf;
+
+}bus_reader_t;
+
+//Bus Event: from the receive task to the poll task of a bus.
+typedef struct bus_event
+{
+    uint8_t type;
+    uint8_t reader;
+    uint16_t count;
+
+}bus_event_t;
+
+//Reader Bus: one UART, its receive path and the Readers on it.
+typedef struct reader_bus
+{
+    const bus_port_t* port;
+    uart_link_t link;
+    vm5f_transport_t io;
+    rx_ring_t ring;
+    frame_parser_t parser;
+    bus_reader_t* readers[BUS_READERS_MAX];
+    int count;
+    xQueueHandle events;
+    uint8_t event_storage[BUS_EVENT_QUEUE_LEN * sizeof(bus_event_t)];
+    StaticQueue_t event_buf;
+    uint8_t rx_buf[RX_BUF_SIZE];
+    spsc_ring_t reads;                                                              //Tag reads, bus_rx_task -> tag_task.
+    uint8_t read_storage[READ_RING_LEN * sizeof(tag_event_t)];
+    uint32_t held;                                                                  //Poll passes with a start or readout held back.
+    uint32_t orphans;                                                               //Frames from an address not in bus_config.
+    uint32_t last_bytes;
+    TaskHandle_t rx_task;
+    TaskHandle_t poll_task;
+    StackType_t rx_stack[UART_RX_TASK_STACK];
+    StackType_t poll_stack[RFID_TASK_STACK];
+    StaticTask_t rx_tcb;
+    StaticTask_t poll_tcb;
+
+}reader_bus_t;
+
+static reader_bus_t buses[BUS_PORT_COUNT];
+static bus_reader_t bus_readers[BUS_READER_COUNT];
+static tag_table_t bus_tags[BUS_READER_COUNT];                                     //Static like the rest: too many Readers fail the link, not the boot.
+
+static inline uint32_t bus_now_us()
+{
+    return (uint32_t) esp_timer_get_time();
+}
+
+//Line time of n bytes (us), 10 bits per byte.
+static inline uint32_t bus_wire_us(uint32_t bytes)
+{
+    return (uint32_t)((uint64_t) bytes * 10 * 1000000 / BUS_BAUD);
+}
+
+//No other Reader is expected to answer between from and to (us). A Reader past its expected
+//time may answer any moment, it counts as due at from.
+static int bus_window_free(const reader_bus_t* bus, const bus_reader_t* self, uint32_t from, uint32_t to)
+{
+    for(int i=0; i<bus->count; i++)
+    {
+        const bus_reader_t* o = bus->readers[i];
+        if(o == self || o->state != BUS_RF)
+        {
+            continue;
+        }
+        uint32_t due = o->started_us + o->round_us;
+        if((int32_t)(due - from) < 0)
+        {
+            due = from;
+        }
+        if((int32_t)(due + BUS_ANSWER_US - from) > 0 && (int32_t)(to - (due - BUS_ANSWER_US)) > 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Poll every idle Reader whose command and answer do not land on another Reader's answer.
+//Returns the number held back.
+static int bus_start_idle(reader_bus_t* bus)
+{
+    uint8_t rounds = BUS_ROUNDS;
+    int held = 0;
+
+    for(int i=0; i<bus->count; i++)
+    {
+        bus_reader_t* r = bus->readers[i];
+        if(r->state != BUS_IDLE)
+        {
+            continue;
+        }
+        const uint32_t now = bus_now_us();
+        const uint32_t due = now + r->round_us;
+        if(!bus_window_free(bus, r, now, now + BUS_ANSWER_US) ||
+           !bus_window_free(bus, r, due - BUS_ANSWER_US, due + BUS_ANSWER_US))
+        {
+            held++;
+            continue;
+        }
+        r->started_us = now;
+        r->state = BUS_RF;
+        vm5f_send_to(&bus->io, r->target.add, CMD_INVENTORY, &rounds, 1);
+    }
+    return held;
+}
+
+//The Reader to read out next: polled the longest ago among those whose readout ends before any
+//other Reader is due to answer. The ones that have to wait are added to *held.
+static bus_reader_t* bus_next_readout(reader_bus_t* bus, int* held)
+{
+    bus_reader_t* best = NULL;
+    const uint32_t now = bus_now_us();
+
+    for(int i=0; i<bus->count; i++)
+    {
+        bus_reader_t* r = bus->readers[i];
+        if(r->state != BUS_DONE)
+        {
+            continue;
+        }
+        if(!bus_window_free(bus, r, now, now + BUS_ANSWER_US + bus_wire_us(r->pending * BUS_TAG_BYTES)))
+        {
+            (*held)++;
+            continue;
+        }
+        if(best == NULL || (int32_t)(r->started_us - best->started_us) < 0)
+        {
+            best = r;
+        }
+    }
+    return best;
+}
+
+static void bus_handle_event(const bus_event_t* ev)
+{
+    bus_reader_t* r = &bus_readers[ev->reader];
+
+    if(ev->type == BUS_EV_ROUND && r->state == BUS_RF)
+    {
+        const uint32_t us = bus_now_us() - r->started_us;
+        r->round_us = r->round_us - r->round_us / 4 + us / 4;
+        r->polls++;
+        r->pending = ev->count;
+        r->state = ev->count ? BUS_DONE : BUS_IDLE;
+    }
+    else if(ev->type == BUS_EV_READOUT && r->state == BUS_READOUT)
+    {
+        r->state = BUS_IDLE;
+    }
+}
+
+//Read out a Reader's buffer and wait for the last tag, poll answers of the others are taken meanwhile.
+static void bus_readout(reader_bus_t* bus, bus_reader_t* r)
+{
+    const TickType_t start = xTaskGetTickCount();
+    const TickType_t timeout = INVENTORY_TIMEOUT / portTICK_RATE_MS;
+    bus_event_t ev;
+
+    r->received = 0;
+    r->state = BUS_READOUT;
+    vm5f_send_to(&bus->io, r->target.add, CMD_GET_RESET_INV_BUFFER, NULL, 0);
+    while(r->state == BUS_READOUT)
+    {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if(waited >= timeout || xQueueReceive(bus->events, &ev, timeout - waited) != pdTRUE)
+        {
+            r->lost++;
+            r->state = BUS_IDLE;
+            break;
+        }
+        bus_handle_event(&ev);
+    }
+}
+
+//Give up on polls that never answered (lost or collided), the Reader's buffer keeps its tags for the next one.
+static void bus_expire(reader_bus_t* bus)
+{
+    const uint32_t now = bus_now_us();
+
+    for(int i=0; i<bus->count; i++)
+    {
+        bus_reader_t* r = bus->readers[i];
+        if(r->state == BUS_RF && now - r->started_us >= INVENTORY_TIMEOUT * 1000)
+        {
+            r->lost++;
+            r->state = BUS_IDLE;
+            LOGW(LOG_INVENTORY_TIMEOUT);
+        }
+    }
+}
+
+//Bus poll task: brings the Readers of its bus up, then keeps each of them inventorying and reads
+//out whichever is done as soon as the line is free for it.
+static void bus_poll_task(void* arg)
+{
+    reader_bus_t* bus = arg;
+    const int warm = (esp_reset_reason() != ESP_RST_POWERON);
+    bus_event_t ev;
+
+    for(int i=0; i<bus->count; i++)
+    {
+        for(int a=0; a<INIT_ATTEMPTS; a++)
+        {
+            printf("bus %d, Reader %02x: \n", (int)(bus->port - bus_ports), bus->readers[i]->target.add);
+            if(reader_init(&bus->readers[i]->target, a == 0 ? warm : 0) == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    while(1)
+    {
+        int held = 0;
+        bus_expire(bus);
+        bus_reader_t* r = bus_next_readout(bus, &held);
+        if(r != NULL)
+        {
+            bus_readout(bus, r);
+            continue;
+        }
+        held += bus_start_idle(bus);
+        if(held)
+        {
+            bus->held++;
+        }
+        const TickType_t wait = held ? BUS_RETRY_MS / portTICK_RATE_MS : INVENTORY_TIMEOUT / 4 / portTICK_RATE_MS;
+        if(xQueueReceive(bus->events, &ev, wait ? wait : 1) == pdTRUE)
+        {
+            bus_handle_event(&ev);
+        }
+    }
+}
+
+static bus_reader_t* bus_find(const reader_bus_t* bus, uint8_t add)
+{
+    for(int i=0; i<bus->count; i++)
+    {
+        if(bus->readers[i]->target.add == add)
+        {
+            return bus->readers[i];
+        }
+    }
+    return NULL;
+}
+
+static void bus_post(reader_bus_t* bus, uint8_t type, const bus_reader_t* r, uint16_t count)
+{
+    const bus_event_t ev = { type, r->id, count };
+    xQueueSend(bus->events, &ev, 0);
+}
+
+//Route one frame by the address it came from: poll answers and the end of a readout to the poll
+//task, buffered tags to tag_task for that Reader's tag table, everything else to its response queue.
+static void bus_dispatch_frame(reader_bus_t* bus, const frame_view_t* frame)
+{
+    bus_reader_t* r = bus_find(bus, frame->add);
+    tag_event_t tag;
+
+    if(r == NULL)
+    {
+        bus->orphans++;
+        return;
+    }
+    if(frame->cmd == CMD_INVENTORY)
+    {
+        //Ant, TagCount(2), ReadRate(2), TotalRead(4). 1 data byte: error, e.g. no tag found.
+        bus_post(bus, BUS_EV_ROUND, r, frame_data_len(frame) >= 9 ? (frame_data(frame, 1) << 8) | frame_data(frame, 2) : 0);
+        return;
+    }
+    if(frame->cmd == CMD_GET_RESET_INV_BUFFER)
+    {
+        if(frame_data_len(frame) == 1)
+        {
+            bus_post(bus, BUS_EV_READOUT, r, 0);                                    //Error code, buffer empty.
+            return;
+        }
+        const int count = tag_decode_buffered(frame, &tag);
+        if(count < 0)
+        {
+            return;
+        }
+        tag_reads++;
+        r->reads += tag.count;
+        tag_post(&bus->reads, &tag, r->id);
+        if(++r->received >= count)
+        {
+            bus_post(bus, BUS_EV_READOUT, r, r->received);
+        }
+        return;
+    }
+    frame_respond(frame, r->target.resp);
+}
+
+static void bus_dispatch_frames(reader_bus_t* bus)
+{
+    const uint32_t head = bus->reads.head;
+    frame_view_t frame;
+
+    while(frame_parser_next(&bus->parser, &frame))
+    {
+        bus_dispatch_frame(bus, &frame);
+    }
+    if(bus->reads.head != head)
+    {
+        xTaskNotifyGive(tag_task_handle);
+    }
+}
+
+//Bus receive task: uart_rx_task for one bus.
+static void bus_rx_task(void* arg)
+{
+    reader_bus_t* bus = arg;
+
+    while(1)
+    {
+        const int n = bus->io.read(&bus->io, bus->rx_buf, RX_BUF_SIZE, RX_IDLE_TIME);
+        if(n < 0)
+        {
+            continue;
+        }
+        if(n == 0)
+        {
+            while(frame_parser_idle(&bus->parser))
+            {
+                bus_dispatch_frames(bus);
+            }
+            continue;
+        }
+        ring_write(&bus->ring, bus->rx_buf, n);
+        bus_dispatch_frames(bus);
+    }
+}
+
+//Open the buses bus_config uses, set up their Readers, and start a receive and a poll task per bus.
+static void bus_start()
+{
+    for(int i=0; i<BUS_READER_COUNT; i++)
+    {
+        const bus_reader_config_t* c = &bus_config[i];
+        bus_reader_t* r = &bus_readers[i];
+
+        if(c->bus >= BUS_PORT_COUNT || buses[c->bus].count >= BUS_READERS_MAX)
+        {
+            printf("bus %d: Reader %02x left out \n", c->bus, c->add);
+            continue;
+        }
+        reader_bus_t* bus = &buses[c->bus];
+        if(bus->port == NULL)
+        {
+            bus->port = &bus_ports[c->bus];
+            bus->link.port = bus->port->port;
+            uart_link_open(&bus->link, bus->port->txd, bus->port->rxd, bus->port->de, BUS_BAUD);
+            bus->io.name = "rs485";
+            bus->io.write = uart_transport_write;
+            bus->io.read = uart_transport_read;
+            bus->io.ctx = &bus->link;
+            ring_init(&bus->ring);
+            frame_parser_init(&bus->parser, &bus->ring);
+            spsc_init(&bus->reads, bus->read_storage, sizeof(tag_event_t), READ_RING_LEN);
+            bus->events = xQueueCreateStatic(BUS_EVENT_QUEUE_LEN, sizeof(bus_event_t), bus->event_storage, &bus->event_buf);
+        }
+        r->tags = &bus_tags[i];
+        tag_table_init(r->tags, TAG_EXPIRY_MS, TAG_HOLDOFF_MS);
+        r->id = i;
+        r->state = BUS_IDLE;
+        r->round_us = BUS_ROUND_US_INIT;
+        r->target.io = &bus->io;
+        r->target.add = c->add;
+        r->target.resp = xQueueCreateStatic(BUS_RESP_QUEUE_LEN, sizeof(vm5f_response_t), r->resp_storage, &r->resp_buf);
+        bus->readers[bus->count++] = r;
+    }
+    for(int b=0; b<BUS_PORT_COUNT; b++)
+    {
+        if(buses[b].count > 0)
+        {
+            reader_bus_t* bus = &buses[b];
+            bus->rx_task = xTaskCreateStaticPinnedToCore(bus_rx_task, "bus_rx_task", UART_RX_TASK_STACK, bus,
+                                                         configMAX_PRIORITIES-1, bus->rx_stack, &bus->rx_tcb, CORE_IO);
+            bus->poll_task = xTaskCreateStaticPinnedToCore(bus_poll_task, "bus_poll_task", RFID_TASK_STACK, bus,
+                                                           configMAX_PRIORITIES-2, bus->poll_stack, &bus->poll_tcb, CORE_IO);
+        }
+    }
+}
+
+//Per Reader throughput and how busy each line is, over the last stats period.
+static void bus_report()
+{
+    uint32_t reads = 0;
+    uint32_t arrivals = 0;
+
+    for(int b=0; b<BUS_PORT_COUNT; b++)
+    {
+        reader_bus_t* bus = &buses[b];
+        if(bus->count == 0)
+        {
+            continue;
+        }
+        const uint32_t bytes = bus->link.tx_bytes + bus->link.rx_bytes;
+        printf("bus %d: utilisation %u%%, frames %u, bad checksum %u, held back %u, unknown address %u, stack free rx %u, poll %u \n",
+               b, bus_wire_us(bytes - bus->last_bytes) / (STATS_PERIOD * 10), bus->parser.frames, bus->parser.bad_checksum,
+               bus->held, bus->orphans, uxTaskGetStackHighWaterMark(bus->rx_task), uxTaskGetStackHighWaterMark(bus->poll_task));
+        printf("bus %d read ring: high water %u of %u, dropped %u \n", b, bus->reads.high_water, READ_RING_LEN, bus->reads.dropped);
+        bus->last_bytes = bytes;
+        for(int i=0; i<bus->count; i++)
+        {
+            bus_reader_t* r = bus->readers[i];
+            const uint32_t r_reads = (r->reads - r->last_reads) * 1000 / STATS_PERIOD;
+            const uint32_t r_arrivals = (r->arrivals - r->last_arrivals) * 1000 / STATS_PERIOD;
+            printf("reader %u (%02x): polls %u, round %u ms, reads/s %u, arrivals/s %u, in field %u, lost %u \n",
+                   r->id, r->target.add, r->polls, r->round_us / 1000, r_reads, r_arrivals, r->tags->used, r->lost);
+            r->last_reads = r->reads;
+            r->last_arrivals = r->arrivals;
+            reads += r_reads;
+            arrivals += r_arrivals;
+        }
+    }
+    printf("buses: reads/s %u, arrivals/s %u from %d Readers \n", reads, arrivals, (int) BUS_READER_COUNT);
+}
+#endif
+
+//Tag table a read belongs to.
+static tag_table_t* reader_tags(uint8_t reader)
+{
+#if VM5F_BUS
+    return bus_readers[reader].tags;
+#else
+    return &tag_table;
+#endif
+}
+
+//Fold one read into its Reader's tag table, only a new arrival goes on to gpio_task.
+static void tag_aggregate(const tag_event_t* read)
+{
+    const tag_entry_t* entry;
+#if VM5F_TIMING
+    uint32_t t_taken;
+    TIMING_STAMP(t_taken);
+    TIMING_RECORD(TIMING_READ_HANDOFF, read->t_queued_us, t_taken);
+#endif
+
+    if(tag_table_update(reader_tags(read->reader), read->epc, read->epc_len, read->pc, read->ant, read->freq,
+                        read->rssi, read->count, read->time_ms, &entry) == TAG_ARRIVED)
+    {
+#if VM5F_BUS
+        bus_readers[read->reader].arrivals++;
+#endif
+        tag_emit(entry, TAG_ARRIVED, read->reader, read);
+    }
+}
+
+//Take every read waiting in a ring.
+static void tag_drain(spsc_ring_t* ring)
+{
+    tag_event_t read;
+
+    while(spsc_pop(ring, &read))
+    {
+        tag_aggregate(&read);
+    }
+}
+
+//Tag task, on the policy core: folds the reads from the receive path into the tag tables and
+//sweeps the tables for departures. Woken by the receive path once per batch of frames.
+static void tag_task(void* arg)
+{
+    uint32_t last_sweep = 0;
+
+    while(1)
+    {
+        ulTaskNotifyTake(pdTRUE, TAG_SWEEP_PERIOD / portTICK_RATE_MS);
+#if VM5F_BUS
+        for(int b=0; b<BUS_PORT_COUNT; b++)
+        {
+            if(buses[b].count > 0)
+            {
+                tag_drain(&buses[b].reads);
+            }
+        }
+#else
+        tag_drain(&read_ring);
+#endif
+
+        const uint32_t now = (uint32_t)(esp_timer_get_time() / 1000);
+        if(now - last_sweep >= TAG_SWEEP_PERIOD)
+        {
+#if VM5F_BUS
+            for(int i=0; i<BUS_READER_COUNT; i++)
+            {
+                if(bus_readers[i].tags != NULL)
+                {
+                    tag_table_sweep(bus_readers[i].tags, now, tag_sweep_emit, (void*)(uintptr_t) i);
+                }
+            }
+#else
+            tag_table_sweep(&tag_table, now, tag_sweep_emit, (void*) 0);
+#endif
+            last_sweep = now;
         }
     }
 }
 
 //RFID UART communication task function.
+#if VM5F_SIM && VM5F_SIM_DISCOVERY
+//One discovery run: a fresh population of tags, all in the field at once, inventoried in the given
+//mode until every tag has been read once or DISCOVERY_TIMEOUT.
+static void discovery_run(uint8_t mode, uint16_t tags)
+{
+    vm5f_sim_config_t config = VM5F_SIM_DISCOVERY_CONFIG;
+    uint32_t ms = 0;
+    uint32_t t50 = 0;
+    uint32_t t90 = 0;
+    int rounds = 0;
+
+    config.tags = tags;
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    vm5f_sim_init(&sim, &config);
+    xSemaphoreGive(sim_lock);
+    memset(discovery_seen, 0, sizeof(discovery_seen));
+    discovery_found = 0;
+    session_target = TARGET_A;
+    inventory_set_mode(mode, BUFFER_ROUNDS);
+
+    const int64_t start = esp_timer_get_time();
+    while(discovery_found < tags && ms < DISCOVERY_TIMEOUT)
+    {
+        inventory_round(0, 0);
+        rounds++;
+        ms = (uint32_t)((esp_timer_get_time() - start) / 1000);
+        if(t50 == 0 && discovery_found * 2 >= tags)
+        {
+            t50 = ms;
+        }
+        if(t90 == 0 && discovery_found * 10 >= tags * 9)
+        {
+            t90 = ms;
+        }
+    }
+    printf("discovery %s, %u tags: %u found in %u ms, 50%% %u ms, 90%% %u ms, %d rounds, %u new tags/s \n",
+           mode_names[mode], tags, discovery_found, ms, t50, t90, rounds, ms ? discovery_found * 1000 / ms : 0);
+}
+
+//Unique tag discovery, fast switch real time inventory against buffered inventory and session
+//inventory with auto flip, then back to the normal simulation.
+static void discovery_bench()
+{
+    const vm5f_sim_config_t config = VM5F_SIM_DEFAULTS;
+
+    for(int i=0; i<sizeof(discovery_tags) / sizeof(discovery_tags[0]); i++)
+    {
+        discovery_run(INVENTORY_REALTIME, discovery_tags[i]);
+        discovery_run(INVENTORY_BUFFERED, discovery_tags[i]);
+        discovery_run(INVENTORY_SESSION, discovery_tags[i]);
+    }
+    inventory_set_mode(INVENTORY_REALTIME, BUFFER_ROUNDS);
+    xSemaphoreTake(sim_lock, portMAX_DELAY);
+    vm5f_sim_init(&sim, &config);
+    xSemaphoreGive(sim_lock);
+}
+#endif
+
 static void rfid_task()
-{   
-            //resetVM_5F();
-            //getData();
-            //vTaskDelay(100 / portTICK_PERIOD_MS);
-            setFreqRegion();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            setBaudRate();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            setDRM();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            setAntDetect();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            setWorkAntenna();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            setOutputPower();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            
-            getFirmware();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            getData();
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-
-            printf("\n\t***SYSTEM READY***\n\n");
-            
+{
+    //Anything but power on (software reset, watchdog, brownout) leaves the Reader's settings in place.
+    int warm = (esp_reset_reason() != ESP_RST_POWERON);
+
+    for(int i=0; i<INIT_ATTEMPTS; i++)
+    {
+        if(reader_init(&reader_target, warm) == 0)
+        {
+            break;
+        }
+        printf("init failed, power cycling Reader \n");
+        reader_power_cycle();
+        warm = 0;
+    }
+
+#if VM5F_SIM && VM5F_SIM_DISCOVERY
+    discovery_bench();
+#endif
+    printf("\n\t***SYSTEM READY***\n\n");
+
+    while(1)
+    {
+        sched_round();
+    }
+}
+
+//Low priority task reporting heap and task stack high-water marks, to spot leaks and fragmentation on soak runs.
+static void stats_task(void* arg)
+{
+    uint32_t last_frames = 0;
+    uint32_t last_arrivals = 0;
+    uint32_t last_reads = 0;
+
+    while(1)
+    {
+        vTaskDelay(STATS_PERIOD / portTICK_RATE_MS);
+        if(journal_exporting)
+        {
+            continue;
+        }
+        printf("heap free: %u, min free: %u, largest block: %u \n",
+               heap_caps_get_free_size(MALLOC_CAP_8BIT),
+               heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+               heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#if VM5F_BUS
+        printf("stack free (words): gpio %u, tag %u, stats %u \n",
+               uxTaskGetStackHighWaterMark(gpio_task_handle),
+               uxTaskGetStackHighWaterMark(tag_task_handle),
+               uxTaskGetStackHighWaterMark(NULL));
+        bus_report();
+#else
+        printf("stack free (words): gpio %u, uart_rx %u, rfid %u, tag %u, stats %u \n",
+               uxTaskGetStackHighWaterMark(gpio_task_handle),
+               uxTaskGetStackHighWaterMark(uart_rx_task_handle),
+               uxTaskGetStackHighWaterMark(rfid_task_handle),
+               uxTaskGetStackHighWaterMark(tag_task_handle),
+               uxTaskGetStackHighWaterMark(NULL));
+        printf("read ring: high water %u of %u, dropped %u \n", read_ring.high_water, READ_RING_LEN, read_ring.dropped);
+        printf("sched: %s at %u dBm, switches %u, active rounds %u, idle rounds %u, idle RF duty %u%% \n",
+               sched_idle ? "idle" : "active", sched_dbm, sched_switches, sched_rounds[0], sched_rounds[1],
+               sched_time_ms[1] ? (uint32_t)((uint64_t) sched_rf_ms[1] * 100 / sched_time_ms[1]) : 0);
+        printf("health: temp %d C (last %u: mean %d, max %d), power cap %u dBm, derates %u, resets %u, power cycles %u, timeouts %u \n",
+               health_last(&health_temp), health_temp.n, health_mean(&health_temp), health_extreme(&health_temp, 1),
+               health_dbm_cap, health_derates, health_resets, health_power_cycles, health_timeouts);
+        for(int a=0; a<HEALTH_ANTENNAS; a++)
+        {
+            if(health_rl[a].n || health_ant_errors[a])
+            {
+                printf("health: antenna %d%s, return loss %d dB (last %u: mean %d, min %d), detect errors %u%s \n",
+                       a + 1, a == health_work_ant ? " (work)" : "", health_last(&health_rl[a]), health_rl[a].n,
+                       health_mean(&health_rl[a]), health_extreme(&health_rl[a], 0), health_ant_errors[a],
+                       (health_ant_skip & (1 << a)) ? ", SKIPPED" : "");
+            }
+        }
+        if(health_skips || health_failovers)
+        {
+            printf("health: antennas skipped %u times, work antenna failovers %u \n", health_skips, health_failovers);
+        }
+#endif
+        printf("rx frames: %u, bad checksum: %u, skipped bytes: %u, ring overflows: %u, tag drops: %u, resp drops: %u, not allowed: %u \n",
+               rx_parser.frames, rx_parser.bad_checksum, rx_parser.skipped, rx_ring.overflow_events,
+               tag_queue_dropped, rx_resp_dropped, allow_denied);
+        printf("tag reads: %u, tags in field: %u, table full: %u, pc mismatch: %u, bad tag frames: %u \n", tag_reads,
+               tag_table.used, tag_table.full, tag_pc_mismatch, tag_bad_frames);
+        if(mem_commands)
+        {
+            printf("tag memory: %u read commands, %u frames, %u tags read, %u unmatched \n",
+                   mem_commands, mem_frames, mem_tags_read, mem_unmatched);
+        }
+        printf("door state: %d, badges while busy: %u \n", door_state, door_busy_tags);
+        printf("tag bus: published %u, pool %u of %u free, exhausted %u \n", tag_bus.published,
+               event_bus_free(&tag_bus), tag_bus.records, tag_bus.exhausted);
+        for(int i=0; i<tag_bus.subs; i++)
+        {
+            const event_sub_t* sub = tag_bus.sub[i];
+            printf("tag bus %s: delivered %u, taken %u, lag %u (max %u of %u), dropped %u, blocked %u \n", sub->name,
+                   sub->delivered, sub->taken, event_sub_lag(sub), sub->lag_max, sub->mask + 1, sub->dropped, sub->blocked);
+        }
+        if(journal_task_handle != NULL)
+        {
+            printf("journal: sector %u block %u, blocks written %u, torn %u, errors %u, lost %u, ring dropped %u \n",
+                   journal.head_sector, journal.head_block, journal.blocks_written, journal.torn, journal.errors,
+                   journal.lost, journal_ring.dropped);
+        }
+        printf("frame cpu: %u cycles avg over %u frames, log records: %u \n",
+               frame_count ? frame_cycles / frame_count : 0, frame_count, log_ring.written);
+        frame_cycles = 0;
+        frame_count = 0;
+        printf("frames/s: %u, reads/s: %u, arrivals/s: %u \n", (rx_parser.frames - last_frames) * 1000 / STATS_PERIOD,
+               (tag_reads - last_reads) * 1000 / STATS_PERIOD, (tag_arrivals - last_arrivals) * 1000 / STATS_PERIOD);
+#if VM5F_SIM
+        bench_report();
+#endif
+        TIMING_REPORT();
+        last_frames = rx_parser.frames;
+        last_arrivals = tag_arrivals;
+        last_reads = tag_reads;
+        for(int m=0; m<INVENTORY_MODES; m++)
+        {
+            const mode_stats_t* ms = &mode_stats[m];
+            if(ms->rounds == 0 || ms->time_ms == 0)
+            {
+                continue;
+            }
+            printf("%s: rounds %u, tag frames %u, unique/s %u, bytes/unique %u \n",
+                   mode_names[m], ms->rounds, ms->records,
+                   (uint32_t)((uint64_t)ms->unique * 1000 / ms->time_ms),
+                   ms->unique ? ms->rx_bytes / ms->unique : 0);
+        }
+        if(epc_filter_count > 0)
+        {
+            printf("epc filter: %d prefixes, applied %u, lost %u, probes %u, probe round %u frames/%u bytes, saved ~%u frames/~%u bytes \n",
+                   epc_filter_count, epc_filter_applies, epc_filter_lost, epc_filter_probes, epc_probe_frames,
+                   epc_probe_bytes, epc_saved_frames, epc_saved_bytes);
+#if VM5F_SIM
+            printf("epc filter: %u foreign reads posted \n", sim_foreign_posted);
+#endif
+        }
+        if(mode_stats[INVENTORY_SESSION].rounds)
+        {
+            printf("session: target %c, flips %u \n", session_target == TARGET_A ? 'A' : 'B', session_flips);
+        }
+    }
+}
+
+//Lowest priority task printing the deferred log, so console writes never hold up the Reader.
+static void log_task(void* arg)
+{
+    while(1)
+    {
+        if(!journal_exporting)
+        {
+            log_drain();
+        }
+        vTaskDelay(LOG_DRAIN_PERIOD / portTICK_RATE_MS);
+    }
+}
+
+/***************************** Journal ***************************************/
+static void journal_export_block(const uint8_t* block, int len, void* ctx)
+{
+    fwrite(block, 1, len, stdout);
+    *(uint32_t*) ctx += len;
+}
+
+//Console baud rate change, once everything queued so far has gone out.
+static void journal_console_baud(uint32_t baud)
+{
+    fflush(stdout);
+    uart_wait_tx_done(CONFIG_CONSOLE_UART_NUM, portMAX_DELAY);
+    uart_set_baudrate(CONFIG_CONSOLE_UART_NUM, baud);
+    vTaskDelay(JOURNAL_EXPORT_PAUSE / portTICK_RATE_MS);
+}
+
+//Bulk export: "#J export <baud>" at the console rate, then at <baud> the stored blocks raw, oldest
+//first, ended by an all-zero header; back at the console rate "#J done <bytes>". Text output is
+//held meanwhile. tools/journal_decode.py --port drives this.
+static void journal_export_console()
+{
+    static const uint8_t end[JOURNAL_HEADER_SIZE];
+    uint32_t bytes = 0;
+
+    journal_exporting = 1;
+    vTaskDelay(LOG_DRAIN_PERIOD / portTICK_RATE_MS);                //Let a drain in progress finish.
+    printf("#J export %u \n", JOURNAL_EXPORT_BAUD);
+    journal_console_baud(JOURNAL_EXPORT_BAUD);
+    esp_vfs_dev_uart_set_tx_line_endings(ESP_LINE_ENDINGS_LF);     //Binary: no CR inserted.
+    journal_export(&journal, journal_export_block, &bytes);
+    fwrite(end, 1, sizeof(end), stdout);
+    journal_console_baud(CONFIG_CONSOLE_UART_BAUDRATE);
+    esp_vfs_dev_uart_set_tx_line_endings(ESP_LINE_ENDINGS_CRLF);
+    printf("#J done %u \n", bytes);
+    journal_exporting = 0;
+}
+
+//journal_sub wakeup, runs in tag_task.
+static void journal_sub_notify(void* ctx)
+{
+    xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_EVENTS, eSetBits);
+}
+
+//Journal task: batches door events into flash blocks and runs the export console_task asks for.
+//Flash writes stall the caches of both cores, so blocks are only written when full or
+//JOURNAL_FLUSH_TIME old. Door decisions come from gpio_task over journal_ring, departures
+//straight from tag_bus; both drop rather than wait when this task falls behind. Asleep until
+//notified or the batch is due.
+static void journal_task(void* arg)
+{
+    journal_record_t rec;
+    const tag_event_t* tag;
+    uint32_t batch_ms = 0;                                          //When the oldest unwritten record came in.
+    uint32_t bits;
+
+    while(1)
+    {
+        TickType_t wait = portMAX_DELAY;
+        if(journal.batch_count > 0)
+        {
+            const uint32_t age = (uint32_t)(esp_timer_get_time() / 1000) - batch_ms;
+            wait = age < JOURNAL_FLUSH_TIME ? (JOURNAL_FLUSH_TIME - age) / portTICK_RATE_MS + 1 : 0;
+        }
+        bits = 0;
+        xTaskNotifyWait(0, 0xFFFFFFFF, &bits, wait);
+        const uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        while(spsc_pop(&journal_ring, &rec))
+        {
+            if(journal.batch_count == 0)
+            {
+                batch_ms = now_ms;
+            }
+            journal_append(&journal, &rec);
+        }
+        while((tag = event_sub_take(&tag_bus, &journal_sub)) != NULL)
+        {
+            if(tag->type == TAG_DEPARTED)
+            {
+                journal_fill(&rec, JOURNAL_EV_DEPARTED, JOURNAL_ACT_NONE, tag);
+                if(journal.batch_count == 0)
+                {
+                    batch_ms = now_ms;
+                }
+                journal_append(&journal, &rec);
+            }
+            event_bus_release(&tag_bus, tag);
+        }
+        if(journal.batch_count > 0 && now_ms - batch_ms >= JOURNAL_FLUSH_TIME)
+        {
+            journal_flush(&journal);
+        }
+        if(bits & JOURNAL_NOTIFY_EXPORT)
+        {
+            journal_flush(&journal);
+            journal_export_console();
+        }
+    }
+}
+
+//Mount the journal partition and start journal_task. Without the partition door events are not kept.
+static void journal_start()
+{
+    if(journal_flash_partition(&journal_flash, "journal") != 0 || journal_mount(&journal, &journal_flash) != 0)
+    {
+        printf("journal: no partition, door events not kept \n");
+        return;
+    }
+    printf("journal: %u sectors, head %u/%u, boot %u, next record %u, torn blocks %u \n", journal.sectors,
+           journal.head_sector, journal.head_block, journal.boot, journal.next_seq, journal.torn);
+    spsc_init(&journal_ring, journal_ring_storage, sizeof(journal_record_t), JOURNAL_RING_LEN);
+    event_bus_subscribe(&tag_bus, &journal_sub, "journal", journal_sub_slot, JOURNAL_SUB_LEN, EVENT_DROP_OLDEST, 0,
+                        journal_sub_notify, NULL);
+    journal_task_handle = xTaskCreateStaticPinnedToCore(journal_task, "journal_task", JOURNAL_TASK_STACK, NULL, 2,
+                                                        journal_task_stack, &journal_task_tcb, CORE_POLICY);
+}
+
+/***************************** Console ***************************************/
+//Exactly len bytes from the console, or -1 when the host went quiet for ALLOW_UPLOAD_TIMEOUT.
+static int console_read(uint8_t* buf, int len)
+{
+    int got = 0;
+
+    while(got < len)
+    {
+        const int n = uart_read_bytes(CONFIG_CONSOLE_UART_NUM, &buf[got], len - got, ALLOW_UPLOAD_TIMEOUT / portTICK_RATE_MS);
+        if(n <= 0)
+        {
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+//Allowlist upload: "#A ready", the host sends the image length (4 bytes, little endian), the
+//partition not in use is erased, "#A go <chunk>"; then the image in chunks of <chunk> bytes, each
+//acknowledged with "#A ok <bytes so far>" once in flash. The header is held back and written last,
+//so an upload cut short never leaves a valid image. "#A done <generation>" when the new list is
+//active, "#A error <why>" ends it otherwise. tools/allowlist_build.py --port drives this.
+static void allowlist_upload()
+{
+    allowlist_header_t hdr;
+    uint8_t len_le[4];
+    uint32_t done = 0;
+
+    printf("#A ready \n");
+    if(console_read(len_le, sizeof(len_le)) != 0)
+    {
+        printf("#A error timeout \n");
+        return;
+    }
+    const uint32_t len = len_le[0] | len_le[1] << 8 | len_le[2] << 16 | (uint32_t) len_le[3] << 24;
+    if(len < ALLOWLIST_HEADER_SIZE)
+    {
+        printf("#A error length %u \n", len);
+        return;
+    }
+    if(allowlist_update_begin() != 0)
+    {
+        printf("#A error erase \n");
+        return;
+    }
+    printf("#A go %u \n", ALLOW_UPLOAD_CHUNK);
+    while(done < len)
+    {
+        const uint32_t n = (len - done < ALLOW_UPLOAD_CHUNK) ? len - done : ALLOW_UPLOAD_CHUNK;
+        if(console_read(allow_upload_buf, n) != 0)
+        {
+            printf("#A error timeout at %u \n", done);
+            return;
+        }
+        uint32_t skip = 0;
+        if(done < ALLOWLIST_HEADER_SIZE)                            //Header bytes wait for the commit.
+        {
+            skip = ALLOWLIST_HEADER_SIZE - done < n ? ALLOWLIST_HEADER_SIZE - done : n;
+            memcpy((uint8_t*) &hdr + done, allow_upload_buf, skip);
+        }
+        if(skip < n && allowlist_update_write(done + skip, &allow_upload_buf[skip], n - skip) != 0)
+        {
+            printf("#A error write at %u \n", done + skip);
+            return;
+        }
+        done += n;
+        printf("#A ok %u \n", done);
+    }
+    if(allowlist_update_commit(&hdr) != 0)
+    {
+        printf("#A error image \n");
+        return;
+    }
+    printf("#A done %u \n", hdr.generation);
+}
+
+//One command byte from the console.
+static void console_command(uint8_t c)
+{
+    if(c == JOURNAL_EXPORT_CMD && journal_task_handle != NULL)
+    {
+        xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_EXPORT, eSetBits);
+    }
+    else if(c == ALLOW_UPLOAD_CMD)
+    {
+        allowlist_upload();
+        xQueueReset(console_events);                                //Data events of the upload, already read.
+    }
+}
+
+//Console input: the UART driver's event queue wakes this task when bytes came in, nothing polls.
+static void console_task(void* arg)
+{
+    uart_event_t event;
+    uint8_t buf[16];
+    int n;
+
+    while(1)
+    {
+        if(!xQueueReceive(console_events, &event, portMAX_DELAY))
+        {
+            continue;
+        }
+        if(event.type != UART_DATA)                                 //Overflow, break, framing: drop what is there.
+        {
+            uart_flush_input(CONFIG_CONSOLE_UART_NUM);
+            continue;
+        }
+        while((n = uart_read_bytes(CONFIG_CONSOLE_UART_NUM, buf, sizeof(buf), 0)) > 0)
+        {
+            for(int i=0; i<n; i++)
+            {
+                console_command(buf[i]);
+            }
+        }
+    }
+}
+
+//Put the console UART under the driver, stdout included, and start console_task.
+static void console_start()
+{
+    fflush(stdout);
+    uart_driver_install(CONFIG_CONSOLE_UART_NUM, CONSOLE_RX_BUF, 0, CONSOLE_QUEUE_LEN, &console_events, 0);
+    esp_vfs_dev_uart_use_driver(CONFIG_CONSOLE_UART_NUM);
+    xTaskCreateStaticPinnedToCore(console_task, "console_task", CONSOLE_TASK_STACK, NULL, 1, console_task_stack,
+                                  &console_task_tcb, CORE_POLICY);
+}
+
+//host_sub wakeup, runs in tag_task.
+static void host_sub_notify(void* ctx)
+{
+    xTaskNotifyGive(host_task_handle);
+}
+
+//Host forwarder: one console line per arrival and departure for a host on the serial port,
+//"#T arrived|departed reader <n> ant <n> rssi <n> reads <n> epc <hex>". The console is slow, if the
+//host falls behind the oldest events go and host_sub counts them.
+static void host_task(void* arg)
+{
+    const tag_event_t* tag;
+    char epc_hex[TAG_EPC_MAX * 2 + 1];
+
     while(1)
     {
-        real_time_inventory();
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        TagDetect();
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        
-        setWorkAntenna();
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        getData();
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while((tag = event_sub_take(&tag_bus, &host_sub)) != NULL)
+        {
+            if(!journal_exporting)                                  //The console carries the export.
+            {
+                for(int i=0; i<tag->epc_len; i++)
+                {
+                    sprintf(&epc_hex[i * 2], "%02x", tag->epc[i]);
+                }
+                epc_hex[tag->epc_len * 2] = 0;
+                printf("#T %s reader %u ant %u rssi %u reads %u epc %s \n", tag->type == TAG_ARRIVED ? "arrived" : "departed",
+                       tag->reader, tag->ant, tag->rssi, tag->count, epc_hex);
+            }
+            event_bus_release(&tag_bus, tag);
+        }
     }
 }
 
+//Publisher wait for a full EVENT_BLOCK queue, tag_task gives the subscriber a tick.
+static void tag_bus_wait()
+{
+    vTaskDelay(1);
+}
+
 void app_main()
 {
     init();
     gpio_setup();
-    //create a queue to handle gpio event from isr
-    tag_found_queue = xQueueCreate(10, sizeof(uint32_t)); 
+    allowlist_init();
+    //tag event bus, the door subscribes first so it gets every event before the slower subscribers
+    event_bus_init(&tag_bus, tag_bus_pool, tag_bus_ref, sizeof(tag_event_t), EVENT_POOL_LEN, tag_bus_wait);
+    event_bus_subscribe(&tag_bus, &door_sub, "door", door_sub_slot, DOOR_SUB_LEN, EVENT_BLOCK, DOOR_SUB_BLOCK,
+                        door_sub_notify, NULL);
+    event_bus_subscribe(&tag_bus, &host_sub, "host", host_sub_slot, HOST_SUB_LEN, EVENT_DROP_OLDEST, 0,
+                        host_sub_notify, NULL);
+    resp_queue = xQueueCreateStatic(RESP_QUEUE_LEN, sizeof(vm5f_response_t), resp_queue_storage, &resp_queue_buf);
+    reader_target.io = vm5f_io;
+    reader_target.add = VM5F_BROADCAST;
+    reader_target.resp = resp_queue;
+    mem_job_lock = xSemaphoreCreateMutexStatic(&mem_job_lock_buf);
+    mem_job_done = xSemaphoreCreateBinaryStatic(&mem_job_done_buf);
+    door_init();
+#if defined(EPC_FILTER_PREFIX) || (VM5F_SIM && VM5F_SIM_FILTER)
+    epc_filter_set(&epc_filter_build, 1);
+#endif
+#if VM5F_SIM && VM5F_SIM_HEALTH
+    inv_config.seq[1].ant = ANTENNA_2;                              //Two antennas, the simulated cable fault is on the first.
+    inv_config.seq[1].stay = 1;
+#endif
+    //start the door event journal, before gpio_task records the first state
+    journal_start();
+    //start console input once journal_task is there to take an export
+    console_start();
+    //start the host forwarder before tag_task publishes to it
+    host_task_handle = xTaskCreateStaticPinnedToCore(host_task, "host_task", HOST_TASK_STACK, NULL, 1,
+                                                     host_task_stack, &host_task_tcb, CORE_POLICY);
     //start gpio task
-    xTaskCreate(gpio_task, "gpio_task", 1024*2, NULL, configMAX_PRIORITIES, NULL);
+    gpio_task_handle = xTaskCreateStaticPinnedToCore(gpio_task, "gpio_task", GPIO_TASK_STACK, NULL,
+                                                     configMAX_PRIORITIES-1, gpio_task_stack, &gpio_task_tcb, CORE_POLICY);
+    //start tag aggregation task, before anything can post reads to it
+    tag_task_handle = xTaskCreateStaticPinnedToCore(tag_task, "tag_task", TAG_TASK_STACK, NULL,
+                                                    configMAX_PRIORITIES-2, tag_task_stack, &tag_task_tcb, CORE_POLICY);
+#if VM5F_BUS
+    //start a receive and a poll task per RS-485 bus
+    bus_start();
+#else
+    //start uart receive task
+    uart_rx_task_handle = xTaskCreateStaticPinnedToCore(uart_rx_task, "uart_rx_task", UART_RX_TASK_STACK, NULL,
+                                                        configMAX_PRIORITIES-1, uart_rx_task_stack, &uart_rx_task_tcb, CORE_IO);
     //start uart task
-    xTaskCreate(rfid_task, "uart_rfid_task", 1024*2, NULL, configMAX_PRIORITIES-1, NULL);
+    rfid_task_handle = xTaskCreateStaticPinnedToCore(rfid_task, "uart_rfid_task", RFID_TASK_STACK, NULL,
+                                                     configMAX_PRIORITIES-2, rfid_task_stack, &rfid_task_tcb, CORE_IO);
+#endif
+    //start heap/stack report task
+    xTaskCreateStaticPinnedToCore(stats_task, "stats_task", STATS_TASK_STACK, NULL, 1, stats_task_stack, &stats_task_tcb, CORE_POLICY);
+    //start deferred log output task
+    xTaskCreateStaticPinnedToCore(log_task, "log_task", LOG_TASK_STACK, NULL, 1, log_task_stack, &log_task_tcb, CORE_POLICY);
 }
\ No newline at end of file
@@ -0,0 +1,411 @@
+/*
+    Streaming frame parser for VM-5F responses.
+
+    Received bytes are pushed into a ring buffer as they arrive. The parser walks the ring
+    byte by byte, finds frame boundaries from the head (0xA0) and len bytes, verifies the
+    checksum and hands out frame views that point into the ring (no copying). Tag views go one
+    step further for the tag frames: PC, EPC (its length taken from the PC word, 16 to 496 bits),
+    memory read data, RSSI and antenna, still read in place.
+    Only uses standard C, so it builds on the host as well as on the ESP-32.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_HEAD          0xA0                                        //First byte of every VM-5F frame.
+#define FRAME_MIN_LEN       0x03                                        //len counts add, cmd, data and checksum.
+#define FRAME_OVERHEAD      2                                           //head and len are not counted in len.
+
+#define RX_RING_SIZE        1024                                        //Must be a power of 2.
+#define RX_RING_MASK        (RX_RING_SIZE - 1)
+
+#define PC_EPC_WORDS(pc)    (((pc) >> 11) & 0x1F)                       //EPC length field of the PC word, in 16 bit words.
+#define PC_XI               0x0200                                      //An XPC_W1 word follows the PC word.
+
+//Kinds of a real time, fast switch or session inventory frame (0x89, 0x8A, 0x8B).
+#define INV_FRAME_TAG       0                                           //Freq/Ant, PC, EPC, RSSI: 4 + EPC bytes, always even.
+#define INV_FRAME_ERROR     1                                           //1 data byte: error code, the round is over.
+#define INV_FRAME_ANT_ERROR 2                                           //2 data bytes: fast switch antenna failed, the round goes on.
+#define INV_FRAME_END       3                                           //7 data bytes: end of round statistics.
+
+//Receive Ring Buffer. Indexes run freely and are masked on access.
+typedef struct rx_ring
+{
+    uint8_t buf[RX_RING_SIZE];
+    volatile uint32_t head;                                             //Write index.
+    volatile uint32_t tail;                                             //Read index.
+    uint32_t overflow;                                                  //Bytes lost because the ring was full.
+    uint32_t overflow_events;                                           //Writes that lost bytes (each breaks at least one frame).
+
+}rx_ring_t;
+
+//Frame View: one complete, checksum verified frame inside the ring.
+//Valid until the next call of frame_parser_next() on the same parser.
+typedef struct frame_view
+{
+    const rx_ring_t *ring;
+    uint32_t pos;                                                       //Ring index of the head byte.
+    uint8_t len;
+    uint8_t add;
+    uint8_t cmd;
+
+}frame_view_t;
+
+//Tag View: one tag of a tag frame. EPC and memory data stay in the ring, the view holds their
+//offsets in the frame data field. Valid as long as the frame view it was made from.
+typedef struct tag_view
+{
+    const frame_view_t *frame;
+    uint16_t pc;
+    uint8_t epc;                                                        //Data offset of the EPC.
+    uint8_t epc_len;                                                    //EPC bytes, from the PC word.
+    uint8_t mem;                                                        //Data offset of the memory read (0x81 frames).
+    uint8_t mem_len;
+    uint8_t rssi;                                                       //0 in 0x81 frames, they carry none.
+    uint8_t freq_ant;
+    uint8_t count;                                                      //Reads of the tag (buffered and 0x81 frames), 1 otherwise.
+    uint8_t pc_mismatch;                                                //The PC word claimed more EPC than the frame holds.
+
+}tag_view_t;
+
+//Frame Parser state and counters.
+typedef struct frame_parser
+{
+    rx_ring_t *ring;
+    uint32_t release;                                                   //Size of the last returned frame, freed on the next call.
+    uint32_t frames;                                                    //Good frames returned.
+    uint32_t bad_checksum;                                              //Frames dropped on checksum mismatch.
+    uint32_t bad_len;                                                   //Heads dropped because of an impossible len byte.
+    uint32_t skipped;                                                   //Bytes thrown away while looking for a frame head.
+    uint32_t stalled;                                                   //Partial frames dropped after the line went idle.
+
+}frame_parser_t;
+
+void ring_init(rx_ring_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overflow = 0;
+    ring->overflow_events = 0;
+}
+
+static inline uint32_t ring_count(const rx_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+static inline uint32_t ring_space(const rx_ring_t *ring)
+{
+    return RX_RING_SIZE - ring_count(ring);
+}
+
+//Byte at offset from the read index.
+static inline uint8_t ring_peek(const rx_ring_t *ring, uint32_t offset)
+{
+    return ring->buf[(ring->tail + offset) & RX_RING_MASK];
+}
+
+//Push received bytes into the ring, returns number of bytes stored. Bytes that do not fit are dropped.
+int ring_write(rx_ring_t *ring, const uint8_t *data, int len)
+{
+    uint32_t space = ring_space(ring);
+    if((uint32_t)len > space)
+    {
+        ring->overflow += len - space;
+        ring->overflow_events++;
+        len = space;
+    }
+
+    uint32_t idx = ring->head & RX_RING_MASK;
+    uint32_t first = RX_RING_SIZE - idx;
+    if(first > (uint32_t)len)
+    {
+        first = len;
+    }
+    memcpy(&ring->buf[idx], data, first);
+    memcpy(&ring->buf[0], data + first, len - first);
+    ring->head += len;
+    return len;
+}
+
+void frame_parser_init(frame_parser_t *parser, rx_ring_t *ring)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->ring = ring;
+}
+
+//Byte i of the frame (0 = head).
+static inline uint8_t frame_byte(const frame_view_t *frame, int i)
+{
+    return frame->ring->buf[(frame->pos + i) & RX_RING_MASK];
+}
+
+//Byte i of the frame data field (after head, len, add and cmd).
+static inline uint8_t frame_data(const frame_view_t *frame, int i)
+{
+    return frame_byte(frame, 4 + i);
+}
+
+//Length of the frame data field.
+static inline int frame_data_len(const frame_view_t *frame)
+{
+    return frame->len - FRAME_MIN_LEN;
+}
+
+//Total size of the frame on the wire.
+static inline int frame_size(const frame_view_t *frame)
+{
+    return frame->len + FRAME_OVERHEAD;
+}
+
+//Pointer to the frame if it does not wrap around the end of the ring, NULL otherwise.
+static inline const uint8_t* frame_ptr(const frame_view_t *frame)
+{
+    uint32_t idx = frame->pos & RX_RING_MASK;
+    if(idx + frame_size(frame) > RX_RING_SIZE)
+    {
+        return NULL;
+    }
+    return &frame->ring->buf[idx];
+}
+
+//Copy the frame out of the ring, returns number of bytes copied.
+int frame_copy(const frame_view_t *frame, uint8_t *dst, int max)
+{
+    int n = frame_size(frame);
+    if(n > max)
+    {
+        n = max;
+    }
+    for(int i=0; i<n; i++)
+    {
+        dst[i] = frame_byte(frame, i);
+    }
+    return n;
+}
+
+//Copy n bytes of the frame data field from offset off, two copies at most.
+static void frame_copy_data(const frame_view_t *frame, int off, uint8_t *dst, int n)
+{
+    const uint32_t idx = (frame->pos + 4 + off) & RX_RING_MASK;
+    uint32_t first = RX_RING_SIZE - idx;
+    if(first > (uint32_t)n)
+    {
+        first = n;
+    }
+    memcpy(dst, &frame->ring->buf[idx], first);
+    memcpy(dst + first, &frame->ring->buf[0], n - first);
+}
+
+//PC word at data offset off, EPC after it (and after the XPC_W1 word if the PC announces one), room
+//bytes left for both. An EPC longer than the room is cut to fit and flagged.
+static void tag_view_epc(tag_view_t *v, int off, int room)
+{
+    v->pc = (frame_data(v->frame, off) << 8) | frame_data(v->frame, off + 1);
+    v->epc = off + 2;
+    room -= 2;
+    if((v->pc & PC_XI) && room >= PC_EPC_WORDS(v->pc) * 2 + 2)
+    {
+        v->epc += 2;
+        room -= 2;
+    }
+    v->epc_len = PC_EPC_WORDS(v->pc) * 2;
+    v->pc_mismatch = (v->epc_len > room);
+    if(v->pc_mismatch)
+    {
+        v->epc_len = room > 0 ? room : 0;
+    }
+}
+
+//Kind of an inventory frame by its data length. The other frames have fixed lengths, a tag frame
+//is anything else: its EPC may be as short as one word, so a length threshold would misread it.
+static inline int inventory_frame_kind(const frame_view_t *frame)
+{
+    switch(frame_data_len(frame))
+    {
+        case 1:
+            return INV_FRAME_ERROR;
+
+        case 2:
+            return INV_FRAME_ANT_ERROR;
+
+        case 7:
+            return INV_FRAME_END;
+
+        default:
+            return INV_FRAME_TAG;
+    }
+}
+
+//Tag view of a real time, fast switch or session inventory tag frame.
+//Frame data: Freq/Ant, PC(2), EPC, RSSI.
+void tag_view_inventory(const frame_view_t *frame, tag_view_t *v)
+{
+    const int n = frame_data_len(frame);
+
+    v->frame = frame;
+    v->freq_ant = frame_data(frame, 0);
+    v->rssi = frame_data(frame, n - 1);
+    v->count = 1;
+    v->mem = 0;
+    v->mem_len = 0;
+    tag_view_epc(v, 1, n - 2);
+}
+
+//Tag view of an inventory buffer tag frame, returns its TagCount, -1 if the lengths do not add up.
+//Frame data: TagCount(2), DataLen, PC(2)+EPC+CRC(2), RSSI, Freq/Ant, InvCount.
+int tag_view_buffered(const frame_view_t *frame, tag_view_t *v)
+{
+    const int n = frame_data(frame, 2);
+
+    if(6 + n != frame_data_len(frame) || n < 4)
+    {
+        return -1;
+    }
+    v->frame = frame;
+    v->rssi = frame_data(frame, 3 + n);
+    v->freq_ant = frame_data(frame, 4 + n);
+    v->count = frame_data(frame, 5 + n);
+    v->mem = 0;
+    v->mem_len = 0;
+    tag_view_epc(v, 3, n - 2);
+    return (frame_data(frame, 0) << 8) | frame_data(frame, 1);
+}
+
+//Tag view of a read tag memory (0x81) frame, returns its TagCount, -1 if the lengths do not add up.
+//Frame data: TagCount(2), DataLen, PC(2)+EPC+CRC(2)+Data, ReadLen, Freq/Ant, ReadCount.
+int tag_view_read(const frame_view_t *frame, tag_view_t *v)
+{
+    const int n = frame_data(frame, 2);
+    const int read_len = frame_data(frame, 3 + n);
+
+    if(6 + n != frame_data_len(frame) || read_len + 4 > n)
+    {
+        return -1;
+    }
+    v->frame = frame;
+    v->rssi = 0;
+    v->freq_ant = frame_data(frame, 4 + n);
+    v->count = frame_data(frame, 5 + n);
+    v->mem = 3 + n - read_len;
+    v->mem_len = read_len;
+    tag_view_epc(v, 3, n - read_len - 2);
+    return (frame_data(frame, 0) << 8) | frame_data(frame, 1);
+}
+
+static inline uint8_t tag_view_ant(const tag_view_t *v)
+{
+    return v->freq_ant & 0x03;
+}
+
+static inline uint8_t tag_view_freq(const tag_view_t *v)
+{
+    return v->freq_ant >> 2;
+}
+
+//Copy the EPC out, up to max bytes. Returns the bytes copied.
+int tag_view_copy_epc(const tag_view_t *v, uint8_t *dst, int max)
+{
+    const int n = v->epc_len < max ? v->epc_len : max;
+    frame_copy_data(v->frame, v->epc, dst, n);
+    return n;
+}
+
+//Copy the memory read out, up to max bytes. Returns the bytes copied.
+int tag_view_copy_mem(const tag_view_t *v, uint8_t *dst, int max)
+{
+    const int n = v->mem_len < max ? v->mem_len : max;
+    frame_copy_data(v->frame, v->mem, dst, n);
+    return n;
+}
+
+//Is the tag's EPC this one? Compared in the ring.
+int tag_view_epc_equal(const tag_view_t *v, const uint8_t *epc, int len)
+{
+    if(len != v->epc_len)
+    {
+        return 0;
+    }
+    for(int i=0; i<len; i++)
+    {
+        if(frame_data(v->frame, v->epc + i) != epc[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Find the next complete frame in the ring.
+//Returns 1 and fills frame when one is found, 0 when more bytes are needed.
+int frame_parser_next(frame_parser_t *parser, frame_view_t *frame)
+{
+    rx_ring_t *ring = parser->ring;
+
+    ring->tail += parser->release;                                      //Give back the frame returned last time.
+    parser->release = 0;
+
+    while(ring_count(ring) >= FRAME_OVERHEAD)
+    {
+        if(ring_peek(ring, 0) != FRAME_HEAD)
+        {
+            ring->tail++;
+            parser->skipped++;
+            continue;
+        }
+
+        uint8_t len = ring_peek(ring, 1);
+        if(len < FRAME_MIN_LEN || (uint32_t)len + FRAME_OVERHEAD > RX_RING_SIZE)
+        {
+            ring->tail++;                                               //Not a real head, resync on the next byte.
+            parser->bad_len++;
+            continue;
+        }
+
+        uint32_t size = len + FRAME_OVERHEAD;
+        if(ring_count(ring) < size)
+        {
+            return 0;                                                   //Frame not complete yet.
+        }
+
+        uint8_t sum = 0;
+        for(uint32_t i=0; i<size - 1; i++)
+        {
+            sum += ring_peek(ring, i);
+        }
+        if((uint8_t)(~sum + 1) != ring_peek(ring, size - 1))
+        {
+            ring->tail++;                                               //0xA0 may also appear inside data, resync after it.
+            parser->bad_checksum++;
+            continue;
+        }
+
+        frame->ring = ring;
+        frame->pos = ring->tail;
+        frame->len = len;
+        frame->add = ring_peek(ring, 2);
+        frame->cmd = ring_peek(ring, 3);
+        parser->release = size;
+        parser->frames++;
+        return 1;
+    }
+    return 0;
+}
+
+//Call when the line has gone idle. The Reader sends a frame without gaps, so a frame that is
+//still incomplete now never will be (usually a 0xA0 data byte read as a head). Drops that head
+//so the following bytes get parsed, returns 1 if anything was dropped.
+int frame_parser_idle(frame_parser_t *parser)
+{
+    rx_ring_t *ring = parser->ring;
+
+    ring->tail += parser->release;
+    parser->release = 0;
+    if(ring_count(ring) == 0)
+    {
+        return 0;
+    }
+    ring->tail++;
+    parser->stalled++;
+    return 1;
+}
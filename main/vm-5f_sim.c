@@ -0,0 +1,1042 @@
+/*
+    Simulated VM-5F Reader, to run the firmware without a Reader attached.
+
+    Sits behind the transport interface: takes the command frames the firmware writes and hands
+    back response frames with Reader-like timing, including the multi frame responses of the
+    inventory commands (0x89, 0x8A, 0x8B, 0x80 then 0x91) and of read tag memory (0x81). Settings
+    written are returned by the matching get command.
+
+    The tag population is synthetic. Tag i has a fixed EPC, is seen by antenna i % antennas, and
+    moves in and out of the field (dwell_ms in, gap_ms out, every tag with its own phase). A tag
+    in the field is read in an antenna round with read_pct percent chance. Low indexes are the
+    strong tags: with slots set, a round reads at most that many tags and the strongest win
+    (collisions and capture effect of a Gen2 round), so in a crowd the weak tags starve unless
+    the strong ones are silenced. 0x8B does that with the inventoried flags of sessions S0-S3:
+    a read flips the flag, only tags whose flag matches the target answer. S0 flags fall back
+    to A at every command, S1 after SIM_S1_PERSIST_MS, S2/S3 when the tag leaves the field.
+    0x89 and 0x8A ignore the flags (every tag answers every round). Tag masks (0x98) are run as
+    Selects at the start of every inventory command and set the SL or session flags, so 0x8B
+    with an SL filter only hears the tags a mask picked. foreign_pct of the tags carry another
+    EPC prefix (retail items passing by), long_pct a 128, 256 or 496 bit EPC instead of 96 bits,
+    short_pct a 16 to 80 bit one (a hash, then the index in the last two bytes).
+    Every tag has a TID (E2 80 11 05 80 00 and a serial number) and 64 bytes of user memory.
+    Health: the temperature is temp_c plus 1 C per dBm of output power above POWER_MIN_DBM, the
+    antennas in bad_ants have a poor return loss and fail antenna detection (error 0x22), and with
+    reset_ms set the Reader reboots that often, losing its settings and tag masks; the output power
+    goes back to the last one stored with 0x76 (0x66 sets it without storing, flash_writes counts 0x76).
+    Faults for the receive path: random extra delay per frame (jitter), frames with one byte
+    flipped (checksum fails) and dropped bytes.
+
+    The caller passes the time in, the model only uses standard C and the command codes of
+    vm-5f.c, so it runs on the host as well.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#define SIM_TAGS_MAX        512
+#define SIM_EPC_LEN         12                                          //96 bit EPC of most tags.
+#define SIM_EPC_MAX         62
+#define SIM_TID_LEN         12
+#define SIM_USER_LEN        64
+#define SIM_BANK_MAX        (4 + SIM_EPC_MAX)                           //Largest memory bank: CRC, PC and a 496 bit EPC.
+#define SIM_FRAME_MAX       160                                         //Largest response frame built.
+#define SIM_REPLY_US        1500                                        //Answer time of a plain command.
+#define SIM_ADDRESS         0x01                                        //Reader address until 0x73 changes it.
+#define SIM_FW_MAJOR        1
+#define SIM_FW_MINOR        7
+#define SIM_ERR_NO_BUFFER   0x38                                        //Error code: inventory buffer empty.
+#define SIM_ERR_NO_TAG      0x36                                        //Error code: no tag read.
+#define SIM_READ_US         4000                                        //Air time of one tag memory read.
+#define SIM_ANT_MISSING     (-2)                                        //sim_next_read(): the step's antenna failed detection.
+#define SIM_NEVER           UINT64_MAX
+#define SIM_S1_PERSIST_MS   1000                                        //S1 flag back to A this long after a read.
+#define SIM_FLAG_SL         0x10                                        //flags: SL asserted (bits 0-3: session flag is B).
+
+//Simulation Config.
+typedef struct vm5f_sim_config
+{
+    uint16_t tags;                                                      //Tag population, up to SIM_TAGS_MAX.
+    uint8_t read_pct;                                                   //Chance a tag in the field is read per antenna round.
+    uint8_t antennas;                                                   //Antennas that see tags (1 to 4).
+    uint32_t dwell_ms;                                                  //Time in the field per visit.
+    uint32_t gap_ms;                                                    //Time out of the field between visits.
+    uint32_t round_us;                                                  //Fixed time of one antenna round.
+    uint32_t tag_us;                                                    //Air time of one tag read.
+    uint32_t jitter_us;                                                 //Up to this much extra delay per frame.
+    uint32_t corrupt_ppm;                                               //Frames with a flipped byte, per million.
+    uint32_t drop_ppm;                                                  //Bytes lost, per million.
+    uint16_t slots;                                                     //Most tags read per antenna round, 0: no limit.
+    uint8_t foreign_pct;                                                //Tags with a foreign EPC prefix.
+    uint8_t long_pct;                                                   //Tags with an EPC longer than 96 bits.
+    uint8_t short_pct;                                                  //Tags with an EPC shorter than 96 bits.
+    int8_t temp_c;                                                      //Temperature at POWER_MIN_DBM.
+    uint8_t bad_ants;                                                   //Bit per antenna with a cable or antenna fault.
+    uint32_t reset_ms;                                                  //Reboot this often, 0: never.
+
+}vm5f_sim_config_t;
+
+//Tag Mask held by the simulated Reader.
+typedef struct sim_mask
+{
+    uint8_t used;
+    uint8_t target;
+    uint8_t action;
+    uint8_t membank;
+    uint8_t start;
+    uint8_t bits;
+    uint8_t mask[MASK_BITS_MAX / 8];
+
+}sim_mask_t;
+
+#define VM5F_SIM_DEFAULTS { .tags = 50, .read_pct = 90, .antennas = 1, .dwell_ms = 3000, .gap_ms = 7000, \
+                            .round_us = 5000, .tag_us = 2500, .jitter_us = 500, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 0, \
+                            .foreign_pct = 0, .long_pct = 0, .short_pct = 0, .temp_c = 40, .bad_ants = 0, .reset_ms = 0 }
+
+//Full speed flood: every tag in the field is read every round and tag frames follow each other at
+//the line rate (a 21 byte 0x89 tag frame takes 1823 us at 115200 baud), half the tags in the field.
+#define VM5F_SIM_FLOOD_CONFIG { .tags = 256, .read_pct = 100, .antennas = 1, .dwell_ms = 2000, .gap_ms = 2000, \
+                              .round_us = 0, .tag_us = 1823, .jitter_us = 0, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 0, \
+                              .foreign_pct = 0, .long_pct = 0, .short_pct = 0, .temp_c = 40, .bad_ants = 0, .reset_ms = 0 }
+
+//Dense field for the discovery benchmark: every tag stays in the field, a round reads at most 16 of them.
+#define VM5F_SIM_DISCOVERY_CONFIG { .tags = 100, .read_pct = 90, .antennas = 1, .dwell_ms = 1000000, .gap_ms = 0, \
+                                  .round_us = 5000, .tag_us = 1823, .jitter_us = 0, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 16, \
+                                  .foreign_pct = 0, .long_pct = 0, .short_pct = 0, .temp_c = 40, .bad_ants = 0, .reset_ms = 0 }
+
+//Hot Reader with a broken cable on antenna 1 of two, rebooting every minute: for the health monitor.
+#define VM5F_SIM_HEALTH_CONFIG { .tags = 50, .read_pct = 90, .antennas = 2, .dwell_ms = 3000, .gap_ms = 7000, \
+                               .round_us = 5000, .tag_us = 2500, .jitter_us = 500, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 0, \
+                               .foreign_pct = 0, .long_pct = 0, .short_pct = 0, .temp_c = 62, .bad_ants = 0x01, .reset_ms = 60000 }
+
+//Short EPCs: half the tags carry 2 to 10 byte EPCs, whose tag frames are shorter than an end of round frame.
+#define VM5F_SIM_SHORT_CONFIG { .tags = 50, .read_pct = 90, .antennas = 1, .dwell_ms = 3000, .gap_ms = 7000, \
+                              .round_us = 5000, .tag_us = 2500, .jitter_us = 500, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 0, \
+                              .foreign_pct = 0, .long_pct = 0, .short_pct = 50, .temp_c = 40, .bad_ants = 0, .reset_ms = 0 }
+
+//Retail items passing the portal: a third of the tags carry a foreign EPC prefix, for the EPC filter.
+#define VM5F_SIM_FILTER_CONFIG { .tags = 50, .read_pct = 90, .antennas = 1, .dwell_ms = 3000, .gap_ms = 7000, \
+                               .round_us = 5000, .tag_us = 2500, .jitter_us = 500, .corrupt_ppm = 0, .drop_ppm = 0, .slots = 0, \
+                               .foreign_pct = 33, .long_pct = 0, .short_pct = 0, .temp_c = 40, .bad_ants = 0, .reset_ms = 0 }
+
+//Simulated Reader.
+typedef struct vm5f_sim
+{
+    vm5f_sim_config_t cfg;
+    uint32_t rng;
+    uint8_t address;
+    uint8_t settings[32][3];                                            //Last parameters of each set command (cmd & 0x1F).
+    uint8_t buffer[SIM_TAGS_MAX];                                       //Reads of each tag in the inventory buffer.
+    uint8_t flags[SIM_TAGS_MAX];                                        //Inventoried flag per session (bit s set: B).
+    uint32_t s1_ms[SIM_TAGS_MAX];                                       //When the S1 flag went to B.
+    sim_mask_t masks[MASK_MAX];
+
+    uint8_t out[SIM_FRAME_MAX];                                         //Frame being sent.
+    int out_len;
+    int out_pos;
+    uint64_t out_due_us;                                                //When its first byte is on the line.
+
+    uint8_t job;                                                        //Multi frame command being answered, 0: none.
+    ant_step_t seq[ANT_SEQ_LEN];
+    int step;
+    int round;
+    int repeat;
+    int tag;
+    int round_reads;                                                    //Reads in the current antenna round.
+    uint8_t session;                                                    //0x8B job: session, target and SL filter.
+    uint8_t target;
+    uint8_t sl;
+    uint8_t membank;                                                    //0x81 job: what to read, and the tags that answer.
+    uint8_t word_add;
+    uint8_t word_cnt;
+    uint16_t read_tags[SIM_TAGS_MAX];
+    uint8_t err_ant;                                                    //Antenna of the last SIM_ANT_MISSING.
+    uint64_t boot_us;                                                   //Last reboot.
+    uint8_t stored_dbm;                                                 //Output power in flash (0x76), back after a reboot.
+    uint32_t reads;                                                     //Reads so far (0x91: tags to report).
+    uint64_t job_start_us;
+    uint64_t next_us;                                                   //Time of the next frame of the job.
+
+    uint32_t commands;
+    uint32_t frames;
+    uint32_t corrupted;
+    uint32_t dropped;
+    uint32_t flash_writes;                                              //0x76 commands, each one a flash write on the Reader.
+
+}vm5f_sim_t;
+
+void vm5f_sim_init(vm5f_sim_t *sim, const vm5f_sim_config_t *cfg)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->cfg = *cfg;
+    if(sim->cfg.tags > SIM_TAGS_MAX)
+    {
+        sim->cfg.tags = SIM_TAGS_MAX;
+    }
+    if(sim->cfg.antennas < 1 || sim->cfg.antennas > 4)
+    {
+        sim->cfg.antennas = 1;
+    }
+    sim->rng = 0x12345678;
+    sim->address = SIM_ADDRESS;
+}
+
+static uint32_t sim_rand(vm5f_sim_t *sim)
+{
+    uint32_t x = sim->rng;                                              //xorshift32
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+    return x;
+}
+
+static inline uint32_t sim_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352D;
+    x ^= x >> 15;
+    x *= 0x846CA68B;
+    x ^= x >> 16;
+    return x;
+}
+
+//EPC length of tag i in bytes: 12, or 16, 32 or 62 for long_pct of the tags, 2 to 10 for short_pct of them.
+static int sim_epc_len(const vm5f_sim_t *sim, int i)
+{
+    static const uint8_t lengths[3] = { 16, 32, SIM_EPC_MAX };
+    static const uint8_t short_lengths[5] = { 2, 4, 6, 8, 10 };
+
+    if(((sim_hash(i) >> 8) % 100) < sim->cfg.long_pct)
+    {
+        return lengths[i % 3];
+    }
+    return ((sim_hash(i) >> 16) % 100) < sim->cfg.short_pct ? short_lengths[i % 5] : SIM_EPC_LEN;
+}
+
+//EPC of tag i: fixed prefix (a foreign one for foreign_pct of the tags), index, then a hash of the index.
+//A short EPC is hash bytes, then the index in 16 bits. Returns its length.
+static int sim_epc(const vm5f_sim_t *sim, int i, uint8_t *epc)
+{
+    static const uint8_t prefix[4] = { 0xE2, 0x80, 0x68, 0x94 };
+    static const uint8_t foreign[4] = { 0x30, 0x14, 0x25, 0x7B };       //SGTIN-96 of some retailer.
+    const uint32_t h = sim_hash(i);
+    const int len = sim_epc_len(sim, i);
+
+    if(len < SIM_EPC_LEN)
+    {
+        for(int b=0; b<len-2; b++)
+        {
+            epc[b] = (uint8_t) sim_hash(h + b);
+        }
+        epc[len - 2] = (uint8_t)(i >> 8);
+        epc[len - 1] = (uint8_t) i;
+        return len;
+    }
+    memcpy(epc, (h % 100) < sim->cfg.foreign_pct ? foreign : prefix, 4);
+    for(int b=0; b<4; b++)
+    {
+        epc[4 + b] = (uint8_t)(i >> (24 - 8 * b));
+        epc[8 + b] = (uint8_t)(h >> (24 - 8 * b));
+    }
+    for(int b=SIM_EPC_LEN; b<len; b++)
+    {
+        epc[b] = (uint8_t) sim_hash(h + b);
+    }
+    return len;
+}
+
+//PC word of an EPC of len bytes.
+static inline uint16_t sim_pc(int len)
+{
+    return (uint16_t)((len / 2) << 11);
+}
+
+//Bank membank of tag i, returns its size in bytes. The EPC bank is CRC, PC, EPC.
+static int sim_memory(const vm5f_sim_t *sim, int i, uint8_t membank, uint8_t *mem)
+{
+    const uint32_t h = sim_hash(i ^ 0x5A5A5A5A);
+
+    switch(membank)
+    {
+        case MEMBANK_RESERVED:
+            memset(mem, 0, 8);                                          //Kill and access password, not set.
+            return 8;
+
+        case MEMBANK_EPC:
+        {
+            const int len = sim_epc(sim, i, &mem[4]);
+            mem[0] = sim_hash(i) >> 8;                                  //Stand-in for the EPC CRC.
+            mem[1] = sim_hash(i);
+            mem[2] = sim_pc(len) >> 8;
+            mem[3] = sim_pc(len) & 0xFF;
+            return 4 + len;
+        }
+
+        case MEMBANK_TID:
+        {
+            static const uint8_t tid[6] = { 0xE2, 0x80, 0x11, 0x05, 0x80, 0x00 };  //Class, maker and model, XTID header.
+            memcpy(mem, tid, 6);
+            for(int b=0; b<4; b++)
+            {
+                mem[6 + b] = (uint8_t)(h >> (24 - 8 * b));
+            }
+            mem[10] = (uint8_t)(i >> 8);
+            mem[11] = (uint8_t) i;
+            return SIM_TID_LEN;
+        }
+
+        default:
+            for(int b=0; b<SIM_USER_LEN; b++)
+            {
+                mem[b] = (uint8_t)(i + b);
+            }
+            return SIM_USER_LEN;
+    }
+}
+
+//Tag index of a simulated EPC, -1 if it is not one.
+int vm5f_sim_tag_index(const vm5f_sim_t *sim, const uint8_t *epc, int len)
+{
+    uint8_t ref[SIM_EPC_MAX];
+
+    if(len < 2)
+    {
+        return -1;
+    }
+    const uint32_t i = len < SIM_EPC_LEN ? (epc[len - 2] << 8) | epc[len - 1] :
+                       ((uint32_t) epc[4] << 24) | (epc[5] << 16) | (epc[6] << 8) | epc[7];
+    if(i >= sim->cfg.tags || sim_epc(sim, i, ref) != len)
+    {
+        return -1;
+    }
+    return memcmp(ref, epc, len) == 0 ? (int) i : -1;
+}
+
+//Is tag i in the field at time ms? If so *since is set to when this visit began.
+int vm5f_sim_tag_present(const vm5f_sim_t *sim, int i, uint32_t ms, uint32_t *since)
+{
+    const uint32_t period = sim->cfg.dwell_ms + sim->cfg.gap_ms;
+    if(period == 0)
+    {
+        return 0;
+    }
+    const uint32_t phase = (ms + sim_hash(i + 1) % period) % period;
+    if(phase >= sim->cfg.dwell_ms)
+    {
+        return 0;
+    }
+    if(since != NULL)
+    {
+        *since = ms - phase;
+    }
+    return 1;
+}
+
+//Does tag i answer the running 0x8B job? Ages its S1 flag first.
+static int sim_tag_matches(vm5f_sim_t *sim, int i, uint32_t ms)
+{
+    const uint8_t bit = 1 << sim->session;
+
+    if((sim->sl == SL_ASSERTED && !(sim->flags[i] & SIM_FLAG_SL)) ||
+       (sim->sl == SL_DEASSERTED && (sim->flags[i] & SIM_FLAG_SL)))
+    {
+        return 0;
+    }
+    if(sim->session == SESSION_S1 && (sim->flags[i] & bit) && ms - sim->s1_ms[i] >= SIM_S1_PERSIST_MS)
+    {
+        sim->flags[i] &= ~bit;
+    }
+    return ((sim->flags[i] & bit) != 0) == sim->target;
+}
+
+static int sim_tag_read(vm5f_sim_t *sim, int i, uint8_t ant, uint64_t us)
+{
+    const uint32_t ms = (uint32_t)(us / 1000);
+
+    if((i % sim->cfg.antennas) != ant)
+    {
+        return 0;
+    }
+    if(!vm5f_sim_tag_present(sim, i, ms, NULL))
+    {
+        sim->flags[i] = 0;                                              //Unpowered: every flag back to A.
+        return 0;
+    }
+    if(sim->job == CMD_SESSION_INVENTORY && !sim_tag_matches(sim, i, ms))
+    {
+        return 0;
+    }
+    if((sim_rand(sim) % 100) >= sim->cfg.read_pct)
+    {
+        return 0;
+    }
+    if(sim->job == CMD_SESSION_INVENTORY)
+    {
+        sim->flags[i] ^= 1 << sim->session;
+        sim->s1_ms[i] = ms;
+    }
+    return 1;
+}
+
+//Gen2 Select of one mask over the population: EPC bank masks only, actions 0 to 7.
+static void sim_select(vm5f_sim_t *sim, const sim_mask_t *m)
+{
+    //Per action: what matching and other tags do. 1 assert, 2 deassert, 3 negate, 0 nothing.
+    static const uint8_t on_match[8] = { 1, 1, 0, 3, 2, 2, 0, 0 };
+    static const uint8_t on_other[8] = { 2, 0, 2, 0, 1, 0, 1, 3 };
+    const uint8_t bit = (m->target == MASK_TARGET_SL) ? SIM_FLAG_SL : (1 << m->target);
+    uint8_t epc[SIM_EPC_MAX];
+
+    for(int i=0; i<sim->cfg.tags; i++)
+    {
+        const int len = sim_epc(sim, i, epc);
+        int match = (m->membank == MEMBANK_EPC && m->start >= MASK_EPC_START &&
+                     m->start - MASK_EPC_START + m->bits <= len * 8);
+        for(int b=0; match && b<m->bits; b++)
+        {
+            const int e = m->start - MASK_EPC_START + b;
+            match = ((epc[e / 8] >> (7 - e % 8)) & 1) == ((m->mask[b / 8] >> (7 - b % 8)) & 1);
+        }
+        const uint8_t act = (match ? on_match : on_other)[m->action & 7];
+        //Asserted SL is a set bit, an asserted session flag is A: a clear bit.
+        const int assert = (bit == SIM_FLAG_SL) ? 1 : 0;
+        if(act == 1)
+        {
+            sim->flags[i] = assert ? (sim->flags[i] | bit) : (sim->flags[i] & ~bit);
+        }
+        else if(act == 2)
+        {
+            sim->flags[i] = assert ? (sim->flags[i] & ~bit) : (sim->flags[i] | bit);
+        }
+        else if(act == 3)
+        {
+            sim->flags[i] ^= bit;
+        }
+    }
+}
+
+//Run the Selects of every mask held, as the Reader does before an inventory.
+static void sim_select_all(vm5f_sim_t *sim)
+{
+    for(int n=0; n<MASK_MAX; n++)
+    {
+        if(sim->masks[n].used)
+        {
+            sim_select(sim, &sim->masks[n]);
+        }
+    }
+}
+
+//Stronger for low tag indexes, a little noise on top.
+static uint8_t sim_rssi(vm5f_sim_t *sim, int i)
+{
+    return 95 - (i * 40 / sim->cfg.tags) - (sim_rand(sim) % 4);
+}
+
+//Frequency channel and antenna byte of a tag read.
+static uint8_t sim_freq_ant(vm5f_sim_t *sim, uint8_t ant)
+{
+    return ((sim_rand(sim) % 7) << 2) | (ant & 0x03);
+}
+
+//Build the next frame to send, due at time due.
+static void sim_frame(vm5f_sim_t *sim, uint8_t cmd, const uint8_t *data, int n, uint64_t due)
+{
+    uint8_t sum = 0;
+
+    sim->out[0] = VM5F_HEAD;
+    sim->out[1] = n + 3;
+    sim->out[2] = sim->address;
+    sim->out[3] = cmd;
+    memcpy(&sim->out[4], data, n);
+    for(int i=0; i<n + 4; i++)
+    {
+        sum += sim->out[i];
+    }
+    sim->out[n + 4] = (uint8_t)(~sum + 1);
+    sim->out_len = n + 5;
+    sim->out_pos = 0;
+    sim->out_due_us = due + (sim->cfg.jitter_us ? sim_rand(sim) % sim->cfg.jitter_us : 0);
+    sim->frames++;
+    if(sim->cfg.corrupt_ppm && (sim_rand(sim) % 1000000) < sim->cfg.corrupt_ppm)
+    {
+        sim->out[1 + sim_rand(sim) % (sim->out_len - 1)] ^= 0x10;
+        sim->corrupted++;
+    }
+}
+
+//0x98: set, clear or list tag masks.
+static void sim_tag_mask(vm5f_sim_t *sim, const uint8_t *p, int np, uint64_t now)
+{
+    uint8_t d[8 + MASK_BITS_MAX / 8];
+    int count = 0;
+
+    for(int n=0; n<MASK_MAX; n++)
+    {
+        count += sim->masks[n].used;
+    }
+    if(np == 1 && p[0] == MASK_QUERY)
+    {
+        //One frame per mask, only the first is built here (it carries MaskCount), 0 0 without masks.
+        d[0] = 0;
+        d[1] = count;
+        for(int n=0; n<MASK_MAX; n++)
+        {
+            const sim_mask_t *m = &sim->masks[n];
+            if(m->used)
+            {
+                const int nbytes = (m->bits + 7) / 8;
+                d[0] = n + 1;
+                d[2] = m->target;
+                d[3] = m->action;
+                d[4] = m->membank;
+                d[5] = m->start;
+                d[6] = m->bits;
+                memcpy(&d[7], m->mask, nbytes);
+                d[7 + nbytes] = 0x00;
+                sim_frame(sim, CMD_TAG_MASK, d, 8 + nbytes, now + SIM_REPLY_US);
+                return;
+            }
+        }
+        sim_frame(sim, CMD_TAG_MASK, d, 2, now + SIM_REPLY_US);
+        return;
+    }
+    d[0] = RESP_SUCCESS;
+    if(np == 1 && p[0] <= MASK_MAX)
+    {
+        for(int n=0; n<MASK_MAX; n++)
+        {
+            if(p[0] == MASK_CLEAR_ALL || p[0] == n + 1)
+            {
+                sim->masks[n].used = 0;
+            }
+        }
+    }
+    else if(np >= 7 && p[0] >= 1 && p[0] <= MASK_MAX && p[5] > 0 && p[5] <= MASK_BITS_MAX && np == 7 + (p[5] + 7) / 8)
+    {
+        sim_mask_t *m = &sim->masks[p[0] - 1];
+        m->used = 1;
+        m->target = p[1];
+        m->action = p[2];
+        m->membank = p[3];
+        m->start = p[4];
+        m->bits = p[5];
+        memcpy(m->mask, &p[6], (p[5] + 7) / 8);
+    }
+    else
+    {
+        d[0] = RESP_FAIL;
+    }
+    sim_frame(sim, CMD_TAG_MASK, d, 1, now + SIM_REPLY_US);
+}
+
+//Next read of a running 0x89/0x8A/0x8B job: tag index, -1 when all rounds are done, SIM_ANT_MISSING
+//when a fast switch step is on a bad antenna.
+static int sim_next_read(vm5f_sim_t *sim)
+{
+    while(sim->repeat > 0)
+    {
+        const ant_step_t *st = &sim->seq[sim->step];
+        if(st->ant != ANTENNA_NONE && sim->round < st->stay)
+        {
+            if(sim->cfg.bad_ants & (1 << st->ant))
+            {
+                sim->err_ant = st->ant;
+                sim->round = st->stay;                                  //Nothing read there this sequence.
+                return SIM_ANT_MISSING;
+            }
+            while(sim->tag < sim->cfg.tags && (sim->cfg.slots == 0 || sim->round_reads < sim->cfg.slots))
+            {
+                const int i = sim->tag++;
+                if(sim_tag_read(sim, i, st->ant, sim->next_us))
+                {
+                    sim->round_reads++;
+                    return i;
+                }
+            }
+            sim->tag = 0;
+            sim->round_reads = 0;
+            sim->round++;
+            sim->next_us += sim->cfg.round_us;
+            continue;
+        }
+        sim->round = 0;
+        if(++sim->step == ANT_SEQ_LEN)
+        {
+            sim->step = 0;
+            sim->repeat--;
+        }
+    }
+    return -1;
+}
+
+//Produce the next frame of the job in progress, if any.
+static void sim_job_next(vm5f_sim_t *sim)
+{
+    uint8_t d[SIM_FRAME_MAX];
+
+    if(sim->job == CMD_REAL_TIME_INVENTORY || sim->job == CMD_FAST_SWITCH_INVENTORY || sim->job == CMD_SESSION_INVENTORY)
+    {
+        const int i = sim_next_read(sim);
+        if(i == SIM_ANT_MISSING)
+        {
+            //Fast switch only: Ant, ErrorCode, the round goes on.
+            d[0] = sim->err_ant;
+            d[1] = ERR_ANT_MISSING;
+            sim_frame(sim, sim->job, d, 2, sim->next_us);
+            return;
+        }
+        if(i >= 0)
+        {
+            //Freq/Ant, PC(2), EPC, RSSI.
+            const int len = sim_epc(sim, i, &d[3]);
+            d[0] = sim_freq_ant(sim, sim->seq[sim->step].ant);
+            d[1] = sim_pc(len) >> 8;
+            d[2] = sim_pc(len) & 0xFF;
+            d[3 + len] = sim_rssi(sim, i);
+            sim->next_us += sim->cfg.tag_us;
+            sim->reads++;
+            sim_frame(sim, sim->job, d, 4 + len, sim->next_us);
+            return;
+        }
+        //End of command: 0x89/0x8B AntID, ReadRate(2), TotalRead(4); 0x8A TotalRead(3), Duration(4).
+        const uint32_t ms = (uint32_t)((sim->next_us - sim->job_start_us) / 1000);
+        const uint32_t rate = ms ? sim->reads * 1000 / ms : sim->reads;
+        if(sim->job != CMD_FAST_SWITCH_INVENTORY)
+        {
+            const uint8_t end[7] = { sim->seq[0].ant, rate >> 8, rate, sim->reads >> 24, sim->reads >> 16, sim->reads >> 8, sim->reads };
+            memcpy(d, end, 7);
+        }
+        else
+        {
+            const uint8_t end[7] = { sim->reads >> 16, sim->reads >> 8, sim->reads, ms >> 24, ms >> 16, ms >> 8, ms };
+            memcpy(d, end, 7);
+        }
+        sim_frame(sim, sim->job, d, 7, sim->next_us);
+        sim->job = 0;
+        return;
+    }
+    if(sim->job == CMD_GET_RESET_INV_BUFFER)
+    {
+        while(sim->tag < sim->cfg.tags && sim->buffer[sim->tag] == 0)
+        {
+            sim->tag++;
+        }
+        if(sim->tag == sim->cfg.tags)
+        {
+            sim->job = 0;
+            return;
+        }
+        //TagCount(2), DataLen, PC(2)+EPC+CRC(2), RSSI, Freq/Ant, InvCount. Reported tags leave the buffer.
+        const int i = sim->tag++;
+        const int len = sim_epc(sim, i, &d[5]);
+        d[0] = sim->reads >> 8;                                         //Tags in the buffer when the read out started.
+        d[1] = sim->reads;
+        d[2] = 4 + len;
+        d[3] = sim_pc(len) >> 8;
+        d[4] = sim_pc(len) & 0xFF;
+        d[5 + len] = sim_hash(i) >> 8;                                  //Stand-in for the EPC CRC.
+        d[6 + len] = sim_hash(i);
+        d[7 + len] = sim_rssi(sim, i);
+        d[8 + len] = sim_freq_ant(sim, i % sim->cfg.antennas);
+        d[9 + len] = sim->buffer[i];
+        sim->next_us += SIM_REPLY_US / 4;
+        sim_frame(sim, sim->job, d, 10 + len, sim->next_us);
+        sim->buffer[i] = 0;
+        return;
+    }
+    if(sim->job == CMD_READ)
+    {
+        uint8_t mem[SIM_BANK_MAX];
+        if(sim->tag == (int) sim->reads)
+        {
+            sim->job = 0;
+            return;
+        }
+        //TagCount(2), DataLen, PC(2)+EPC+CRC(2)+Data, ReadLen, Freq/Ant, ReadCount.
+        const int i = sim->read_tags[sim->tag++];
+        const int len = sim_epc(sim, i, &d[5]);
+        const int nread = sim->word_cnt * 2;
+        sim_memory(sim, i, sim->membank, mem);
+        d[0] = sim->reads >> 8;
+        d[1] = sim->reads;
+        d[2] = 4 + len + nread;
+        d[3] = sim_pc(len) >> 8;
+        d[4] = sim_pc(len) & 0xFF;
+        d[5 + len] = sim_hash(i) >> 8;
+        d[6 + len] = sim_hash(i);
+        memcpy(&d[7 + len], &mem[sim->word_add * 2], nread);
+        d[7 + len + nread] = nread;
+        d[8 + len + nread] = sim_freq_ant(sim, i % sim->cfg.antennas);
+        d[9 + len + nread] = 1;
+        sim->next_us += SIM_READ_US;
+        sim_frame(sim, sim->job, d, 10 + len + nread, sim->next_us);
+    }
+}
+
+//0x81: one round on the work antenna picks the tags to read (each answers once), then their frames follow.
+static void sim_read_memory(vm5f_sim_t *sim, const uint8_t *p, int np, uint64_t now)
+{
+    uint8_t mem[SIM_BANK_MAX];
+    const uint8_t ant = sim->settings[CMD_SET_WORK_ANTENNA & 0x1F][0];
+    uint8_t d[1];
+
+    //MemBank, WordAdd, WordCnt, Password(4).
+    if(np < 3 || p[0] > MEMBANK_USER || p[2] == 0 || p[2] > READ_WORDS_MAX)
+    {
+        d[0] = RESP_FAIL;
+        sim_frame(sim, CMD_READ, d, 1, now + SIM_REPLY_US);
+        return;
+    }
+    sim->job = CMD_READ;
+    sim->membank = p[0];
+    sim->word_add = p[1];
+    sim->word_cnt = p[2];
+    sim->reads = 0;
+    sim->tag = 0;
+    sim->next_us = now + sim->cfg.round_us;
+    for(int i=0; i<sim->cfg.tags && (sim->cfg.slots == 0 || (int) sim->reads < sim->cfg.slots); i++)
+    {
+        //A tag whose bank ends before the last word asked for does not answer.
+        if((sim->word_add + sim->word_cnt) * 2 <= sim_memory(sim, i, sim->membank, mem) &&
+           sim_tag_read(sim, i, ant, sim->next_us))
+        {
+            sim->read_tags[sim->reads++] = i;
+        }
+    }
+    if(sim->reads == 0)
+    {
+        sim->job = 0;
+        d[0] = SIM_ERR_NO_TAG;
+        sim_frame(sim, CMD_READ, d, 1, sim->next_us);
+        return;
+    }
+    sim_job_next(sim);
+}
+
+//0x80: run the rounds on the work antenna into the buffer, answer once they are done.
+static void sim_inventory_buffered(vm5f_sim_t *sim, uint8_t rounds, uint64_t now)
+{
+    const uint8_t ant = sim->settings[CMD_SET_WORK_ANTENNA & 0x1F][0];
+    uint64_t t = now;
+    uint32_t reads = 0;
+    int count = 0;
+
+    for(int r=0; r<rounds; r++)
+    {
+        int round_reads = 0;
+        t += sim->cfg.round_us;
+        for(int i=0; i<sim->cfg.tags && (sim->cfg.slots == 0 || round_reads < sim->cfg.slots); i++)
+        {
+            if(sim_tag_read(sim, i, ant, t))
+            {
+                if(sim->buffer[i] < 0xFF)
+                {
+                    sim->buffer[i]++;
+                }
+                t += sim->cfg.tag_us;
+                reads++;
+                round_reads++;
+            }
+        }
+    }
+    for(int i=0; i<sim->cfg.tags; i++)
+    {
+        count += (sim->buffer[i] != 0);
+    }
+    const uint32_t ms = (uint32_t)((t - now) / 1000);
+    const uint32_t rate = ms ? reads * 1000 / ms : reads;
+    //AntID, TagCount(2), ReadRate(2), TotalRead(4).
+    const uint8_t d[9] = { ant, count >> 8, count, rate >> 8, rate, reads >> 24, reads >> 16, reads >> 8, reads };
+    sim_frame(sim, CMD_INVENTORY, d, sizeof(d), t);
+}
+
+//Set command and its get command, and the number of parameter bytes.
+static int sim_setting(uint8_t cmd, int *get)
+{
+    switch(cmd)
+    {
+        case CMD_SET_ANT_DETECT:    case CMD_GET_ANT_DETECT:    *get = (cmd == CMD_GET_ANT_DETECT);    return 1;
+        case CMD_SET_WORK_ANTENNA:  case CMD_GET_WORK_ANTENNA:  *get = (cmd == CMD_GET_WORK_ANTENNA);  return 1;
+        case CMD_SET_OUTPUT_POWER:  case CMD_GET_OUTPUT_POWER:  *get = (cmd == CMD_GET_OUTPUT_POWER);  return 1;
+        case CMD_SET_FREQ_REGION:   case CMD_GET_FREQ_REGION:   *get = (cmd == CMD_GET_FREQ_REGION);   return 3;
+        case CMD_SET_DRM:           case CMD_GET_DRM:           *get = (cmd == CMD_GET_DRM);           return 1;
+        case CMD_SET_BAUD_RATE:     *get = 0;                                                          return 1;
+        default:                    return 0;
+    }
+}
+
+//Reboot: settings written and tag masks are gone.
+static void sim_reboot(vm5f_sim_t *sim, uint64_t now)
+{
+    memset(sim->settings, 0, sizeof(sim->settings));
+    memset(sim->masks, 0, sizeof(sim->masks));
+    sim->settings[CMD_SET_OUTPUT_POWER & 0x1F][0] = sim->stored_dbm;
+    sim->boot_us = now;
+}
+
+//Temperature (C): temp_c, warmer with output power.
+static int sim_temperature(const vm5f_sim_t *sim)
+{
+    const int dbm = sim->settings[CMD_SET_OUTPUT_POWER & 0x1F][0];
+    return sim->cfg.temp_c + (dbm > POWER_MIN_DBM ? dbm - POWER_MIN_DBM : 0);
+}
+
+//Take one command frame from the firmware. Frames with a bad checksum are ignored, like the Reader does.
+static void sim_command(vm5f_sim_t *sim, const uint8_t *f, int len, uint64_t now)
+{
+    const uint8_t cmd = f[3];
+    const uint8_t *p = &f[4];
+    const int np = len - 5;
+    uint8_t d[8];
+    int get;
+
+    sim->commands++;
+    sim->job = 0;                                                       //A new command ends the one running.
+    sim->out_len = 0;
+    sim->out_pos = 0;
+    if(sim->cfg.reset_ms && now - sim->boot_us >= sim->cfg.reset_ms * 1000ULL)
+    {
+        sim_reboot(sim, now);
+    }
+
+    const int ns = sim_setting(cmd, &get);
+    if(ns > 0)
+    {
+        const int slot = (get ? cmd - 1 : cmd) & 0x1F;                  //Every get code is its set code + 1.
+        if(get)
+        {
+            sim_frame(sim, cmd, sim->settings[slot], ns, now + SIM_REPLY_US);
+            return;
+        }
+        memcpy(sim->settings[slot], p, np < ns ? np : ns);
+        if(cmd == CMD_SET_OUTPUT_POWER)
+        {
+            sim->stored_dbm = p[0];
+            sim->flash_writes++;
+        }
+        d[0] = RESP_SUCCESS;
+        sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+        return;
+    }
+
+    switch(cmd)
+    {
+        case CMD_SET_TEMP_OUTPUT_POWER:
+            sim->settings[CMD_SET_OUTPUT_POWER & 0x1F][0] = p[0];       //Read back by 0x77, not stored.
+            d[0] = RESP_SUCCESS;
+            sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+            return;
+
+        case CMD_RESET:
+            sim_reboot(sim, now);                                       //No answer.
+            return;
+
+        case CMD_GET_READER_TEMP:
+        {
+            const int t = sim_temperature(sim) + (int)(sim_rand(sim) % 3) - 1;
+            d[0] = (t >= 0);
+            d[1] = t >= 0 ? t : -t;
+            sim_frame(sim, cmd, d, 2, now + SIM_REPLY_US);
+            return;
+        }
+
+        case CMD_GET_RETURN_LOSS:
+        {
+            const uint8_t ant = sim->settings[CMD_SET_WORK_ANTENNA & 0x1F][0];
+            d[0] = (sim->cfg.bad_ants & (1 << ant)) ? 3 + sim_rand(sim) % 3 : 16 + sim_rand(sim) % 6;
+            sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US * 4);
+            return;
+        }
+
+        case CMD_GET_FIRMWARE:
+            d[0] = SIM_FW_MAJOR;
+            d[1] = SIM_FW_MINOR;
+            sim_frame(sim, cmd, d, 2, now + SIM_REPLY_US);
+            return;
+
+        case CMD_SET_READER_ADDRESS:
+            sim->address = p[0];
+            d[0] = RESP_SUCCESS;
+            sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+            return;
+
+        case CMD_REAL_TIME_INVENTORY:
+        case CMD_FAST_SWITCH_INVENTORY:
+        case CMD_SESSION_INVENTORY:
+            if(cmd == CMD_SESSION_INVENTORY)
+            {
+                //Session, Target, [SL,] Repeat.
+                if(np < 3 || p[0] > SESSION_S3 || p[1] > TARGET_B)
+                {
+                    d[0] = RESP_FAIL;
+                    sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+                    return;
+                }
+                sim->session = p[0];
+                sim->target = p[1];
+                sim->sl = np >= 4 ? p[2] : SL_ANY;
+                if(sim->session == SESSION_S0)
+                {
+                    for(int i=0; i<sim->cfg.tags; i++)
+                    {
+                        sim->flags[i] &= ~1;                            //Carrier was off between commands.
+                    }
+                }
+            }
+            if(cmd != CMD_FAST_SWITCH_INVENTORY)
+            {
+                sim->seq[0].ant = sim->settings[CMD_SET_WORK_ANTENNA & 0x1F][0];
+                sim->seq[0].stay = np > 0 ? p[np - 1] : 1;
+                for(int i=1; i<ANT_SEQ_LEN; i++)
+                {
+                    sim->seq[i].ant = ANTENNA_NONE;
+                    sim->seq[i].stay = 0;
+                }
+                sim->repeat = 1;
+            }
+            else
+            {
+                for(int i=0; i<ANT_SEQ_LEN; i++)
+                {
+                    sim->seq[i].ant = p[2 * i];
+                    sim->seq[i].stay = p[2 * i + 1];
+                }
+                sim->repeat = p[9];
+            }
+            if(cmd != CMD_FAST_SWITCH_INVENTORY && (sim->cfg.bad_ants & (1 << sim->seq[0].ant)))
+            {
+                d[0] = ERR_ANT_MISSING;
+                sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+                return;
+            }
+            sim_select_all(sim);
+            sim->job = cmd;
+            sim->step = 0;
+            sim->round = 0;
+            sim->tag = 0;
+            sim->round_reads = 0;
+            sim->reads = 0;
+            sim->job_start_us = now;
+            sim->next_us = now + sim->cfg.round_us;
+            sim_job_next(sim);
+            return;
+
+        case CMD_INVENTORY:
+            if(sim->cfg.bad_ants & (1 << sim->settings[CMD_SET_WORK_ANTENNA & 0x1F][0]))
+            {
+                d[0] = ERR_ANT_MISSING;
+                sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+                return;
+            }
+            sim_select_all(sim);
+            sim_inventory_buffered(sim, np > 0 ? p[0] : 1, now);
+            return;
+
+        case CMD_TAG_MASK:
+            sim_tag_mask(sim, p, np, now);
+            return;
+
+        case CMD_READ:
+            sim_read_memory(sim, p, np, now);
+            return;
+
+        case CMD_GET_RESET_INV_BUFFER:
+            sim->tag = 0;
+            sim->reads = 0;
+            sim->next_us = now;
+            for(int i=0; i<sim->cfg.tags; i++)
+            {
+                sim->reads += (sim->buffer[i] != 0);
+            }
+            if(sim->reads > 0)
+            {
+                sim->job = cmd;
+                sim_job_next(sim);
+                return;
+            }
+            d[0] = SIM_ERR_NO_BUFFER;
+            sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+            return;
+
+        default:
+            d[0] = RESP_FAIL;
+            sim_frame(sim, cmd, d, 1, now + SIM_REPLY_US);
+            return;
+    }
+}
+
+//Bytes written by the firmware. Whole frames are expected (vm5f_send writes one frame per call).
+int vm5f_sim_write(vm5f_sim_t *sim, const uint8_t *data, int len, uint64_t now_us)
+{
+    int pos = 0;
+
+    while(pos + 5 <= len)
+    {
+        const int n = data[pos + 1] + 2;
+        if(data[pos] != VM5F_HEAD || pos + n > len)
+        {
+            break;
+        }
+        uint8_t sum = 0;
+        for(int i=0; i<n; i++)
+        {
+            sum += data[pos + i];
+        }
+        if(sum == 0)
+        {
+            sim_command(sim, &data[pos], n, now_us);
+        }
+        pos += n;
+    }
+    return len;
+}
+
+//Bytes the Reader has put on the line by now_us, up to max.
+int vm5f_sim_read(vm5f_sim_t *sim, uint8_t *buf, int max, uint64_t now_us)
+{
+    int n = 0;
+
+    while(n < max)
+    {
+        if(sim->out_pos == sim->out_len)
+        {
+            sim->out_len = 0;
+            sim->out_pos = 0;
+            sim_job_next(sim);
+            if(sim->out_len == 0)
+            {
+                break;
+            }
+        }
+        if(sim->out_due_us > now_us)
+        {
+            break;
+        }
+        const uint8_t b = sim->out[sim->out_pos++];
+        if(sim->cfg.drop_ppm && (sim_rand(sim) % 1000000) < sim->cfg.drop_ppm)
+        {
+            sim->dropped++;
+            continue;
+        }
+        buf[n++] = b;
+    }
+    return n;
+}
+
+//Time the next byte is due, SIM_NEVER when nothing is pending.
+uint64_t vm5f_sim_next_due(vm5f_sim_t *sim)
+{
+    if(sim->out_pos == sim->out_len)
+    {
+        sim->out_len = 0;
+        sim->out_pos = 0;
+        sim_job_next(sim);
+        if(sim->out_len == 0)
+        {
+            return SIM_NEVER;
+        }
+    }
+    return sim->out_due_us;
+}
@@ -0,0 +1,77 @@
+/*
+    Single producer, single consumer ring of fixed size records, lock-free.
+
+    Carries decoded tag reads from the receive task on the I/O core to the tag task on the
+    policy core. Only the producer writes head and only the consumer writes tail, so neither
+    side takes a lock or masks interrupts. A memory barrier between copying a record and
+    moving the index makes the record visible to the other core before the index says so.
+    A push on a full ring fails and is counted, the producer never waits.
+    Only uses standard C and GCC builtins.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+//SPSC Ring.
+typedef struct spsc_ring
+{
+    uint8_t *buf;
+    uint32_t rec_size;
+    uint32_t mask;                                                      //Records - 1, records is a power of 2.
+    volatile uint32_t head;                                             //Next record to write, producer only.
+    volatile uint32_t tail;                                             //Next record to read, consumer only.
+    uint32_t dropped;                                                   //Pushes on a full ring, producer only.
+    uint32_t high_water;                                                //Most records waiting at once, producer only.
+
+}spsc_ring_t;
+
+//buf holds records * rec_size bytes, records must be a power of 2.
+void spsc_init(spsc_ring_t *ring, void *buf, uint32_t rec_size, uint32_t records)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->buf = buf;
+    ring->rec_size = rec_size;
+    ring->mask = records - 1;
+}
+
+static inline uint32_t spsc_count(const spsc_ring_t *ring)
+{
+    return ring->head - ring->tail;
+}
+
+//Producer: copy a record in. Returns 0 when the ring is full.
+static inline int spsc_push(spsc_ring_t *ring, const void *rec)
+{
+    const uint32_t head = ring->head;
+    const uint32_t used = head - ring->tail;
+
+    if(used > ring->mask)
+    {
+        ring->dropped++;
+        return 0;
+    }
+    memcpy(&ring->buf[(head & ring->mask) * ring->rec_size], rec, ring->rec_size);
+    __sync_synchronize();                                               //Record written before head moves.
+    ring->head = head + 1;
+    if(used + 1 > ring->high_water)
+    {
+        ring->high_water = used + 1;
+    }
+    return 1;
+}
+
+//Consumer: copy the oldest record out. Returns 0 when the ring is empty.
+static inline int spsc_pop(spsc_ring_t *ring, void *rec)
+{
+    const uint32_t tail = ring->tail;
+
+    if(ring->head == tail)
+    {
+        return 0;
+    }
+    __sync_synchronize();                                               //head read before the record.
+    memcpy(rec, &ring->buf[(tail & ring->mask) * ring->rec_size], ring->rec_size);
+    __sync_synchronize();                                               //Record read before the slot is given back.
+    ring->tail = tail + 1;
+    return 1;
+}
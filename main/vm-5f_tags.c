@@ -0,0 +1,216 @@
+/*
+    Tag table: aggregates reads per EPC, so one tag in the field gives one "arrived" and one
+    "departed" event instead of a stream of reads.
+
+    Fixed capacity open addressing hash table (linear probing, backward shift delete), so an
+    update is constant time and nothing is allocated. Per tag it keeps first/last seen time,
+    read count, RSSI min/max/sum, last antenna and frequency.
+
+    A tag arrives on its first read and departs after expiry_ms without a read. After departing
+    it stays in the table for holdoff_ms; reads in that window do not raise a new arrival until
+    the hold-off is over, so a tag flickering at the edge of the field does not re-trigger.
+    Only uses standard C.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef TAG_EPC_MAX
+#define TAG_EPC_MAX         62                                          //Longest EPC kept, in bytes (496 bits, the Gen2 limit).
+#endif
+#define TAG_TABLE_SIZE      512                                         //Power of 2, keep at least 2x the tags expected at once.
+#define TAG_TABLE_MASK      (TAG_TABLE_SIZE - 1)
+#define TAG_EXPIRY_MS       1000                                        //No read for this long: departed.
+#define TAG_HOLDOFF_MS      2000                                        //Quiet time after departure before a new arrival.
+
+#define TAG_EMPTY           0
+#define TAG_PRESENT         1
+#define TAG_GONE            2                                           //Departed, in hold-off.
+
+#define TAG_ARRIVED         1
+#define TAG_DEPARTED        2
+
+//Tag Table Entry.
+typedef struct tag_entry
+{
+    uint8_t epc[TAG_EPC_MAX];
+    uint8_t epc_len;
+    uint8_t state;
+    uint8_t ant;
+    uint8_t freq;
+    uint8_t rssi_min;
+    uint8_t rssi_max;
+    uint16_t pc;
+    uint32_t rssi_sum;
+    uint32_t count;
+    uint32_t first_ms;
+    uint32_t last_ms;
+    uint32_t departed_ms;
+    uint32_t hash;
+
+}tag_entry_t;
+
+//Tag Table.
+typedef struct tag_table
+{
+    tag_entry_t slots[TAG_TABLE_SIZE];
+    uint32_t used;
+    uint32_t expiry_ms;
+    uint32_t holdoff_ms;
+    uint32_t full;                                                      //Reads of new tags dropped, table full.
+
+}tag_table_t;
+
+//Called for every arrival and departure.
+typedef void (*tag_event_cb_t)(const tag_entry_t *entry, int event, void *ctx);
+
+void tag_table_init(tag_table_t *table, uint32_t expiry_ms, uint32_t holdoff_ms)
+{
+    memset(table, 0, sizeof(*table));
+    table->expiry_ms = expiry_ms;
+    table->holdoff_ms = holdoff_ms;
+}
+
+static inline uint32_t tag_hash(const uint8_t *epc, int len)
+{
+    uint32_t h = 2166136261u;
+    for(int i=0; i<len; i++)
+    {
+        h = (h ^ epc[i]) * 16777619u;
+    }
+    return h;
+}
+
+//Start a fresh presence period for an entry.
+static void tag_entry_start(tag_entry_t *e, uint32_t now)
+{
+    e->state = TAG_PRESENT;
+    e->first_ms = now;
+    e->count = 0;
+    e->rssi_sum = 0;
+    e->rssi_min = 0xFF;
+    e->rssi_max = 0;
+}
+
+static void tag_entry_add(tag_entry_t *e, uint16_t pc, uint8_t ant, uint8_t freq, uint8_t rssi, uint32_t count, uint32_t now)
+{
+    e->pc = pc;
+    e->ant = ant;
+    e->freq = freq;
+    e->count += count;
+    e->rssi_sum += (uint32_t) rssi * count;
+    if(rssi < e->rssi_min)
+    {
+        e->rssi_min = rssi;
+    }
+    if(rssi > e->rssi_max)
+    {
+        e->rssi_max = rssi;
+    }
+    e->last_ms = now;
+}
+
+//Record count reads of an EPC. Returns TAG_ARRIVED when this read makes the tag arrive, 0 otherwise.
+//*entry is set to the tag's entry (NULL if the table is full).
+int tag_table_update(tag_table_t *table, const uint8_t *epc, int len, uint16_t pc, uint8_t ant,
+                     uint8_t freq, uint8_t rssi, uint32_t count, uint32_t now, const tag_entry_t **entry)
+{
+    if(len > TAG_EPC_MAX)
+    {
+        len = TAG_EPC_MAX;
+    }
+    const uint32_t h = tag_hash(epc, len);
+    uint32_t idx = h & TAG_TABLE_MASK;
+
+    *entry = NULL;
+    while(table->slots[idx].state != TAG_EMPTY)
+    {
+        tag_entry_t *e = &table->slots[idx];
+        if(e->hash == h && e->epc_len == len && memcmp(e->epc, epc, len) == 0)
+        {
+            *entry = e;
+            if(e->state == TAG_GONE && (int32_t)(e->last_ms - e->departed_ms) <= 0)
+            {
+                tag_entry_start(e, now);                                //Back during hold-off, the sweep raises the arrival.
+                e->state = TAG_GONE;
+            }
+            tag_entry_add(e, pc, ant, freq, rssi, count, now);
+            return 0;
+        }
+        idx = (idx + 1) & TAG_TABLE_MASK;
+    }
+
+    if(table->used >= TAG_TABLE_SIZE - TAG_TABLE_SIZE / 8)
+    {
+        table->full++;                                                  //Keep probe chains short.
+        return 0;
+    }
+    tag_entry_t *e = &table->slots[idx];
+    memcpy(e->epc, epc, len);
+    e->epc_len = len;
+    e->hash = h;
+    tag_entry_start(e, now);
+    tag_entry_add(e, pc, ant, freq, rssi, count, now);
+    table->used++;
+    *entry = e;
+    return TAG_ARRIVED;
+}
+
+//Remove the entry at idx and shift the rest of its probe chain back (no tombstones needed).
+static void tag_table_remove(tag_table_t *table, uint32_t idx)
+{
+    uint32_t hole = idx;
+    uint32_t next = (idx + 1) & TAG_TABLE_MASK;
+
+    while(table->slots[next].state != TAG_EMPTY)
+    {
+        uint32_t home = table->slots[next].hash & TAG_TABLE_MASK;
+        //Move next into the hole unless its home lies cyclically in (hole, next].
+        if(((next - home) & TAG_TABLE_MASK) >= ((next - hole) & TAG_TABLE_MASK))
+        {
+            table->slots[hole] = table->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & TAG_TABLE_MASK;
+    }
+    table->slots[hole].state = TAG_EMPTY;
+    table->used--;
+}
+
+//Walk the table: raise departures after expiry_ms without reads, end hold-offs (a tag read again
+//during its hold-off arrives anew) and free entries that are gone for good.
+void tag_table_sweep(tag_table_t *table, uint32_t now, tag_event_cb_t cb, void *ctx)
+{
+    uint32_t idx = 0;
+
+    while(idx < TAG_TABLE_SIZE)
+    {
+        tag_entry_t *e = &table->slots[idx];
+        if(e->state == TAG_PRESENT && (now - e->last_ms) >= table->expiry_ms)
+        {
+            e->state = TAG_GONE;
+            e->departed_ms = now;
+            cb(e, TAG_DEPARTED, ctx);
+        }
+        else if(e->state == TAG_GONE && (now - e->departed_ms) >= table->holdoff_ms)
+        {
+            if((int32_t)(e->last_ms - e->departed_ms) > 0 && (now - e->last_ms) < table->expiry_ms)
+            {
+                e->state = TAG_PRESENT;
+                cb(e, TAG_ARRIVED, ctx);
+            }
+            else
+            {
+                tag_table_remove(table, idx);
+                continue;                                               //Something may have moved into idx.
+            }
+        }
+        idx++;
+    }
+}
+
+//Mean RSSI over the reads of the current presence period.
+static inline uint8_t tag_entry_rssi_mean(const tag_entry_t *e)
+{
+    return e->count ? (uint8_t)(e->rssi_sum / e->count) : 0;
+}
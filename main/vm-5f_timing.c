@@ -0,0 +1,151 @@
+/*
+    Hot path timing: where the time goes between an inventory command and the relay.
+
+    Stages are stamped with esp_timer (microseconds, one clock for both cores, unlike CCOUNT)
+    and the time between two stages goes into a fixed log2 bucket histogram: bucket 0 holds
+    0-1 us, bucket k holds 2^k to 2^(k+1)-1 us, the last one everything longer. Recording is a
+    count leading zeros and three adds, each histogram has a single writer task. Histograms come
+    in pairs: the writer fills the one timing_active points at, timing_report() swaps it and
+    reads the other once the writer is out of it, so no sample is lost or counted half.
+
+    Built in unless NDEBUG is set (release builds) or VM5F_TIMING is 0; then the TIMING_* macros
+    below expand to nothing and no stamps are kept.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef VM5F_TIMING
+#ifdef NDEBUG
+#define VM5F_TIMING 0
+#else
+#define VM5F_TIMING 1
+#endif
+#endif
+
+#if VM5F_TIMING
+#include "esp_timer.h"
+
+#define TIMING_BUCKETS      21                                          //Up to 2^20 us (about 1 s) and over.
+
+//Measured intervals.
+#define TIMING_CMD_TO_RX        0                                       //Inventory command sent -> first byte of the answer.
+#define TIMING_RX_TO_FRAME      1                                       //Bytes read -> frame complete and checksum OK.
+#define TIMING_FRAME_TO_QUEUE   2                                       //Checksum OK -> arrival queued for gpio_task.
+#define TIMING_QUEUE_TO_RECV    3                                       //Queued -> received by gpio_task.
+#define TIMING_RECV_TO_RELAY    4                                       //Received -> relay switched.
+#define TIMING_CMD_TO_RELAY     5                                       //Command of the round that saw the tag -> relay.
+#define TIMING_STOP_TO_DOOR     6                                       //STOP edge interrupt -> handled by gpio_task.
+#define TIMING_READ_HANDOFF     7                                       //Frame complete -> read taken by tag_task (crosses cores).
+#define TIMING_COUNT            8
+
+//Timing Histogram.
+typedef struct timing_hist
+{
+    uint32_t bucket[TIMING_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+
+}timing_hist_t;
+
+static const char * const timing_names[TIMING_COUNT] =
+{
+    "cmd->rx", "rx->frame", "frame->queue", "queue->recv", "recv->relay", "cmd->relay", "stop->door", "read handoff",
+};
+
+static timing_hist_t timing_hist[TIMING_COUNT][2];
+static volatile uint8_t timing_active[TIMING_COUNT];                    //Half being filled, swapped by timing_report().
+static volatile uint32_t timing_busy[TIMING_COUNT];                     //Odd while the writer is in timing_record().
+
+static inline void timing_record(int h, uint32_t start_us, uint32_t end_us)
+{
+    timing_busy[h]++;
+    __sync_synchronize();                                               //Busy before the half is picked.
+    timing_hist_t *t = &timing_hist[h][timing_active[h]];
+    const uint32_t us = end_us - start_us;
+    int k = 31 - __builtin_clz(us | 1);
+
+    if(k >= TIMING_BUCKETS)
+    {
+        k = TIMING_BUCKETS - 1;
+    }
+    t->bucket[k]++;
+    t->count++;
+    t->sum_us += us;
+    if(us > t->max_us)
+    {
+        t->max_us = us;
+    }
+    __sync_synchronize();
+    timing_busy[h]++;
+}
+
+//Upper bound (us) of the bucket holding the given fraction (per mille) of the samples.
+static uint32_t timing_percentile(const timing_hist_t *t, uint32_t permille)
+{
+    const uint32_t want = (uint32_t)(((uint64_t) t->count * permille + 999) / 1000);
+    uint32_t seen = 0;
+
+    for(int k=0; k<TIMING_BUCKETS; k++)
+    {
+        seen += t->bucket[k];
+        if(seen >= want)
+        {
+            const uint32_t top = (2u << k) - 1;
+            return (k == TIMING_BUCKETS - 1 || top > t->max_us) ? t->max_us : top;
+        }
+    }
+    return t->max_us;
+}
+
+//Take the samples of histogram h recorded so far and start it over, while its writer keeps going.
+static void timing_take(int h, timing_hist_t *t)
+{
+    const int old = timing_active[h];
+
+    timing_active[h] = old ^ 1;                                         //Later records go to the other half.
+    __sync_synchronize();
+    while(timing_busy[h] & 1)
+    {
+        //A record that picked the old half before the swap, a few instructions.
+    }
+    *t = timing_hist[h][old];
+    memset(&timing_hist[h][old], 0, sizeof(timing_hist[h][old]));
+}
+
+//Print every histogram that has samples, then start over.
+void timing_report()
+{
+    for(int h=0; h<TIMING_COUNT; h++)
+    {
+        timing_hist_t t;
+        timing_take(h, &t);
+        if(t.count == 0)
+        {
+            continue;
+        }
+        printf("timing %-12s n %u, mean %u us, p50 <= %u us, p99 <= %u us, max %u us, buckets:",
+               timing_names[h], t.count, (uint32_t)(t.sum_us / t.count),
+               timing_percentile(&t, 500), timing_percentile(&t, 990), t.max_us);
+        for(int k=0; k<TIMING_BUCKETS; k++)
+        {
+            if(t.bucket[k])
+            {
+                printf(" %u:%u", k ? (1u << k) : 0, t.bucket[k]);
+            }
+        }
+        printf(" \n");
+    }
+}
+
+#define TIMING_NOW()                    ((uint32_t) esp_timer_get_time())
+#define TIMING_STAMP(var)               ((var) = TIMING_NOW())
+#define TIMING_RECORD(h, start, end)    timing_record((h), (start), (end))
+#define TIMING_REPORT()                 timing_report()
+#else
+#define TIMING_STAMP(var)               do { } while(0)
+#define TIMING_RECORD(h, start, end)    do { } while(0)
+#define TIMING_REPORT()                 do { } while(0)
+#endif
@@ -0,0 +1,137 @@
+#!/usr/bin/env python
+"""
+Build an EPC allowlist image for the allow_a/allow_b flash partitions.
+
+Input: text file, one EPC per line in hex (spaces allowed, '#' starts a comment).
+Output: binary image as read by main/vm-5f_allowlist.c.
+
+    python tools/allowlist_build.py badges.txt allowlist.bin --generation 7
+    esptool.py write_flash 0x110000 allowlist.bin        # allow_a, see partitions.csv
+
+Write the image to the partition not in use, or use a higher generation than the one
+running, so the firmware picks it up at the next boot.
+
+Or send it over the console to the running firmware, which writes the partition not in use
+and switches to the new list without a reboot (needs pyserial):
+
+    python tools/allowlist_build.py badges.txt allowlist.bin --generation 8 --port /dev/ttyUSB0
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x4C414D56
+VERSION = 1
+HEADER_SIZE = 32
+MAX_LOAD = 0.7
+MAX_PROBES = 64
+UPLOAD_CMD = b'A'
+ERASE_TIMEOUT = 30                                      # s, a 768 KB partition erase takes seconds
+
+
+def fnv1a(epc, seed):
+    h = 2166136261 ^ seed
+    for b in bytearray(epc):
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def read_epcs(path, epc_len):
+    epcs = set()
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split('#', 1)[0].replace(' ', '').strip()
+            if not line:
+                continue
+            epc = bytes(bytearray.fromhex(line))
+            if len(epc) != epc_len:
+                sys.exit('%s:%d: EPC is %d bytes, expected %d' % (path, n, len(epc), epc_len))
+            if epc == b'\0' * epc_len:
+                sys.exit('%s:%d: all-zero EPC marks an empty slot and can not be listed' % (path, n))
+            epcs.add(epc)
+    return sorted(epcs)
+
+
+def build(epcs, epc_len, generation, seed):
+    slot_count = int(max(len(epcs), 1) / MAX_LOAD) + 1
+    slots = [None] * slot_count
+    for epc in epcs:
+        idx = (fnv1a(epc, seed) * slot_count) >> 32
+        for probe in range(MAX_PROBES):
+            if slots[idx] is None:
+                slots[idx] = epc
+                break
+            idx = (idx + 1) % slot_count
+        else:
+            return None
+    empty = b'\0' * epc_len
+    body = b''.join(s if s is not None else empty for s in slots)
+    head = struct.pack('<IHBBIIII', MAGIC, VERSION, epc_len, 0, generation, slot_count, len(epcs), seed)
+    head += struct.pack('<I', zlib.crc32(body) & 0xFFFFFFFF)
+    head += struct.pack('<I', zlib.crc32(head) & 0xFFFFFFFF)
+    assert len(head) == HEADER_SIZE
+    return head + body
+
+
+def upload_answer(ser, timeout):
+    """Next '#A' line from the console, other output is skipped."""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        line = ser.readline().decode('ascii', 'replace').strip()
+        if line.startswith('#A'):
+            if line.startswith('#A error'):
+                sys.exit('upload failed: %s' % line[3:])
+            return line.split()
+    sys.exit('no answer from the firmware')
+
+
+def upload(port, baud, image, timeout):
+    """Send an image to the firmware's allowlist upload command, return the active generation."""
+    import serial
+    ser = serial.Serial(port, baud, timeout=0.2)
+    ser.reset_input_buffer()
+    ser.write(UPLOAD_CMD)
+    upload_answer(ser, timeout)                         # ready
+    ser.write(struct.pack('<I', len(image)))
+    chunk = int(upload_answer(ser, ERASE_TIMEOUT)[2])   # go <chunk>, after the partition erase
+    for pos in range(0, len(image), chunk):
+        ser.write(image[pos:pos + chunk])
+        upload_answer(ser, timeout)                     # ok <bytes>
+    generation = int(upload_answer(ser, timeout)[2])    # done <generation>
+    ser.close()
+    return generation
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('epcs', help='text file, one hex EPC per line')
+    ap.add_argument('output', help='image file to write')
+    ap.add_argument('--generation', type=int, default=1, help='image generation, the newest valid one is used')
+    ap.add_argument('--epc-len', type=int, default=12, help='EPC length in bytes (default 12, 96 bit)')
+    ap.add_argument('--partition-size', type=lambda v: int(v, 0), default=0xC0000, help='partition size to check against')
+    ap.add_argument('--port', help='serial port of the door controller, upload the image to it')
+    ap.add_argument('--baud', type=int, default=115200, help='console baud rate')
+    ap.add_argument('--timeout', type=float, default=5, help='wait for each answer of the firmware (s)')
+    args = ap.parse_args()
+
+    epcs = read_epcs(args.epcs, args.epc_len)
+    for seed in range(256):
+        image = build(epcs, args.epc_len, args.generation, seed)
+        if image is not None:
+            break
+    else:
+        sys.exit('could not place all EPCs within %d probes' % MAX_PROBES)
+    if len(image) > args.partition_size:
+        sys.exit('image is %d bytes, partition holds %d' % (len(image), args.partition_size))
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('%d EPCs, %d slots, seed %d, %d bytes' % (len(epcs), (len(image) - HEADER_SIZE) // args.epc_len, seed, len(image)))
+    if args.port:
+        print('uploaded, generation %d active' % upload(args.port, args.baud, image, args.timeout))
+
+
+if __name__ == '__main__':
+    main()
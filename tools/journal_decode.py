@@ -0,0 +1,160 @@
+#!/usr/bin/env python
+"""
+Print the door event journal (see main/vm-5f_journal.c) as text, one record per line.
+
+Sources:
+    image    a copy of the journal partition, or the file backed image of a host build
+             esptool.py read_flash 0x290000 0x100000 journal.bin      # see partitions.csv
+             python tools/journal_decode.py journal.bin
+    export   the binary stream of the firmware's export command, fetched live (needs pyserial)
+             python tools/journal_decode.py --port /dev/ttyUSB0 --save journal.exp
+             or saved earlier with --save
+             python tools/journal_decode.py --export journal.exp
+
+Blocks with a bad CRC (torn by a power loss) are skipped and reported on stderr.
+"""
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+MAGIC = 0x4A4D5645
+SECTOR_SIZE = 4096
+BLOCK_SIZE = 256
+HEADER = struct.Struct('<IIIHHI8xI')
+RECORD = struct.Struct('<IIHBBBBBB12sI')
+EXPORT_CMD = b'J'
+
+EVENTS = {1: 'arrived', 2: 'departed', 3: 'door'}
+ACTIONS = {0: '-', 1: 'locked', 2: 'denied', 3: 'busy'}
+DOOR_STATES = {0: 'idle', 1: 'locked', 2: 'unlocking', 3: 'forced'}
+
+
+def parse_block(data):
+    """(header fields, records) of a block, None if it is not a valid block."""
+    if len(data) < HEADER.size:
+        return None
+    magic, sector_seq, first_seq, count, boot, records_crc, header_crc = HEADER.unpack_from(data)
+    if magic != MAGIC or not 1 <= count <= (BLOCK_SIZE - HEADER.size) // RECORD.size:
+        return None
+    if zlib.crc32(data[:HEADER.size - 4]) & 0xFFFFFFFF != header_crc:
+        return None
+    body = data[HEADER.size:HEADER.size + count * RECORD.size]
+    if len(body) != count * RECORD.size or zlib.crc32(body) & 0xFFFFFFFF != records_crc:
+        return None
+    records = [RECORD.unpack_from(body, i * RECORD.size) for i in range(count)]
+    return sector_seq, first_seq, count, boot, records
+
+
+def read_image(path):
+    """Records of a partition image, oldest first."""
+    with open(path, 'rb') as f:
+        image = f.read()
+    sectors = []
+    for s in range(len(image) // SECTOR_SIZE):
+        block = parse_block(image[s * SECTOR_SIZE:s * SECTOR_SIZE + BLOCK_SIZE])
+        if block:
+            sectors.append((block[0], s))
+    records = []
+    bad = 0
+    for _, s in sorted(sectors):
+        for b in range(SECTOR_SIZE // BLOCK_SIZE):
+            start = s * SECTOR_SIZE + b * BLOCK_SIZE
+            data = image[start:start + BLOCK_SIZE]
+            if data == b'\xff' * BLOCK_SIZE:
+                break
+            block = parse_block(data)
+            if block:
+                records.extend(block[4])
+            else:
+                bad += 1
+    if bad:
+        sys.stderr.write('%d bad blocks skipped\n' % bad)
+    return records
+
+
+def read_export(data):
+    """Records of an export stream: blocks back to back, ended by an all-zero header."""
+    records = []
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        if data[pos:pos + HEADER.size] == b'\0' * HEADER.size:
+            return records
+        count = HEADER.unpack_from(data, pos)[3]
+        block = parse_block(data[pos:pos + HEADER.size + count * RECORD.size])
+        if block is None:
+            sys.exit('export stream corrupt at byte %d' % pos)
+        records.extend(block[4])
+        pos += HEADER.size + count * RECORD.size
+    sys.exit('export stream ends without the end marker')
+
+
+def fetch_export(port, baud, timeout):
+    """Ask the firmware for an export and return the raw stream."""
+    import serial
+    ser = serial.Serial(port, baud, timeout=1)
+    ser.reset_input_buffer()
+    ser.write(EXPORT_CMD)
+    deadline = time.time() + timeout
+    while True:
+        line = ser.readline().decode('ascii', 'replace')
+        if line.startswith('#J export'):
+            break
+        if time.time() > deadline:
+            sys.exit('no answer to the export command')
+    ser.baudrate = int(line.split()[2])
+    data = bytearray()
+    while not data.endswith(b'\0' * HEADER.size):
+        chunk = ser.read(4096)
+        if not chunk:
+            sys.exit('export stream stalled after %d bytes' % len(data))
+        data += chunk
+    ser.baudrate = baud
+    ser.close()
+    return bytes(data)
+
+
+def render(rec):
+    seq, time_ms, boot, event, action, reader, ant, rssi, epc_len, epc, reads = rec
+    when = 'boot %u %d.%03d' % (boot, time_ms // 1000, time_ms % 1000)
+    if event == 3:
+        return '%8u %s door %s' % (seq, when, DOOR_STATES.get(action, action))
+    epc_hex = ''.join('%02x' % b for b in bytearray(epc[:min(epc_len, len(epc))]))
+    if epc_len > len(epc):
+        epc_hex += '..'                         # longer EPC, the record keeps its first bytes
+    return '%8u %s %-8s %-6s reader %u ant %u rssi %u reads %u epc %s' % (
+        seq, when, EVENTS.get(event, event), ACTIONS.get(action, action), reader, ant, rssi, reads, epc_hex)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('image', nargs='?', help='journal partition image')
+    ap.add_argument('--export', help='saved export stream')
+    ap.add_argument('--port', help='serial port of the door controller, fetch an export')
+    ap.add_argument('--baud', type=int, default=115200, help='console baud rate')
+    ap.add_argument('--timeout', type=float, default=5, help='wait for the export to start (s)')
+    ap.add_argument('--save', help='keep the fetched export stream in this file')
+    args = ap.parse_args()
+
+    if args.port:
+        data = fetch_export(args.port, args.baud, args.timeout)
+        if args.save:
+            with open(args.save, 'wb') as f:
+                f.write(data)
+        records = read_export(data)
+    elif args.export:
+        with open(args.export, 'rb') as f:
+            records = read_export(f.read())
+    elif args.image:
+        records = read_image(args.image)
+    else:
+        ap.error('give an image, --export or --port')
+
+    for rec in records:
+        print(render(rec))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+"""
+Render a console capture of firmware built with LOG_OUTPUT_BINARY=1.
+
+Lines of the form "#L <64 hex digits>" are log records (see main/vm-5f_log.c), they are
+decoded with the message list read from that same file. Other lines are passed through.
+
+    python tools/log_decode.py capture.txt
+    idf.py monitor | python tools/log_decode.py -
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct('<IIHBB5I')
+LEVELS = '-EWID'
+DEFAULT_SOURCE = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'main', 'vm-5f_log.c')
+
+
+def read_formats(path):
+    with open(path) as f:
+        text = f.read()
+    formats = re.findall(r'LOG_MSG\(\s*\w+\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', text)
+    if not formats:
+        sys.exit('%s: no LOG_MSG entries found' % path)
+    return formats
+
+
+def render(formats, data):
+    seq, time_us, msg_id, level, _, a0, a1, a2, a3, a4 = RECORD.unpack(data)
+    if msg_id < len(formats):
+        fmt = formats[msg_id]
+        nargs = len(re.findall(r'%[^%]', fmt.replace('%%', '')))
+        text = (fmt.replace('%u', '%d') % (a0, a1, a2, a3, a4)[:nargs])
+    else:
+        text = 'bad log id %d' % msg_id
+    level_char = LEVELS[level] if level < len(LEVELS) else '?'
+    return '[%d.%03d] %s %s' % (time_us // 1000000, (time_us // 1000) % 1000, level_char, text)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('capture', help="console capture, '-' for stdin")
+    ap.add_argument('--source', default=DEFAULT_SOURCE, help='vm-5f_log.c the firmware was built from')
+    args = ap.parse_args()
+
+    formats = read_formats(args.source)
+    f = sys.stdin if args.capture == '-' else open(args.capture)
+    for line in f:
+        line = line.rstrip('\r\n')
+        m = re.search(r'#L ([0-9a-fA-F]{%d})' % (RECORD.size * 2), line)
+        if m:
+            print(render(formats, bytes(bytearray.fromhex(m.group(1)))))
+        else:
+            print(line)
+
+
+if __name__ == '__main__':
+    main()